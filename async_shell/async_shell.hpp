@@ -0,0 +1,196 @@
+/**
+ * @file async_shell.hpp
+ * @author TNumFive
+ * @brief Shell that hands logs to a background thread.
+ * @version 0.1
+ * @date 2023-02-06
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef LOG2WHAT_ASYNC_SHELL_HPP
+#define LOG2WHAT_ASYNC_SHELL_HPP
+#include "../base/queue.hpp"
+#include "../base/writer.hpp"
+#include <atomic>
+#include <memory>
+#include <thread>
+namespace log2what
+{
+    /**
+     * @brief Shell that writes logs in a dedicated thread.
+     *
+     * @details Caller only builds the log and pushes it into a bounded
+     * lock-free queue, the drain thread calls the writer held. When the queue
+     * is full, caller waits with the given strategy, so no log is dropped.
+     */
+    class async_shell : public writer
+    {
+    public:
+        using string = std::string;
+        using unique_ptr_writer = std::unique_ptr<writer>;
+        /**
+         * @brief Construct a new async shell object.
+         *
+         * @param writer_unique_ptr Writer called by drain thread.
+         * @param capacity How many logs can be queued.
+         * @param strategy How drain thread and callers wait.
+         */
+        async_shell(unique_ptr_writer &&writer_unique_ptr =
+                        unique_ptr_writer{new writer},
+                    const size_t capacity = 8192,
+                    const wait_strategy strategy = wait_strategy::BLOCK)
+            : log_queue{capacity}, not_empty{strategy}, not_full{strategy},
+              drained{strategy}
+        {
+            this->writer_unique_ptr = std::move(writer_unique_ptr);
+            this->running.store(true);
+            this->drain_thread = std::thread{&async_shell::drain, this};
+        }
+        /**
+         * @brief Copy constructor deleted.
+         *
+         * @param other Other shell.
+         */
+        async_shell(const async_shell &other) = delete;
+        /**
+         * @brief Copy assign constructor deleted.
+         *
+         * @param other Other shell.
+         * @return async_shell& Self.
+         */
+        async_shell &operator=(const async_shell &other) = delete;
+        /**
+         * @brief Move constructor deleted.
+         *
+         * @param other Other shell.
+         */
+        async_shell(async_shell &&other) = delete;
+        /**
+         * @brief Move assign constructor deleted.
+         *
+         * @param other Other shell.
+         * @return async_shell& Self.
+         */
+        async_shell &operator=(async_shell &&other) = delete;
+        /**
+         * @brief Drain all queued logs and stop drain thread.
+         */
+        ~async_shell() override
+        {
+            this->running.store(false);
+            this->not_empty.notify();
+            if (this->drain_thread.joinable())
+            {
+                this->drain_thread.join();
+            }
+        }
+        /**
+         * @brief Queue log for drain thread.
+         *
+         * @param level Log level.
+         * @param module Module name.
+         * @param comment Content of log.
+         * @param data Data attached.
+         * @param timestamp_nano Timestamp of log in nanoseconds.
+         */
+        void write(const log_level level, const string &module,
+                   const string &comment, const string &data,
+                   const int64_t timestamp_nano = 0) override
+        {
+            int64_t timestamp =
+                timestamp_nano ? timestamp_nano : get_nano_timestamp();
+            log item{timestamp, level, module, comment, data};
+            auto &log_queue = this->log_queue;
+            if (!log_queue.try_push(std::move(item)))
+            {
+                this->not_full.wait_until(
+                    [&]() { return log_queue.try_push(std::move(item)); });
+            }
+            this->not_empty.notify();
+        }
+        /**
+         * @brief Wait until logs queued before are written, then flush writer.
+         *
+         * @details Writer is only flushed on request, by drain thread once
+         * logs queued before are written, so it batches otherwise.
+         */
+        void flush() override
+        {
+            size_t target = this->log_queue.pushed();
+            this->not_empty.notify();
+            this->drained.wait_until(
+                [&]() { return this->written.load() >= target; });
+            size_t ticket = this->flush_requested.fetch_add(1) + 1;
+            this->not_empty.notify();
+            this->drained.wait_until(
+                [&]() { return this->flushed.load() >= ticket; });
+        }
+
+    private:
+        unique_ptr_writer writer_unique_ptr;
+        mpsc_queue<log> log_queue;
+        wait_event not_empty;
+        wait_event not_full;
+        wait_event drained;
+        std::atomic<bool> running;
+        std::atomic<size_t> written{0};
+        /**
+         * @brief Flush requests made and honored by drain thread.
+         */
+        std::atomic<size_t> flush_requested{0};
+        std::atomic<size_t> flushed{0};
+        std::thread drain_thread;
+        /**
+         * @brief Logs written between two updates of written, so flush() is
+         * not starved while callers keep the queue non-empty.
+         */
+        static constexpr size_t drain_batch = 256;
+        /**
+         * @brief Loop of drain thread.
+         *
+         * @details Keep draining after stopped until queue is empty, so logs
+         * queued before destruction are not lost. Writer is flushed only when
+         * requested and once stopped.
+         */
+        void drain()
+        {
+            log item{0, log_level::TRACE, "", "", ""};
+            while (true)
+            {
+                this->not_empty.wait_until([&]() {
+                    return !this->log_queue.empty() || !this->running.load() ||
+                           this->flush_requested.load() !=
+                               this->flushed.load();
+                });
+                size_t count = 0;
+                while (count < drain_batch && this->log_queue.try_pop(item))
+                {
+                    this->writer_unique_ptr->write(item.level, item.module,
+                                                   item.comment, item.data,
+                                                   item.timestamp_nano);
+                    this->not_full.notify();
+                    count++;
+                }
+                if (count)
+                {
+                    this->written.store(this->log_queue.popped());
+                    this->drained.notify();
+                }
+                size_t requested = this->flush_requested.load();
+                if (requested != this->flushed.load())
+                {
+                    this->writer_unique_ptr->flush();
+                    this->flushed.store(requested);
+                    this->drained.notify();
+                }
+                if (!this->running.load() && this->log_queue.empty())
+                {
+                    this->writer_unique_ptr->flush();
+                    break;
+                }
+            }
+        }
+    };
+} // namespace log2what
+#endif
\ No newline at end of file
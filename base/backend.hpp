@@ -0,0 +1,439 @@
+/**
+ * @file backend.hpp
+ * @author TNumFive
+ * @brief Backend thread that drains per-thread queues of logger.
+ * @version 0.1
+ * @date 2023-02-08
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef LOG2WHAT_BACKEND_HPP
+#define LOG2WHAT_BACKEND_HPP
+
+#include "./common.hpp"
+#include "./format.hpp"
+#include "./queue.hpp"
+#include "./writer.hpp"
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace log2what
+{
+    /**
+     * @brief Backend that writes logs of many threads in one thread.
+     *
+     * @details Every producer thread lazily registers its own spsc queue, so
+     * producers never share a cache line. Backend thread merges heads of all
+     * queues by timestamp_nano, so logs visible in one drain pass are written
+     * in chronological order. When thread exits, its queue is marked closed
+     * and is dropped by backend after being drained.
+     */
+    class backend
+    {
+    public:
+        using string = std::string;
+        /**
+         * @brief Construct a new backend object.
+         *
+         * @param capacity How many logs each thread queue can hold.
+         * @param strategy How backend thread and producers wait.
+         */
+        backend(const size_t capacity = 1024,
+                const wait_strategy strategy = wait_strategy::BLOCK)
+            : not_empty{strategy}, not_full{strategy}, drained{strategy}
+        {
+            static std::atomic<uint64_t> id_counter{0};
+            this->id = ++id_counter;
+            this->capacity = capacity;
+            this->registry_version.store(0);
+            this->running.store(true);
+            this->drain_thread = std::thread{&backend::drain, this};
+        }
+        /**
+         * @brief Copy constructor deleted.
+         *
+         * @param other Other backend.
+         */
+        backend(const backend &other) = delete;
+        /**
+         * @brief Copy assign constructor deleted.
+         *
+         * @param other Other backend.
+         * @return backend& Self.
+         */
+        backend &operator=(const backend &other) = delete;
+        /**
+         * @brief Drain all queues and stop backend thread.
+         */
+        ~backend()
+        {
+            this->running.store(false);
+            this->not_empty.notify();
+            if (this->drain_thread.joinable())
+            {
+                this->drain_thread.join();
+            }
+            std::lock_guard<std::mutex> registry_lock{this->registry_mutex};
+            for (auto &&producer_ptr : this->producer_vector)
+            {
+                producer_ptr->detached.store(true);
+            }
+        }
+        /**
+         * @brief Add writer that backend thread writes logs to.
+         *
+         * @param writer_ptr Writer, must outlive backend.
+         */
+        void attach(writer *writer_ptr)
+        {
+            std::lock_guard<std::mutex> writer_lock{this->writer_mutex};
+            this->writer_ptr_vector.push_back(writer_ptr);
+        }
+        /**
+         * @brief Queue log into queue of calling thread.
+         *
+         * @param level Log level.
+         * @param module Module name.
+         * @param comment Content of log.
+         * @param data Data attached.
+         * @param timestamp_nano Timestamp of log in nanoseconds.
+         */
+        void write(const log_level level, const string &module,
+                   const string &comment, const string &data,
+                   const int64_t timestamp_nano = 0)
+        {
+            int64_t timestamp =
+                timestamp_nano ? timestamp_nano : get_nano_timestamp();
+            this->push(record{log{timestamp, level, module, comment, data}});
+        }
+        /**
+         * @brief Queue log whose comment is formatted by backend thread.
+         *
+         * @param level Log level.
+         * @param module Module name.
+         * @param format Checked format string, must be a string literal.
+         * @param packed Arguments packed by pack_args().
+         */
+        void write_format(const log_level level, const string &module,
+                          const char *format, string &&packed)
+        {
+            log item{get_nano_timestamp(), level, module, std::move(packed),
+                     string{}};
+            this->push(record{std::move(item), format});
+        }
+        /**
+         * @brief Wait until logs queued before are written, then flush
+         * writers.
+         */
+        void flush()
+        {
+            std::vector<std::pair<std::shared_ptr<producer>, size_t>> targets;
+            {
+                std::lock_guard<std::mutex> registry_lock{this->registry_mutex};
+                for (auto &&producer_ptr : this->producer_vector)
+                {
+                    targets.emplace_back(producer_ptr,
+                                         producer_ptr->log_queue.pushed());
+                }
+            }
+            this->not_empty.notify();
+            this->drained.wait_until([&]() {
+                for (auto &&target : targets)
+                {
+                    if (target.first->log_queue.popped() < target.second)
+                    {
+                        return false;
+                    }
+                }
+                return true;
+            });
+            std::lock_guard<std::mutex> writer_lock{this->writer_mutex};
+            for (auto &&writer_ptr : this->writer_ptr_vector)
+            {
+                writer_ptr->flush();
+            }
+        }
+
+    private:
+        /**
+         * @brief Log in queue, comment holds packed arguments if format set.
+         */
+        struct record
+        {
+            log item;
+            const char *format;
+            record(log &&item, const char *format = nullptr)
+                : item{std::move(item)}, format{format}
+            {
+            }
+        };
+        /**
+         * @brief Queue owned by one producer thread.
+         */
+        struct producer
+        {
+            spsc_queue<record> log_queue;
+            std::atomic<bool> closed{false};
+            std::atomic<bool> detached{false};
+            producer(const size_t capacity) : log_queue{capacity} {}
+        };
+        using thread_producer = std::pair<uint64_t, std::shared_ptr<producer>>;
+        /**
+         * @brief Queues registered by current thread, closed on thread exit.
+         */
+        struct thread_producers
+        {
+            uint64_t last_id = 0;
+            producer *last_ptr = nullptr;
+            std::vector<thread_producer> list;
+            ~thread_producers()
+            {
+                for (auto &&i : this->list)
+                {
+                    i.second->closed.store(true, std::memory_order_release);
+                }
+            }
+        };
+        using producer_ptr_vector = std::vector<std::shared_ptr<producer>>;
+        uint64_t id;
+        size_t capacity;
+        std::mutex registry_mutex;
+        producer_ptr_vector producer_vector;
+        std::atomic<size_t> registry_version;
+        std::mutex writer_mutex;
+        std::vector<writer *> writer_ptr_vector;
+        wait_event not_empty;
+        wait_event not_full;
+        wait_event drained;
+        std::atomic<bool> running;
+        std::thread drain_thread;
+        /**
+         * @brief Push record into queue of calling thread, wait if full.
+         *
+         * @param value Record to push.
+         */
+        void push(record &&value)
+        {
+            auto &log_queue = this->local_producer().log_queue;
+            if (!log_queue.try_push(std::move(value)))
+            {
+                this->not_empty.notify();
+                this->not_full.wait_until(
+                    [&]() { return log_queue.try_push(std::move(value)); });
+            }
+            this->not_empty.notify();
+        }
+        /**
+         * @brief Get queue of calling thread, register one if not exists.
+         *
+         * @return producer& Queue of calling thread.
+         */
+        producer &local_producer()
+        {
+            thread_local thread_producers local;
+            if (local.last_id == this->id)
+            {
+                return *local.last_ptr;
+            }
+            for (auto &&i : local.list)
+            {
+                if (i.first == this->id)
+                {
+                    local.last_id = this->id;
+                    local.last_ptr = i.second.get();
+                    return *local.last_ptr;
+                }
+            }
+            // drop queues whose backend is gone before registering new one.
+            auto &list = local.list;
+            list.erase(std::remove_if(list.begin(), list.end(),
+                                      [](const thread_producer &i) {
+                                          return i.second->detached.load();
+                                      }),
+                       list.end());
+            auto producer_ptr = std::make_shared<producer>(this->capacity);
+            {
+                std::lock_guard<std::mutex> registry_lock{this->registry_mutex};
+                this->producer_vector.push_back(producer_ptr);
+                this->registry_version++;
+            }
+            local.list.emplace_back(this->id, producer_ptr);
+            local.last_id = this->id;
+            local.last_ptr = producer_ptr.get();
+            return *local.last_ptr;
+        }
+        /**
+         * @brief Reload snapshot of registered queues if registry changed.
+         *
+         * @param snapshot Snapshot held by backend thread.
+         * @param version Version of snapshot.
+         */
+        void refresh(producer_ptr_vector &snapshot, size_t &version)
+        {
+            if (this->registry_version.load() == version)
+            {
+                return;
+            }
+            std::lock_guard<std::mutex> registry_lock{this->registry_mutex};
+            snapshot = this->producer_vector;
+            version = this->registry_version.load();
+        }
+        /**
+         * @brief Drop queues whose thread exited and which are drained.
+         *
+         * @param snapshot Snapshot held by backend thread.
+         */
+        void prune(producer_ptr_vector &snapshot)
+        {
+            bool any = false;
+            for (auto &&producer_ptr : snapshot)
+            {
+                // load closed first, so front() sees every push before it.
+                if (producer_ptr->closed.load(std::memory_order_acquire) &&
+                    producer_ptr->log_queue.front() == nullptr)
+                {
+                    producer_ptr->detached.store(true);
+                    any = true;
+                }
+            }
+            if (!any)
+            {
+                return;
+            }
+            std::lock_guard<std::mutex> registry_lock{this->registry_mutex};
+            auto &registry = this->producer_vector;
+            registry.erase(std::remove_if(registry.begin(), registry.end(),
+                                          [](const std::shared_ptr<producer>
+                                                 &producer_ptr) {
+                                              return producer_ptr->detached
+                                                  .load();
+                                          }),
+                           registry.end());
+            this->registry_version++;
+        }
+        /**
+         * @brief Loop of backend thread.
+         *
+         * @details Each pass does a k-way merge over heads of all queues with
+         * a min heap on timestamp_nano, taking logs stamped before the pass
+         * began. If every head is stamped later, the pass takes logs up to
+         * the latest head, so queues never stall on a clock stepped back.
+         * Keep draining after stopped until all queues are empty.
+         */
+        void drain()
+        {
+            using head = std::pair<int64_t, size_t>;
+            producer_ptr_vector snapshot;
+            size_t version = static_cast<size_t>(-1);
+            std::vector<head> heap;
+            auto later = std::greater<head>{};
+            auto has_logs = [&]() {
+                this->refresh(snapshot, version);
+                for (auto &&producer_ptr : snapshot)
+                {
+                    if (producer_ptr->log_queue.front() != nullptr)
+                    {
+                        return true;
+                    }
+                }
+                return false;
+            };
+            while (true)
+            {
+                this->not_empty.wait_until(
+                    [&]() { return has_logs() || !this->running.load(); });
+                // logs stamped after pass began wait for next pass, which
+                // keeps passes short and late pushes in order.
+                int64_t deadline = this->running.load()
+                                       ? get_nano_timestamp()
+                                       : std::numeric_limits<int64_t>::max();
+                heap.clear();
+                int64_t latest_head = std::numeric_limits<int64_t>::min();
+                for (size_t i = 0; i < snapshot.size(); i++)
+                {
+                    record *next = snapshot[i]->log_queue.front();
+                    if (next == nullptr)
+                    {
+                        continue;
+                    }
+                    latest_head =
+                        std::max(latest_head, next->item.timestamp_nano);
+                    if (next->item.timestamp_nano <= deadline)
+                    {
+                        heap.emplace_back(next->item.timestamp_nano, i);
+                    }
+                }
+                if (heap.empty() &&
+                    latest_head != std::numeric_limits<int64_t>::min())
+                {
+                    // all heads are stamped ahead of clock, after clock
+                    // stepped back or by callers, take them instead of
+                    // spinning until clock catches up.
+                    deadline = latest_head;
+                    for (size_t i = 0; i < snapshot.size(); i++)
+                    {
+                        record *next = snapshot[i]->log_queue.front();
+                        if (next != nullptr)
+                        {
+                            heap.emplace_back(next->item.timestamp_nano, i);
+                        }
+                    }
+                }
+                std::make_heap(heap.begin(), heap.end(), later);
+                {
+                    std::lock_guard<std::mutex> writer_lock{this->writer_mutex};
+                    while (!heap.empty())
+                    {
+                        std::pop_heap(heap.begin(), heap.end(), later);
+                        size_t index = heap.back().second;
+                        heap.pop_back();
+                        auto &log_queue = snapshot[index]->log_queue;
+                        this->dispatch(*log_queue.front());
+                        log_queue.pop();
+                        this->not_full.notify();
+                        record *next = log_queue.front();
+                        if (next != nullptr &&
+                            next->item.timestamp_nano <= deadline)
+                        {
+                            heap.emplace_back(next->item.timestamp_nano, index);
+                            std::push_heap(heap.begin(), heap.end(), later);
+                        }
+                    }
+                }
+                this->drained.notify();
+                this->prune(snapshot);
+                if (!this->running.load() && !has_logs())
+                {
+                    break;
+                }
+            }
+        }
+        /**
+         * @brief Format record if needed and write it to all writers attached.
+         *
+         * @param value Record to write.
+         */
+        void dispatch(record &value)
+        {
+            log &item = value.item;
+            if (value.format != nullptr)
+            {
+                item.comment = format_packed(value.format, item.comment);
+            }
+            for (auto &&writer_ptr : this->writer_ptr_vector)
+            {
+                writer_ptr->write(item.level, item.module, item.comment,
+                                  item.data, item.timestamp_nano);
+            }
+        }
+    };
+} // namespace log2what
+#endif
\ No newline at end of file
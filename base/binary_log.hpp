@@ -0,0 +1,169 @@
+/**
+ * @file binary_log.hpp
+ * @author TNumFive
+ * @brief Layout of binary log records and raw file writes, shared by
+ * file_writer and db_writer.
+ * @version 0.1
+ * @date 2023-02-13
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef LOG2WHAT_BINARY_LOG_HPP
+#define LOG2WHAT_BINARY_LOG_HPP
+
+#include "./common.hpp"
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+
+namespace log2what
+{
+    /**
+     * @brief Magic bytes at the beginning of every binary log file.
+     *
+     * @details The last byte is the version of layout. Integers are stored in
+     * host byte order (little endian on supported platforms).
+     */
+    static constexpr char binary_log_magic[] = "\x7fL2WBIN\x01";
+    static constexpr size_t binary_log_magic_size =
+        sizeof(binary_log_magic) - 1;
+
+    /**
+     * @brief Type of record in binary log file.
+     *
+     * @details Every record is "u32 length | u8 type | body", length counts
+     * type and body. MODULE body is "u32 id | name", defines or redefines a
+     * module id for following records of the same file. LOG body is
+     * "i64 timestamp_nano | u8 level | u32 module id | u32 comment length |
+     * comment | data".
+     */
+    enum class binary_record_type : uint8_t
+    {
+        MODULE = 1,
+        LOG = 2
+    };
+
+    /**
+     * @brief Size of fixed part of MODULE record.
+     */
+    static constexpr size_t binary_module_fixed_size =
+        sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint32_t);
+
+    /**
+     * @brief Size of fixed part of LOG record.
+     */
+    static constexpr size_t binary_log_fixed_size =
+        sizeof(uint32_t) + sizeof(uint8_t) + sizeof(int64_t) +
+        sizeof(uint8_t) + sizeof(uint32_t) + sizeof(uint32_t);
+
+    /**
+     * @brief Append raw bytes of integer.
+     *
+     * @tparam T Type of integer.
+     * @param buffer Buffer to append to.
+     * @param value Integer.
+     */
+    template <typename T>
+    inline void append_binary(std::string &buffer, const T value)
+    {
+        buffer.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    /**
+     * @brief Append MODULE record.
+     *
+     * @param buffer Buffer to append to.
+     * @param id Module id.
+     * @param module Module name.
+     */
+    inline void append_module_record(std::string &buffer, const uint32_t id,
+                                     const std::string &module)
+    {
+        uint32_t length = sizeof(uint8_t) + sizeof(uint32_t) + module.size();
+        append_binary<uint32_t>(buffer, length);
+        auto type = static_cast<uint8_t>(binary_record_type::MODULE);
+        append_binary<uint8_t>(buffer, type);
+        append_binary<uint32_t>(buffer, id);
+        buffer.append(module);
+    }
+
+    /**
+     * @brief Append LOG record.
+     *
+     * @param buffer Buffer to append to.
+     * @param timestamp_nano Timestamp in nanoseconds.
+     * @param level Log level.
+     * @param module_id Module id defined before.
+     * @param comment Content of log.
+     * @param data Data attached.
+     */
+    inline void append_log_record(std::string &buffer,
+                                  const int64_t timestamp_nano,
+                                  const log_level level,
+                                  const uint32_t module_id,
+                                  const std::string &comment,
+                                  const std::string &data)
+    {
+        uint32_t length = binary_log_fixed_size - sizeof(uint32_t) +
+                          comment.size() + data.size();
+        append_binary<uint32_t>(buffer, length);
+        auto type = static_cast<uint8_t>(binary_record_type::LOG);
+        append_binary<uint8_t>(buffer, type);
+        append_binary<int64_t>(buffer, timestamp_nano);
+        append_binary<uint8_t>(buffer, static_cast<uint8_t>(level));
+        append_binary<uint32_t>(buffer, module_id);
+        append_binary<uint32_t>(buffer, comment.size());
+        buffer.append(comment);
+        buffer.append(data);
+    }
+
+    /**
+     * @brief Read raw bytes of integer.
+     *
+     * @tparam T Type of integer.
+     * @param cursor Current position, moved forward.
+     * @return T Integer read.
+     */
+    template <typename T> inline T read_binary(const char *&cursor)
+    {
+        T value;
+        std::memcpy(&value, cursor, sizeof(value));
+        cursor += sizeof(value);
+        return value;
+    }
+
+    /**
+     * @brief Write all bytes at given offset, retry on partial writes.
+     *
+     * @param fd File descriptor.
+     * @param data Bytes to write.
+     * @param size Number of bytes.
+     * @param offset Offset in file.
+     * @return true If all written.
+     * @return false If write failed.
+     */
+    inline bool pwrite_all(const int fd, const char *data, size_t size,
+                           off_t offset)
+    {
+        while (size > 0)
+        {
+            ssize_t written = ::pwrite(fd, data, size, offset);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            data += written;
+            size -= written;
+            offset += written;
+        }
+        return true;
+    }
+} // namespace log2what
+#endif
\ No newline at end of file
@@ -29,6 +29,31 @@ namespace log2what
         ERROR = 16
     };
 
+/**
+ * @brief Least log level compiled in, calls of lower levels made through
+ * LOG2WHAT_TRACE-like macros are removed entirely.
+ */
+#ifndef LOG2WHAT_ACTIVE_LEVEL
+#define LOG2WHAT_ACTIVE_LEVEL 1
+#endif
+
+    /**
+     * @brief Get mask of all levels not less than given level.
+     *
+     * @param least Least level enabled.
+     * @return int Mask of enabled levels.
+     */
+    constexpr int get_level_mask(const log_level least)
+    {
+        return ~(static_cast<int>(least) - 1);
+    }
+
+    /**
+     * @brief Mask of levels compiled in.
+     */
+    static constexpr int active_level_mask =
+        get_level_mask(static_cast<log_level>(LOG2WHAT_ACTIVE_LEVEL));
+
     /**
      * @brief Convert log_level enum to string.
      *
@@ -57,6 +82,33 @@ namespace log2what
         }
     }
 
+    /**
+     * @brief Convert log_level enum to single letter.
+     *
+     * @details Same letter as to_string(), without building a string.
+     *
+     * @param level Log level to be converted.
+     * @return char Result letter.
+     */
+    inline char to_char(const log_level level)
+    {
+        switch (level)
+        {
+        case log_level::TRACE:
+            return 'T';
+        case log_level::DEBUG:
+            return 'D';
+        case log_level::INFO:
+            return 'I';
+        case log_level::WARN:
+            return 'W';
+        case log_level::ERROR:
+            return 'E';
+        default:
+            return 'U';
+        }
+    }
+
     /**
      * @brief Struct of log.
      */
@@ -126,7 +178,10 @@ namespace log2what
          *
          * @param other Other log.
          */
-        log(log &&other) { this->swap(std::move(other)); };
+        log(log &&other) : timestamp_nano{0}, level{log_level::TRACE}
+        {
+            this->swap(std::move(other));
+        };
         /**
          * @brief Move assign constructor.
          *
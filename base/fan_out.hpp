@@ -0,0 +1,286 @@
+/**
+ * @file fan_out.hpp
+ * @author TNumFive
+ * @brief Fan-out that writes every log to writers in parallel.
+ * @version 0.1
+ * @date 2023-03-01
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef LOG2WHAT_FAN_OUT_HPP
+#define LOG2WHAT_FAN_OUT_HPP
+
+#include "./common.hpp"
+#include "./queue.hpp"
+#include "./writer.hpp"
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace log2what
+{
+    /**
+     * @brief What a caller does when queue of a writer is full.
+     */
+    enum class overflow_policy : int
+    {
+        /**
+         * @brief Wait until writer catches up, no log is lost.
+         */
+        BLOCK = 1,
+        /**
+         * @brief Drop the log for this writer only and count it.
+         */
+        DROP = 2
+    };
+
+    /**
+     * @brief Fan-out that gives every writer its own queue and thread.
+     *
+     * @details Log is built once and shared by all queues through a
+     * std::shared_ptr, so adding a writer costs a reference count instead of
+     * a copy. Each writer drains its queue in its own thread, so a slow
+     * writer only delays itself, or with overflow_policy::DROP loses its own
+     * logs, while the others keep up. Logs of one caller thread reach every
+     * writer in order. Writers must be attached before logs are written.
+     */
+    class fan_out
+    {
+    public:
+        using string = std::string;
+        /**
+         * @brief Construct a new fan out object.
+         *
+         * @param capacity How many logs each writer can queue.
+         * @param strategy How writer threads and callers wait.
+         */
+        fan_out(const size_t capacity = 8192,
+                const wait_strategy strategy = wait_strategy::BLOCK)
+        {
+            this->capacity = capacity;
+            this->strategy = strategy;
+            this->running.store(true);
+        }
+        /**
+         * @brief Copy constructor deleted.
+         *
+         * @param other Other fan out.
+         */
+        fan_out(const fan_out &other) = delete;
+        /**
+         * @brief Copy assign constructor deleted.
+         *
+         * @param other Other fan out.
+         * @return fan_out& Self.
+         */
+        fan_out &operator=(const fan_out &other) = delete;
+        /**
+         * @brief Drain all queues and stop writer threads.
+         */
+        ~fan_out()
+        {
+            this->running.store(false);
+            for (auto &&sink_ptr : this->sink_vector)
+            {
+                sink_ptr->not_empty.notify();
+            }
+            for (auto &&sink_ptr : this->sink_vector)
+            {
+                if (sink_ptr->drain_thread.joinable())
+                {
+                    sink_ptr->drain_thread.join();
+                }
+            }
+        }
+        /**
+         * @brief Add writer with its own queue and thread.
+         *
+         * @param writer_ptr Writer, must outlive fan out.
+         * @param policy What callers do when its queue is full.
+         */
+        void attach(writer *writer_ptr,
+                    const overflow_policy policy = overflow_policy::BLOCK)
+        {
+            std::unique_ptr<sink> sink_ptr{
+                new sink{writer_ptr, policy, this->capacity, this->strategy}};
+            sink_ptr->drain_thread =
+                std::thread{&sink::drain, sink_ptr.get(),
+                            std::cref(this->running)};
+            this->sink_vector.push_back(std::move(sink_ptr));
+        }
+        /**
+         * @brief Queue log for every writer.
+         *
+         * @param level Log level.
+         * @param module Module name.
+         * @param comment Content of log.
+         * @param data Data attached.
+         * @param timestamp_nano Timestamp of log in nanoseconds.
+         */
+        void write(const log_level level, const string &module,
+                   const string &comment, const string &data,
+                   const int64_t timestamp_nano = 0)
+        {
+            int64_t timestamp =
+                timestamp_nano ? timestamp_nano : get_nano_timestamp();
+            auto item = std::make_shared<const log>(timestamp, level, module,
+                                                    comment, data);
+            for (auto &&sink_ptr : this->sink_vector)
+            {
+                sink_ptr->push(item);
+            }
+        }
+        /**
+         * @brief Wait until logs queued before are written and flushed by
+         * every writer.
+         *
+         * @details Writers are only flushed on request, by their own thread
+         * once logs queued before are written, so they batch otherwise.
+         */
+        void flush()
+        {
+            for (auto &&sink_ptr : this->sink_vector)
+            {
+                sink &current = *sink_ptr;
+                size_t target = current.log_queue.pushed();
+                current.not_empty.notify();
+                current.drained.wait_until(
+                    [&]() { return current.written.load() >= target; });
+                size_t ticket = current.flush_requested.fetch_add(1) + 1;
+                current.not_empty.notify();
+                current.drained.wait_until(
+                    [&]() { return current.flushed.load() >= ticket; });
+            }
+        }
+        /**
+         * @brief Number of logs dropped for a writer.
+         *
+         * @param index Index of writer in order attached.
+         * @return size_t Number of logs, 0 if index is out of range.
+         */
+        size_t dropped(const size_t index) const
+        {
+            if (index >= this->sink_vector.size())
+            {
+                return 0;
+            }
+            return this->sink_vector[index]->dropped.load();
+        }
+
+    private:
+        using shared_log = std::shared_ptr<const log>;
+        /**
+         * @brief Queue and thread of one writer.
+         */
+        struct sink
+        {
+            writer *writer_ptr;
+            overflow_policy policy;
+            mpsc_queue<shared_log> log_queue;
+            wait_event not_empty;
+            wait_event not_full;
+            wait_event drained;
+            std::atomic<size_t> written{0};
+            std::atomic<size_t> dropped{0};
+            /**
+             * @brief Flush requests made and honored by writer thread.
+             */
+            std::atomic<size_t> flush_requested{0};
+            std::atomic<size_t> flushed{0};
+            std::thread drain_thread;
+            /**
+             * @brief Logs written between two updates of written, so flush()
+             * is not starved while callers keep the queue non-empty.
+             */
+            static constexpr size_t drain_batch = 256;
+            sink(writer *writer_ptr, const overflow_policy policy,
+                 const size_t capacity, const wait_strategy strategy)
+                : writer_ptr{writer_ptr}, policy{policy}, log_queue{capacity},
+                  not_empty{strategy}, not_full{strategy}, drained{strategy}
+            {
+            }
+            /**
+             * @brief Share log with writer thread, wait or drop if full.
+             *
+             * @param item Log shared by all writers.
+             */
+            void push(const shared_log &item)
+            {
+                shared_log shared = item;
+                auto &log_queue = this->log_queue;
+                if (!log_queue.try_push(std::move(shared)))
+                {
+                    if (this->policy == overflow_policy::DROP)
+                    {
+                        this->dropped.fetch_add(1, std::memory_order_relaxed);
+                        return;
+                    }
+                    this->not_empty.notify();
+                    this->not_full.wait_until([&]() {
+                        return log_queue.try_push(std::move(shared));
+                    });
+                }
+                this->not_empty.notify();
+            }
+            /**
+             * @brief Loop of writer thread.
+             *
+             * @details Same as async_shell, keep draining after stopped until
+             * queue is empty. Writer is flushed only when requested and once
+             * stopped, so it keeps its own batching.
+             *
+             * @param running Cleared when fan out is destroyed.
+             */
+            void drain(const std::atomic<bool> &running)
+            {
+                shared_log item;
+                while (true)
+                {
+                    this->not_empty.wait_until([&]() {
+                        return !this->log_queue.empty() || !running.load() ||
+                               this->flush_requested.load() !=
+                                   this->flushed.load();
+                    });
+                    size_t count = 0;
+                    while (count < drain_batch &&
+                           this->log_queue.try_pop(item))
+                    {
+                        this->writer_ptr->write(item->level, item->module,
+                                                item->comment, item->data,
+                                                item->timestamp_nano);
+                        // last writer done with log frees it here.
+                        item.reset();
+                        this->not_full.notify();
+                        count++;
+                    }
+                    if (count)
+                    {
+                        this->written.store(this->log_queue.popped());
+                        this->drained.notify();
+                    }
+                    size_t requested = this->flush_requested.load();
+                    if (requested != this->flushed.load())
+                    {
+                        this->writer_ptr->flush();
+                        this->flushed.store(requested);
+                        this->drained.notify();
+                    }
+                    if (!running.load() && this->log_queue.empty())
+                    {
+                        this->writer_ptr->flush();
+                        break;
+                    }
+                }
+            }
+        };
+        size_t capacity;
+        wait_strategy strategy;
+        std::atomic<bool> running;
+        std::vector<std::unique_ptr<sink>> sink_vector;
+    };
+} // namespace log2what
+
+#endif
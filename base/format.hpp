@@ -0,0 +1,413 @@
+/**
+ * @file format.hpp
+ * @author TNumFive
+ * @brief Checked format strings and binary packed arguments.
+ * @version 0.1
+ * @date 2023-02-10
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef LOG2WHAT_FORMAT_HPP
+#define LOG2WHAT_FORMAT_HPP
+
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace log2what
+{
+    /**
+     * @brief Called when format string is invalid, not constexpr on purpose so
+     * that invalid format strings fail to compile.
+     *
+     * @param reason Why format string is invalid.
+     */
+    inline void format_string_error(const char *) {}
+
+    /**
+     * @brief Placeholder count of format string with unmatched brace.
+     */
+    constexpr size_t bad_format_string = static_cast<size_t>(-1);
+
+    /**
+     * @brief Count "{}" placeholders of format string.
+     *
+     * @tparam N Length of literal.
+     * @param str String literal.
+     * @return size_t Number of placeholders, bad_format_string if any brace
+     * is unmatched.
+     */
+    template <size_t N>
+    constexpr size_t count_placeholders(const char (&str)[N])
+    {
+        size_t placeholders = 0;
+        for (size_t i = 0; i + 1 < N; i++)
+        {
+            if (str[i] == '{' && str[i + 1] == '}')
+            {
+                placeholders++;
+                i++;
+            }
+            else if ((str[i] == '{' && str[i + 1] == '{') ||
+                     (str[i] == '}' && str[i + 1] == '}'))
+            {
+                i++;
+            }
+            else if (str[i] == '{' || str[i] == '}')
+            {
+                return bad_format_string;
+            }
+        }
+        return placeholders;
+    }
+
+    /**
+     * @brief Number of arguments as type, only used in unevaluated context so
+     * that arguments need not be constant.
+     *
+     * @tparam Args Types of arguments.
+     * @return std::integral_constant<size_t, sizeof...(Args)> Count.
+     */
+    template <typename... Args>
+    std::integral_constant<size_t, sizeof...(Args)>
+    count_format_args(const Args &...);
+
+    /**
+     * @brief Identity type, keeps format string out of argument deduction.
+     *
+     * @tparam T Type.
+     */
+    template <typename T> struct type_identity
+    {
+        using type = T;
+    };
+
+    /**
+     * @brief Format string literal already checked by LOG2WHAT_CHECK_FORMAT().
+     */
+    struct checked_format_literal
+    {
+        const char *str;
+    };
+
+    /**
+     * @brief Tag of format string checked by LOG2WHAT_CHECK_FORMAT(), only
+     * meant for the LOG2WHAT_INFOF() family.
+     */
+    struct format_checked
+    {
+    };
+
+    /**
+     * @brief Mark format string literal as checked.
+     *
+     * @details Binds tighter than comma, so "format_checked{} | __VA_ARGS__"
+     * only marks the first macro argument.
+     *
+     * @tparam N Length of literal.
+     * @param str String literal.
+     * @return checked_format_literal Checked format string.
+     */
+    template <size_t N>
+    constexpr checked_format_literal operator|(format_checked,
+                                               const char (&str)[N])
+    {
+        return checked_format_literal{str};
+    }
+
+    /**
+     * @brief Format string checked against argument types.
+     *
+     * @details Only "{}" placeholders are supported, "{{" and "}}" are
+     * escaped braces. Number of placeholders must match number of arguments.
+     * String literal is checked at compile time with C++20. C++17 can not
+     * check it, so only format strings checked by LOG2WHAT_CHECK_FORMAT()
+     * are accepted, use the LOG2WHAT_INFOF() family. Only the pointer is kept,
+     * so pass string literals only.
+     *
+     * @tparam Args Types of arguments.
+     */
+    template <typename... Args> class basic_format_string
+    {
+    public:
+#if defined __cpp_consteval
+        /**
+         * @brief Construct a new format string object.
+         *
+         * @tparam N Length of literal.
+         * @param str String literal.
+         */
+        template <size_t N>
+        consteval basic_format_string(const char (&str)[N]) : str{str}
+        {
+            const size_t placeholders = count_placeholders(str);
+            if (placeholders == bad_format_string)
+            {
+                format_string_error("unmatched brace in format string");
+            }
+            else if (placeholders != sizeof...(Args))
+            {
+                format_string_error("placeholders and arguments mismatch");
+            }
+        }
+#else
+        /**
+         * @brief Unchecked string literal is rejected with C++17.
+         *
+         * @tparam N Length of literal.
+         * @param str String literal.
+         */
+        template <size_t N>
+        basic_format_string(const char (&str)[N]) : str{str}
+        {
+            static_assert(N == 0, "format string can not be checked with "
+                                  "C++17, use LOG2WHAT_INFOF() and the like");
+        }
+#endif
+        /**
+         * @brief Construct a new format string object from checked literal.
+         *
+         * @param checked Format string checked by LOG2WHAT_CHECK_FORMAT().
+         */
+        constexpr basic_format_string(const checked_format_literal checked)
+            : str{checked.str}
+        {
+        }
+        /**
+         * @brief Get the format string.
+         *
+         * @return const char* Format string.
+         */
+        constexpr const char *get() const { return this->str; }
+
+    private:
+        const char *str;
+    };
+
+    /**
+     * @brief Format string of given argument types.
+     *
+     * @tparam Args Types of arguments.
+     */
+    template <typename... Args>
+    using format_string =
+        basic_format_string<typename type_identity<Args>::type...>;
+
+    /**
+     * @brief Type tag of packed argument.
+     */
+    enum class arg_type : char
+    {
+        INT = 'i',
+        UINT = 'u',
+        DOUBLE = 'd',
+        BOOL = 'b',
+        CHAR = 'c',
+        STRING = 's'
+    };
+
+    /**
+     * @brief Append raw bytes of trivially copyable value.
+     *
+     * @tparam T Type of value.
+     * @param packed Packed arguments.
+     * @param value Value to append.
+     */
+    template <typename T> inline void pack_raw(std::string &packed, T value)
+    {
+        packed.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    /**
+     * @brief Append one argument with its type tag.
+     *
+     * @tparam T Type of argument.
+     * @param packed Packed arguments.
+     * @param value Argument.
+     */
+    template <typename T>
+    inline void pack_arg(std::string &packed, const T &value)
+    {
+        if constexpr (std::is_same<T, bool>::value)
+        {
+            packed.push_back(static_cast<char>(arg_type::BOOL));
+            packed.push_back(value ? 1 : 0);
+        }
+        else if constexpr (std::is_same<T, char>::value)
+        {
+            packed.push_back(static_cast<char>(arg_type::CHAR));
+            packed.push_back(value);
+        }
+        else if constexpr (std::is_integral<T>::value &&
+                           std::is_signed<T>::value)
+        {
+            packed.push_back(static_cast<char>(arg_type::INT));
+            pack_raw<int64_t>(packed, value);
+        }
+        else if constexpr (std::is_integral<T>::value)
+        {
+            packed.push_back(static_cast<char>(arg_type::UINT));
+            pack_raw<uint64_t>(packed, value);
+        }
+        else if constexpr (std::is_floating_point<T>::value)
+        {
+            packed.push_back(static_cast<char>(arg_type::DOUBLE));
+            pack_raw<double>(packed, value);
+        }
+        else if constexpr (std::is_convertible<const T &, const char *>::value)
+        {
+            const char *str = value;
+            std::string_view view{str ? str : "(null)"};
+            packed.push_back(static_cast<char>(arg_type::STRING));
+            pack_raw<uint32_t>(packed, view.size());
+            packed.append(view.data(), view.size());
+        }
+        else
+        {
+            static_assert(
+                std::is_convertible<const T &, std::string_view>::value,
+                "argument must be integer, float, char or string");
+            std::string_view view{value};
+            packed.push_back(static_cast<char>(arg_type::STRING));
+            pack_raw<uint32_t>(packed, view.size());
+            packed.append(view.data(), view.size());
+        }
+    }
+
+    /**
+     * @brief Pack arguments into compact binary form.
+     *
+     * @tparam Args Types of arguments.
+     * @param args Arguments.
+     * @return std::string Packed arguments.
+     */
+    template <typename... Args>
+    inline std::string pack_args(const Args &...args)
+    {
+        std::string packed;
+        (pack_arg(packed, args), ...);
+        return packed;
+    }
+
+    /**
+     * @brief Read raw bytes of trivially copyable value.
+     *
+     * @tparam T Type of value.
+     * @param cursor Current position, moved forward.
+     * @return T Value read.
+     */
+    template <typename T> inline T unpack_raw(const char *&cursor)
+    {
+        T value;
+        std::memcpy(&value, cursor, sizeof(value));
+        cursor += sizeof(value);
+        return value;
+    }
+
+    /**
+     * @brief Append next packed argument as text.
+     *
+     * @param out Output string.
+     * @param cursor Current position in packed arguments, moved forward.
+     */
+    inline void unpack_arg(std::string &out, const char *&cursor)
+    {
+        char buffer[32];
+        std::to_chars_result result{buffer, std::errc{}};
+        switch (static_cast<arg_type>(*cursor++))
+        {
+        case arg_type::INT:
+            result = std::to_chars(buffer, buffer + sizeof(buffer),
+                                   unpack_raw<int64_t>(cursor));
+            break;
+        case arg_type::UINT:
+            result = std::to_chars(buffer, buffer + sizeof(buffer),
+                                   unpack_raw<uint64_t>(cursor));
+            break;
+        case arg_type::DOUBLE:
+            result = std::to_chars(buffer, buffer + sizeof(buffer),
+                                   unpack_raw<double>(cursor));
+            break;
+        case arg_type::BOOL:
+            out.append(*cursor++ ? "true" : "false");
+            return;
+        case arg_type::CHAR:
+            out.push_back(*cursor++);
+            return;
+        case arg_type::STRING:
+        {
+            uint32_t size = unpack_raw<uint32_t>(cursor);
+            out.append(cursor, size);
+            cursor += size;
+            return;
+        }
+        default:
+            out.append("{?}");
+            return;
+        }
+        out.append(buffer, result.ptr);
+    }
+
+    /**
+     * @brief Format packed arguments with format string.
+     *
+     * @param format Checked format string.
+     * @param packed Arguments packed by pack_args().
+     * @return std::string Formatted string.
+     */
+    inline std::string format_packed(const char *format,
+                                     const std::string &packed)
+    {
+        std::string out;
+        out.reserve(std::strlen(format) + packed.size());
+        const char *cursor = packed.data();
+        const char *end = cursor + packed.size();
+        for (const char *p = format; *p; p++)
+        {
+            if (p[0] == '{' && p[1] == '}')
+            {
+                if (cursor < end)
+                {
+                    unpack_arg(out, cursor);
+                }
+                p++;
+                continue;
+            }
+            if ((p[0] == '{' && p[1] == '{') || (p[0] == '}' && p[1] == '}'))
+            {
+                p++;
+            }
+            out.push_back(*p);
+        }
+        return out;
+    }
+} // namespace log2what
+
+/**
+ * @brief First of macro arguments, the format string literal.
+ */
+#define LOG2WHAT_FORMAT_FIRST(...) LOG2WHAT_FORMAT_FIRST_(__VA_ARGS__, unused)
+#define LOG2WHAT_FORMAT_FIRST_(first, ...) first
+/**
+ * @brief Check format string literal against arguments at compile time,
+ * works with C++17 where basic_format_string can not be consteval.
+ *
+ * @details Takes the format string followed by arguments, arguments are not
+ * evaluated.
+ */
+#define LOG2WHAT_CHECK_FORMAT(...)                                             \
+    static_assert(::log2what::count_placeholders(                             \
+                      LOG2WHAT_FORMAT_FIRST(__VA_ARGS__)) !=                   \
+                      ::log2what::bad_format_string,                           \
+                  "unmatched brace in format string");                         \
+    static_assert(::log2what::count_placeholders(                             \
+                      LOG2WHAT_FORMAT_FIRST(__VA_ARGS__)) +                    \
+                          1 ==                                                 \
+                      decltype(::log2what::count_format_args(                  \
+                          __VA_ARGS__))::value,                                \
+                  "placeholders and arguments mismatch")
+#endif
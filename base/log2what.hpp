@@ -12,8 +12,12 @@
 #ifndef LOG2WHAT_LOG2_HPP
 #define LOG2WHAT_LOG2_HPP
 
+#include "./backend.hpp"
 #include "./common.hpp"
+#include "./fan_out.hpp"
+#include "./format.hpp"
 #include "./writer.hpp"
+#include <atomic>
 #include <memory>
 #include <string>
 #include <vector>
@@ -32,7 +36,11 @@ namespace log2what
          *
          * @param module Name of module.
          */
-        logger(string module = "root") { this->module == module; }
+        logger(string module = "root")
+        {
+            this->module = module;
+            this->level_mask.store(get_level_mask(log_level::TRACE));
+        }
         /**
          * @brief Copy constructor deleted.
          *
@@ -67,7 +75,10 @@ namespace log2what
          */
         void trace(const string &comment = "", const string &data = "")
         {
-            this->write(log_level::TRACE, comment, data);
+            if (this->is_enabled(log_level::TRACE))
+            {
+                this->write(log_level::TRACE, comment, data);
+            }
         }
         /**
          * @brief Write debug level log.
@@ -77,7 +88,10 @@ namespace log2what
          */
         void debug(const string &comment = "", const string &data = "")
         {
-            this->write(log_level::DEBUG, comment, data);
+            if (this->is_enabled(log_level::DEBUG))
+            {
+                this->write(log_level::DEBUG, comment, data);
+            }
         }
         /**
          * @brief Write info level log.
@@ -87,7 +101,10 @@ namespace log2what
          */
         void info(const string &comment = "", const string &data = "")
         {
-            this->write(log_level::INFO, comment, data);
+            if (this->is_enabled(log_level::INFO))
+            {
+                this->write(log_level::INFO, comment, data);
+            }
         }
         /**
          * @brief Write warn level log.
@@ -97,7 +114,10 @@ namespace log2what
          */
         void warn(const string &comment = "", const string &data = "")
         {
-            this->write(log_level::WARN, comment, data);
+            if (this->is_enabled(log_level::WARN))
+            {
+                this->write(log_level::WARN, comment, data);
+            }
         }
         /**
          * @brief Write error level log.
@@ -107,11 +127,152 @@ namespace log2what
          */
         void error(const string &comment = "", const string &data = "")
         {
-            this->write(log_level::ERROR, comment, data);
+            if (this->is_enabled(log_level::ERROR))
+            {
+                this->write(log_level::ERROR, comment, data);
+            }
+        }
+        /**
+         * @brief Write log with deferred formatting.
+         *
+         * @details Arguments are packed in binary. When backend is enabled,
+         * only the pointer of format string is queued and formatting is done
+         * by backend thread, otherwise log is formatted right away.
+         *
+         * @tparam Args Types of arguments.
+         * @param level Level of log.
+         * @param format Checked format string.
+         * @param args Arguments.
+         */
+        template <typename... Args>
+        void writef(const log_level level, format_string<Args...> format,
+                    const Args &...args)
+        {
+            if (!this->is_enabled(level))
+            {
+                return;
+            }
+            string packed = pack_args(args...);
+            if (this->backend_unique_ptr)
+            {
+                this->backend_unique_ptr->write_format(
+                    level, this->module, format.get(), std::move(packed));
+                return;
+            }
+            this->write(level, format_packed(format.get(), packed), "");
+        }
+        /**
+         * @brief Write trace level log with deferred formatting.
+         *
+         * @tparam Args Types of arguments.
+         * @param format Checked format string.
+         * @param args Arguments.
+         */
+        template <typename... Args>
+        void tracef(format_string<Args...> format, const Args &...args)
+        {
+            this->writef<Args...>(log_level::TRACE, format, args...);
+        }
+        /**
+         * @brief Write debug level log with deferred formatting.
+         *
+         * @tparam Args Types of arguments.
+         * @param format Checked format string.
+         * @param args Arguments.
+         */
+        template <typename... Args>
+        void debugf(format_string<Args...> format, const Args &...args)
+        {
+            this->writef<Args...>(log_level::DEBUG, format, args...);
+        }
+        /**
+         * @brief Write info level log with deferred formatting.
+         *
+         * @tparam Args Types of arguments.
+         * @param format Checked format string.
+         * @param args Arguments.
+         */
+        template <typename... Args>
+        void infof(format_string<Args...> format, const Args &...args)
+        {
+            this->writef<Args...>(log_level::INFO, format, args...);
+        }
+        /**
+         * @brief Write warn level log with deferred formatting.
+         *
+         * @tparam Args Types of arguments.
+         * @param format Checked format string.
+         * @param args Arguments.
+         */
+        template <typename... Args>
+        void warnf(format_string<Args...> format, const Args &...args)
+        {
+            this->writef<Args...>(log_level::WARN, format, args...);
+        }
+        /**
+         * @brief Write error level log with deferred formatting.
+         *
+         * @tparam Args Types of arguments.
+         * @param format Checked format string.
+         * @param args Arguments.
+         */
+        template <typename... Args>
+        void errorf(format_string<Args...> format, const Args &...args)
+        {
+            this->writef<Args...>(log_level::ERROR, format, args...);
+        }
+        /**
+         * @brief Flush logs held by logger and its writers.
+         */
+        virtual void flush() {}
+        /**
+         * @brief Set least level of logs to write.
+         *
+         * @param least Least level enabled.
+         */
+        void set_level(const log_level least)
+        {
+            this->level_mask.store(get_level_mask(least),
+                                   std::memory_order_relaxed);
+        }
+        /**
+         * @brief Check if logs of given level will be written.
+         *
+         * @details One load and one bit test, levels stripped at compile time
+         * fold to false.
+         *
+         * @param level Level of log.
+         * @return true Yes.
+         * @return false No.
+         */
+        bool is_enabled(const log_level level) const
+        {
+            return static_cast<int>(level) & active_level_mask &
+                   this->level_mask.load(std::memory_order_relaxed);
         }
 
     protected:
+        using unique_ptr_backend = std::unique_ptr<backend>;
         string module;
+        /**
+         * @brief Backend thread used instead of caller thread when enabled.
+         */
+        unique_ptr_backend backend_unique_ptr;
+        /**
+         * @brief Mask of levels enabled at runtime.
+         */
+        std::atomic<int> level_mask;
+        /**
+         * @brief Swap level mask with other logger.
+         *
+         * @param other Other logger.
+         */
+        void swap_level(logger &other)
+        {
+            int mask = this->level_mask.load();
+            this->level_mask.store(other.level_mask.load());
+            other.level_mask.store(mask);
+        }
     };
 
     /**
@@ -162,9 +323,24 @@ namespace log2what
          */
         log2one &operator=(log2one &&other) { return this->swap(other); }
         /**
-         * @brief Default destructor.
+         * @brief Stop backend before writer is destroyed.
          */
-        ~log2one() override = default;
+        ~log2one() override { this->backend_unique_ptr.reset(); }
+        /**
+         * @brief Write logs in backend thread instead of caller thread.
+         *
+         * @param capacity How many logs each caller thread can queue.
+         * @param strategy How backend thread and callers wait.
+         * @return log2one& Self.
+         */
+        log2one &enable_backend(const size_t capacity = 1024,
+                                const wait_strategy strategy =
+                                    wait_strategy::BLOCK)
+        {
+            this->backend_unique_ptr.reset(new backend{capacity, strategy});
+            this->backend_unique_ptr->attach(this->writer_unique_ptr.get());
+            return *this;
+        }
         /**
          * @brief Use writer to write log.
          *
@@ -175,8 +351,26 @@ namespace log2what
         void write(const log_level level, const string &comment,
                    const string &data) override
         {
+            if (this->backend_unique_ptr)
+            {
+                this->backend_unique_ptr->write(level, this->module, comment,
+                                                data);
+                return;
+            }
             this->writer_unique_ptr->write(level, this->module, comment, data);
         }
+        /**
+         * @brief Flush backend if enabled, then writer.
+         */
+        void flush() override
+        {
+            if (this->backend_unique_ptr)
+            {
+                this->backend_unique_ptr->flush();
+                return;
+            }
+            this->writer_unique_ptr->flush();
+        }
 
     protected:
         unique_ptr_writer writer_unique_ptr;
@@ -192,6 +386,8 @@ namespace log2what
             {
                 std::swap(this->module, other.module);
                 std::swap(this->writer_unique_ptr, other.writer_unique_ptr);
+                std::swap(this->backend_unique_ptr, other.backend_unique_ptr);
+                this->swap_level(other);
             }
             return *this;
         }
@@ -199,6 +395,10 @@ namespace log2what
 
     /**
      * @brief Logger with lots of writers.
+     *
+     * @details Writers are called one after another by caller thread, by
+     * one backend thread with enable_backend(), or each by its own thread
+     * with enable_fan_out(), so a slow writer does not delay the others.
      */
     class log2lots : public logger
     {
@@ -238,21 +438,97 @@ namespace log2what
          */
         log2lots &operator=(log2lots &&other) { return this->swap(other); }
         /**
-         * @brief Default destructor.
+         * @brief Stop backend and fan out before writers are destroyed.
          */
-        ~log2lots() override = default;
+        ~log2lots() override
+        {
+            this->backend_unique_ptr.reset();
+            this->fan_out_unique_ptr.reset();
+        }
         /**
          * @brief Add writer to writer vector
          *
          * @param writer_unique_ptr new unique pointer of writer
+         * @param policy What callers do when queue of writer is full, only
+         * used with fan out.
          * @return log2lots Self.
          */
-        virtual log2lots &append_writer(unique_ptr_writer &&writer_unique_ptr)
+        virtual log2lots &
+        append_writer(unique_ptr_writer &&writer_unique_ptr,
+                      const overflow_policy policy = overflow_policy::BLOCK)
         {
+            if (this->backend_unique_ptr)
+            {
+                this->backend_unique_ptr->attach(writer_unique_ptr.get());
+            }
+            if (this->fan_out_unique_ptr)
+            {
+                this->fan_out_unique_ptr->attach(writer_unique_ptr.get(),
+                                                 policy);
+            }
             this->writer_unique_ptr_vector.push_back(
                 std::move(writer_unique_ptr));
+            this->policy_vector.push_back(policy);
+            return *this;
+        }
+        /**
+         * @brief Write logs in backend thread instead of caller thread.
+         *
+         * @param capacity How many logs each caller thread can queue.
+         * @param strategy How backend thread and callers wait.
+         * @return log2lots& Self.
+         */
+        log2lots &enable_backend(const size_t capacity = 1024,
+                                 const wait_strategy strategy =
+                                     wait_strategy::BLOCK)
+        {
+            this->fan_out_unique_ptr.reset();
+            this->backend_unique_ptr.reset(new backend{capacity, strategy});
+            for (auto &&writer_unique_ptr : this->writer_unique_ptr_vector)
+            {
+                this->backend_unique_ptr->attach(writer_unique_ptr.get());
+            }
             return *this;
         }
+        /**
+         * @brief Write logs to each writer in its own thread, replaces
+         * backend.
+         *
+         * @details Log is built once and shared by queues of all writers.
+         * Writers should be appended before logging starts.
+         *
+         * @param capacity How many logs each writer can queue.
+         * @param strategy How writer threads and callers wait.
+         * @return log2lots& Self.
+         */
+        log2lots &enable_fan_out(const size_t capacity = 8192,
+                                 const wait_strategy strategy =
+                                     wait_strategy::BLOCK)
+        {
+            this->backend_unique_ptr.reset();
+            this->fan_out_unique_ptr.reset(new fan_out{capacity, strategy});
+            for (size_t i = 0; i < this->writer_unique_ptr_vector.size(); i++)
+            {
+                this->fan_out_unique_ptr->attach(
+                    this->writer_unique_ptr_vector[i].get(),
+                    this->policy_vector[i]);
+            }
+            return *this;
+        }
+        /**
+         * @brief Number of logs dropped for a writer by fan out.
+         *
+         * @param index Index of writer in order appended.
+         * @return size_t Number of logs, 0 if fan out is not enabled.
+         */
+        size_t dropped(const size_t index) const
+        {
+            if (!this->fan_out_unique_ptr)
+            {
+                return 0;
+            }
+            return this->fan_out_unique_ptr->dropped(index);
+        }
         /**
          * @brief Use writer to write log.
          *
@@ -263,14 +539,54 @@ namespace log2what
         void write(const log_level level, const string &comment,
                    const string &data) override
         {
+            if (this->backend_unique_ptr)
+            {
+                this->backend_unique_ptr->write(level, this->module, comment,
+                                                data);
+                return;
+            }
+            if (this->fan_out_unique_ptr)
+            {
+                this->fan_out_unique_ptr->write(level, this->module, comment,
+                                                data);
+                return;
+            }
             for (auto &&writer_unique_ptr : this->writer_unique_ptr_vector)
             {
                 writer_unique_ptr->write(level, this->module, comment, data);
             }
         }
+        /**
+         * @brief Flush backend or fan out if enabled, then writers.
+         */
+        void flush() override
+        {
+            if (this->backend_unique_ptr)
+            {
+                this->backend_unique_ptr->flush();
+                return;
+            }
+            if (this->fan_out_unique_ptr)
+            {
+                this->fan_out_unique_ptr->flush();
+                return;
+            }
+            for (auto &&writer_unique_ptr : this->writer_unique_ptr_vector)
+            {
+                writer_unique_ptr->flush();
+            }
+        }
 
     protected:
         std::vector<unique_ptr_writer> writer_unique_ptr_vector;
+        /**
+         * @brief Overflow policy of each writer, same order as writers.
+         */
+        std::vector<overflow_policy> policy_vector;
+        /**
+         * @brief Queue and thread per writer used when enabled.
+         */
+        std::unique_ptr<fan_out> fan_out_unique_ptr;
         /**
          * @brief Implementation of swap action.
          *
@@ -284,9 +600,68 @@ namespace log2what
                 std::swap(this->module, other.module);
                 std::swap(this->writer_unique_ptr_vector,
                           other.writer_unique_ptr_vector);
+                std::swap(this->policy_vector, other.policy_vector);
+                std::swap(this->backend_unique_ptr, other.backend_unique_ptr);
+                std::swap(this->fan_out_unique_ptr, other.fan_out_unique_ptr);
+                this->swap_level(other);
             }
             return *this;
         }
     };
 } // namespace log2what
-#endif
\ No newline at end of file
+
+/**
+ * @brief Call level method of logger only if level is enabled.
+ *
+ * @details Arguments are not evaluated when level is disabled, and the whole
+ * call is removed when level is below LOG2WHAT_ACTIVE_LEVEL.
+ */
+#define LOG2WHAT_LOG_IF(logger, level, method, ...)                            \
+    do                                                                         \
+    {                                                                          \
+        if ((static_cast<int>(level) & ::log2what::active_level_mask) &&       \
+            (logger).is_enabled(level))                                        \
+        {                                                                      \
+            (logger).method(__VA_ARGS__);                                      \
+        }                                                                      \
+    } while (0)
+#define LOG2WHAT_TRACE(logger, ...)                                            \
+    LOG2WHAT_LOG_IF(logger, ::log2what::log_level::TRACE, trace, __VA_ARGS__)
+#define LOG2WHAT_DEBUG(logger, ...)                                            \
+    LOG2WHAT_LOG_IF(logger, ::log2what::log_level::DEBUG, debug, __VA_ARGS__)
+#define LOG2WHAT_INFO(logger, ...)                                             \
+    LOG2WHAT_LOG_IF(logger, ::log2what::log_level::INFO, info, __VA_ARGS__)
+#define LOG2WHAT_WARN(logger, ...)                                             \
+    LOG2WHAT_LOG_IF(logger, ::log2what::log_level::WARN, warn, __VA_ARGS__)
+#define LOG2WHAT_ERROR(logger, ...)                                            \
+    LOG2WHAT_LOG_IF(logger, ::log2what::log_level::ERROR, error, __VA_ARGS__)
+/**
+ * @brief Call deferred formatting method of logger only if level is enabled,
+ * format string is checked at compile time even with C++17.
+ *
+ * @details Format string is passed marked as checked, the only form the
+ * methods accept with C++17.
+ */
+#define LOG2WHAT_LOG_FORMAT_IF(logger, level, method, ...)                     \
+    do                                                                         \
+    {                                                                          \
+        LOG2WHAT_CHECK_FORMAT(__VA_ARGS__);                                    \
+        LOG2WHAT_LOG_IF(logger, level, method,                                 \
+                        ::log2what::format_checked{} | __VA_ARGS__);           \
+    } while (0)
+#define LOG2WHAT_TRACEF(logger, ...)                                           \
+    LOG2WHAT_LOG_FORMAT_IF(logger, ::log2what::log_level::TRACE, tracef,       \
+                           __VA_ARGS__)
+#define LOG2WHAT_DEBUGF(logger, ...)                                           \
+    LOG2WHAT_LOG_FORMAT_IF(logger, ::log2what::log_level::DEBUG, debugf,       \
+                           __VA_ARGS__)
+#define LOG2WHAT_INFOF(logger, ...)                                            \
+    LOG2WHAT_LOG_FORMAT_IF(logger, ::log2what::log_level::INFO, infof,         \
+                           __VA_ARGS__)
+#define LOG2WHAT_WARNF(logger, ...)                                            \
+    LOG2WHAT_LOG_FORMAT_IF(logger, ::log2what::log_level::WARN, warnf,         \
+                           __VA_ARGS__)
+#define LOG2WHAT_ERRORF(logger, ...)                                           \
+    LOG2WHAT_LOG_FORMAT_IF(logger, ::log2what::log_level::ERROR, errorf,       \
+                           __VA_ARGS__)
+#endif
@@ -0,0 +1,621 @@
+/**
+ * @file queue.hpp
+ * @author TNumFive
+ * @brief Bounded lock-free queues and wait strategies used by async shells.
+ * @version 0.1
+ * @date 2023-02-06
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef LOG2WHAT_QUEUE_HPP
+#define LOG2WHAT_QUEUE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+
+namespace log2what
+{
+    /**
+     * @brief Size of cache line, used to keep hot atomics apart.
+     */
+    static constexpr size_t cache_line_size = 64;
+
+    /**
+     * @brief How a thread waits when the queue is empty or full.
+     */
+    enum class wait_strategy : int
+    {
+        SPIN = 1,
+        YIELD = 2,
+        BLOCK = 4
+    };
+
+    /**
+     * @brief Event that can be waited on with a given wait strategy.
+     *
+     * @details With BLOCK strategy, waiter spins shortly and then sleeps on a
+     * condition variable, notifier only takes the mutex when someone is
+     * actually sleeping, so notify() costs one fence and one load otherwise.
+     */
+    class wait_event
+    {
+    public:
+        /**
+         * @brief Construct a new wait event object.
+         *
+         * @param strategy How to wait.
+         */
+        wait_event(const wait_strategy strategy = wait_strategy::BLOCK)
+        {
+            this->strategy = strategy;
+            this->sleepers.store(0);
+        }
+        /**
+         * @brief Copy constructor deleted.
+         *
+         * @param other Other event.
+         */
+        wait_event(const wait_event &other) = delete;
+        /**
+         * @brief Copy assign constructor deleted.
+         *
+         * @param other Other event.
+         * @return wait_event& Self.
+         */
+        wait_event &operator=(const wait_event &other) = delete;
+        /**
+         * @brief Wait until given predicate returns true.
+         *
+         * @tparam Pred Type of predicate.
+         * @param ready Predicate to check.
+         */
+        template <typename Pred> void wait_until(Pred &&ready)
+        {
+            constexpr int spin_limit = 64;
+            constexpr auto sleep_limit = std::chrono::milliseconds(10);
+            for (int i = 0; i < spin_limit; i++)
+            {
+                if (ready())
+                {
+                    return;
+                }
+            }
+            // ready() may have side effects, never call it again once true.
+            bool done = false;
+            while (!done)
+            {
+                switch (this->strategy)
+                {
+                case wait_strategy::SPIN:
+                    done = ready();
+                    break;
+                case wait_strategy::YIELD:
+                    std::this_thread::yield();
+                    done = ready();
+                    break;
+                default:
+                {
+                    std::unique_lock<std::mutex> lock{this->sleep_mutex};
+                    this->sleepers.fetch_add(1);
+                    // timeout is only a safety net for lost wake-ups.
+                    done = this->sleep_cv.wait_for(lock, sleep_limit, ready);
+                    this->sleepers.fetch_sub(1);
+                    break;
+                }
+                }
+            }
+        }
+        /**
+         * @brief Wake up all sleeping waiters.
+         */
+        void notify()
+        {
+            if (this->strategy != wait_strategy::BLOCK)
+            {
+                return;
+            }
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (this->sleepers.load() > 0)
+            {
+                std::lock_guard<std::mutex> lock{this->sleep_mutex};
+                this->sleep_cv.notify_all();
+            }
+        }
+
+    private:
+        wait_strategy strategy;
+        std::atomic<int> sleepers;
+        std::mutex sleep_mutex;
+        std::condition_variable sleep_cv;
+    };
+
+    /**
+     * @brief Bounded lock-free multi-producer single-consumer queue.
+     *
+     * @details Ring of cells with sequence numbers, producers claim a slot by
+     * compare-and-swap on enqueue_pos, and publish it by storing sequence.
+     * Capacity is rounded up to power of two.
+     *
+     * @tparam T Type of element.
+     */
+    template <typename T> class mpsc_queue
+    {
+    public:
+        /**
+         * @brief Construct a new mpsc queue object.
+         *
+         * @param capacity Least number of elements the queue can hold.
+         */
+        mpsc_queue(const size_t capacity = 1024)
+        {
+            size_t size = 2;
+            while (size < capacity)
+            {
+                size <<= 1;
+            }
+            this->mask = size - 1;
+            this->buffer.reset(new cell[size]);
+            for (size_t i = 0; i < size; i++)
+            {
+                this->buffer[i].sequence.store(i, std::memory_order_relaxed);
+            }
+            this->enqueue_pos.store(0, std::memory_order_relaxed);
+            this->dequeue_pos = 0;
+        }
+        /**
+         * @brief Copy constructor deleted.
+         *
+         * @param other Other queue.
+         */
+        mpsc_queue(const mpsc_queue &other) = delete;
+        /**
+         * @brief Copy assign constructor deleted.
+         *
+         * @param other Other queue.
+         * @return mpsc_queue& Self.
+         */
+        mpsc_queue &operator=(const mpsc_queue &other) = delete;
+        /**
+         * @brief Destroy the mpsc queue object with elements left.
+         */
+        ~mpsc_queue()
+        {
+            while (this->pop(nullptr))
+            {
+            }
+        }
+        /**
+         * @brief Try to push element into queue.
+         *
+         * @param value Element to push.
+         * @return true If pushed.
+         * @return false If queue is full.
+         */
+        bool try_push(T &&value)
+        {
+            cell *target;
+            size_t pos = this->enqueue_pos.load(std::memory_order_relaxed);
+            while (true)
+            {
+                target = &this->buffer[pos & this->mask];
+                size_t seq = target->sequence.load(std::memory_order_acquire);
+                auto diff = static_cast<std::ptrdiff_t>(seq - pos);
+                if (diff == 0)
+                {
+                    if (this->enqueue_pos.compare_exchange_weak(
+                            pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        break;
+                    }
+                }
+                else if (diff < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    pos = this->enqueue_pos.load(std::memory_order_relaxed);
+                }
+            }
+            new (target->storage) T(std::move(value));
+            target->sequence.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+        /**
+         * @brief Try to pop element from queue, consumer only.
+         *
+         * @param value Where the element is moved to.
+         * @return true If popped.
+         * @return false If queue is empty.
+         */
+        bool try_pop(T &value) { return this->pop(&value); }
+        /**
+         * @brief Peek the front element, consumer only.
+         *
+         * @return T* Pointer to front element, nullptr if empty.
+         */
+        T *front()
+        {
+            cell &target = this->buffer[this->dequeue_pos & this->mask];
+            size_t seq = target.sequence.load(std::memory_order_acquire);
+            if (seq != this->dequeue_pos + 1)
+            {
+                return nullptr;
+            }
+            return target.get();
+        }
+        /**
+         * @brief Check if queue is empty, consumer only.
+         *
+         * @return true Yes.
+         * @return false No.
+         */
+        bool empty() { return this->front() == nullptr; }
+        /**
+         * @brief Number of pushes claimed so far.
+         *
+         * @return size_t Count of claimed slots.
+         */
+        size_t pushed() const
+        {
+            return this->enqueue_pos.load(std::memory_order_acquire);
+        }
+        /**
+         * @brief Number of pops done so far.
+         *
+         * @return size_t Count of popped elements.
+         */
+        size_t popped() const
+        {
+            return this->dequeue_count.load(std::memory_order_acquire);
+        }
+
+    private:
+        /**
+         * @brief Slot of ring, with raw storage so T needs no default ctor.
+         */
+        struct cell
+        {
+            std::atomic<size_t> sequence;
+            alignas(T) unsigned char storage[sizeof(T)];
+            T *get() { return reinterpret_cast<T *>(this->storage); }
+        };
+        alignas(cache_line_size) std::atomic<size_t> enqueue_pos;
+        alignas(cache_line_size) size_t dequeue_pos;
+        std::atomic<size_t> dequeue_count{0};
+        size_t mask;
+        std::unique_ptr<cell[]> buffer;
+        /**
+         * @brief Pop front element.
+         *
+         * @param value Where the element is moved to, may be nullptr.
+         * @return true If popped.
+         * @return false If empty.
+         */
+        bool pop(T *value)
+        {
+            T *ptr = this->front();
+            if (ptr == nullptr)
+            {
+                return false;
+            }
+            if (value != nullptr)
+            {
+                *value = std::move(*ptr);
+            }
+            ptr->~T();
+            cell &target = this->buffer[this->dequeue_pos & this->mask];
+            target.sequence.store(this->dequeue_pos + this->mask + 1,
+                                  std::memory_order_release);
+            this->dequeue_pos++;
+            this->dequeue_count.store(this->dequeue_pos,
+                                      std::memory_order_release);
+            return true;
+        }
+    };
+    /**
+     * @brief Bounded lock-free single-producer single-consumer queue.
+     *
+     * @details Head and tail sit on their own cache lines, each side caches
+     * the index of the other side and only reloads it when the cache says
+     * the queue is full or empty.
+     *
+     * @tparam T Type of element.
+     */
+    template <typename T> class spsc_queue
+    {
+    public:
+        /**
+         * @brief Construct a new spsc queue object.
+         *
+         * @param capacity Least number of elements the queue can hold.
+         */
+        spsc_queue(const size_t capacity = 1024)
+        {
+            size_t size = 2;
+            while (size < capacity)
+            {
+                size <<= 1;
+            }
+            this->mask = size - 1;
+            this->buffer.reset(new cell[size]);
+            this->head.store(0, std::memory_order_relaxed);
+            this->tail.store(0, std::memory_order_relaxed);
+            this->cached_head = 0;
+            this->cached_tail = 0;
+        }
+        /**
+         * @brief Copy constructor deleted.
+         *
+         * @param other Other queue.
+         */
+        spsc_queue(const spsc_queue &other) = delete;
+        /**
+         * @brief Copy assign constructor deleted.
+         *
+         * @param other Other queue.
+         * @return spsc_queue& Self.
+         */
+        spsc_queue &operator=(const spsc_queue &other) = delete;
+        /**
+         * @brief Destroy the spsc queue object with elements left.
+         */
+        ~spsc_queue()
+        {
+            while (this->front() != nullptr)
+            {
+                this->pop();
+            }
+        }
+        /**
+         * @brief Try to push element into queue, producer only.
+         *
+         * @param value Element to push.
+         * @return true If pushed.
+         * @return false If queue is full.
+         */
+        bool try_push(T &&value)
+        {
+            size_t pos = this->tail.load(std::memory_order_relaxed);
+            if (pos - this->cached_head > this->mask)
+            {
+                this->cached_head = this->head.load(std::memory_order_acquire);
+                if (pos - this->cached_head > this->mask)
+                {
+                    return false;
+                }
+            }
+            new (this->buffer[pos & this->mask].storage) T(std::move(value));
+            this->tail.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+        /**
+         * @brief Peek the front element, consumer only.
+         *
+         * @return T* Pointer to front element, nullptr if empty.
+         */
+        T *front()
+        {
+            size_t pos = this->head.load(std::memory_order_relaxed);
+            if (pos == this->cached_tail)
+            {
+                this->cached_tail = this->tail.load(std::memory_order_acquire);
+                if (pos == this->cached_tail)
+                {
+                    return nullptr;
+                }
+            }
+            return this->buffer[pos & this->mask].get();
+        }
+        /**
+         * @brief Destroy the front element, consumer only.
+         *
+         * @details Call only after front() returned non-null.
+         */
+        void pop()
+        {
+            size_t pos = this->head.load(std::memory_order_relaxed);
+            this->buffer[pos & this->mask].get()->~T();
+            this->head.store(pos + 1, std::memory_order_release);
+        }
+        /**
+         * @brief Number of pushes done so far.
+         *
+         * @return size_t Count of pushed elements.
+         */
+        size_t pushed() const
+        {
+            return this->tail.load(std::memory_order_acquire);
+        }
+        /**
+         * @brief Number of pops done so far.
+         *
+         * @return size_t Count of popped elements.
+         */
+        size_t popped() const
+        {
+            return this->head.load(std::memory_order_acquire);
+        }
+
+    private:
+        /**
+         * @brief Slot of ring, with raw storage so T needs no default ctor.
+         */
+        struct cell
+        {
+            alignas(T) unsigned char storage[sizeof(T)];
+            T *get() { return reinterpret_cast<T *>(this->storage); }
+        };
+        alignas(cache_line_size) std::atomic<size_t> tail;
+        size_t cached_head;
+        alignas(cache_line_size) std::atomic<size_t> head;
+        size_t cached_tail;
+        alignas(cache_line_size) size_t mask;
+        std::unique_ptr<cell[]> buffer;
+    };
+    /**
+     * @brief Bounded lock-free multi-producer single-consumer queue of
+     * reusable cells.
+     *
+     * @details Same ring as mpsc_queue, but elements are constructed once
+     * and live as long as the queue. Producers fill a claimed cell in place
+     * and the consumer reads it in place, so elements such as strings keep
+     * their capacity and steady state allocates nothing.
+     *
+     * @tparam T Type of element, default constructible.
+     */
+    template <typename T> class mpsc_cell_queue
+    {
+    public:
+        /**
+         * @brief Construct a new mpsc cell queue object.
+         *
+         * @param capacity Least number of cells.
+         */
+        mpsc_cell_queue(const size_t capacity = 1024)
+        {
+            size_t size = 2;
+            while (size < capacity)
+            {
+                size <<= 1;
+            }
+            this->mask = size - 1;
+            this->buffer.reset(new cell[size]);
+            for (size_t i = 0; i < size; i++)
+            {
+                this->buffer[i].sequence.store(i, std::memory_order_relaxed);
+            }
+            this->enqueue_pos.store(0, std::memory_order_relaxed);
+            this->dequeue_pos = 0;
+        }
+        /**
+         * @brief Copy constructor deleted.
+         *
+         * @param other Other queue.
+         */
+        mpsc_cell_queue(const mpsc_cell_queue &other) = delete;
+        /**
+         * @brief Copy assign constructor deleted.
+         *
+         * @param other Other queue.
+         * @return mpsc_cell_queue& Self.
+         */
+        mpsc_cell_queue &operator=(const mpsc_cell_queue &other) = delete;
+        /**
+         * @brief Try to claim a cell and fill it.
+         *
+         * @tparam Fill Type of filler, called with T& holding what the cell
+         * held last time.
+         * @param fill Filler, runs only if a cell is claimed.
+         * @return true If filled and published.
+         * @return false If queue is full.
+         */
+        template <typename Fill> bool try_fill(Fill &&fill)
+        {
+            cell *target;
+            size_t pos = this->enqueue_pos.load(std::memory_order_relaxed);
+            while (true)
+            {
+                target = &this->buffer[pos & this->mask];
+                size_t seq = target->sequence.load(std::memory_order_acquire);
+                auto diff = static_cast<std::ptrdiff_t>(seq - pos);
+                if (diff == 0)
+                {
+                    if (this->enqueue_pos.compare_exchange_weak(
+                            pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        break;
+                    }
+                }
+                else if (diff < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    pos = this->enqueue_pos.load(std::memory_order_relaxed);
+                }
+            }
+            fill(target->value);
+            target->sequence.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+        /**
+         * @brief Peek the front element, consumer only.
+         *
+         * @return T* Pointer to front element, nullptr if empty.
+         */
+        T *front()
+        {
+            cell &target = this->buffer[this->dequeue_pos & this->mask];
+            size_t seq = target.sequence.load(std::memory_order_acquire);
+            if (seq != this->dequeue_pos + 1)
+            {
+                return nullptr;
+            }
+            return &target.value;
+        }
+        /**
+         * @brief Give front cell back to producers, consumer only, call after
+         * front() returned it.
+         */
+        void pop()
+        {
+            cell &target = this->buffer[this->dequeue_pos & this->mask];
+            target.sequence.store(this->dequeue_pos + this->mask + 1,
+                                  std::memory_order_release);
+            this->dequeue_pos++;
+            this->dequeue_count.store(this->dequeue_pos,
+                                      std::memory_order_release);
+        }
+        /**
+         * @brief Check if queue is empty, consumer only.
+         *
+         * @return true Yes.
+         * @return false No.
+         */
+        bool empty() { return this->front() == nullptr; }
+        /**
+         * @brief Number of fills claimed so far.
+         *
+         * @return size_t Count of claimed cells.
+         */
+        size_t pushed() const
+        {
+            return this->enqueue_pos.load(std::memory_order_acquire);
+        }
+        /**
+         * @brief Number of pops done so far.
+         *
+         * @return size_t Count of popped elements.
+         */
+        size_t popped() const
+        {
+            return this->dequeue_count.load(std::memory_order_acquire);
+        }
+
+    private:
+        /**
+         * @brief Slot of ring, element lives as long as the queue.
+         */
+        struct cell
+        {
+            std::atomic<size_t> sequence;
+            T value;
+        };
+        alignas(cache_line_size) std::atomic<size_t> enqueue_pos;
+        alignas(cache_line_size) size_t dequeue_pos;
+        std::atomic<size_t> dequeue_count{0};
+        size_t mask;
+        std::unique_ptr<cell[]> buffer;
+    };
+} // namespace log2what
+#endif
\ No newline at end of file
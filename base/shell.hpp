@@ -88,9 +88,14 @@ namespace log2what
         {
             if (level >= this->mask)
             {
-                this->writer_unique_ptr->write(level, module, comment, data);
+                this->writer_unique_ptr->write(level, module, comment, data,
+                                               timestamp_nano);
             }
         }
+        /**
+         * @brief Flush writer held.
+         */
+        void flush() override { this->writer_unique_ptr->flush(); }
     };
 } // namespace log2what
 #endif
\ No newline at end of file
@@ -0,0 +1,235 @@
+/**
+ * @file time_format.hpp
+ * @author TNumFive
+ * @brief Cached timestamp formatting shared by text writers.
+ * @version 0.1
+ * @date 2023-02-15
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef LOG2WHAT_TIME_FORMAT_HPP
+#define LOG2WHAT_TIME_FORMAT_HPP
+
+#include "./common.hpp"
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+namespace log2what
+{
+    /**
+     * @brief Digits of fraction of second.
+     */
+    enum class time_precision : int
+    {
+        MILLI = 3,
+        MICRO = 6,
+        NANO = 9
+    };
+
+    /**
+     * @brief Time zone used when formatting timestamp.
+     *
+     * @details UTC and FIXED never look up time zone database, FIXED adds a
+     * given offset in seconds to UTC.
+     */
+    enum class time_zone : int
+    {
+        LOCAL = 1,
+        UTC = 2,
+        FIXED = 4
+    };
+
+    /**
+     * @brief Buffer size enough for "2022-07-30 11:01:52.123456789".
+     */
+    static constexpr size_t timestamp_buffer_size = 32;
+
+    /**
+     * @brief Length of "2022-07-30 11:01:52".
+     */
+    static constexpr size_t timestamp_prefix_size = 19;
+
+    /**
+     * @brief Pack time format settings into one integer.
+     *
+     * @param precision Digits of fraction.
+     * @param zone Time zone.
+     * @param offset_sec Offset to UTC in seconds, used by FIXED only.
+     * @return int64_t Packed settings.
+     */
+    constexpr int64_t pack_time_format(const time_precision precision,
+                                       const time_zone zone,
+                                       const int32_t offset_sec)
+    {
+        return static_cast<int64_t>(offset_sec) * 65536 +
+               (static_cast<int64_t>(zone) << 8) +
+               static_cast<int64_t>(precision);
+    }
+
+    /**
+     * @brief Process wide time format settings.
+     *
+     * @return std::atomic<int64_t>& Packed settings.
+     */
+    inline std::atomic<int64_t> &time_format_settings()
+    {
+        static std::atomic<int64_t> settings{
+            pack_time_format(time_precision::MILLI, time_zone::LOCAL, 0)};
+        return settings;
+    }
+
+    /**
+     * @brief Set time format used by all text writers.
+     *
+     * @param precision Digits of fraction.
+     * @param zone Time zone.
+     * @param offset_sec Offset to UTC in seconds, used by FIXED only.
+     */
+    inline void set_time_format(const time_precision precision,
+                                const time_zone zone = time_zone::LOCAL,
+                                const int32_t offset_sec = 0)
+    {
+        time_format_settings().store(
+            pack_time_format(precision, zone, offset_sec),
+            std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Write integer as fixed number of digits.
+     *
+     * @param buffer Where to write.
+     * @param value Non-negative integer.
+     * @param digits Number of digits.
+     */
+    inline void write_digits(char *buffer, int64_t value, const int digits)
+    {
+        for (int i = digits - 1; i >= 0; i--)
+        {
+            buffer[i] = static_cast<char>('0' + value % 10);
+            value /= 10;
+        }
+    }
+
+    /**
+     * @brief Write "YYYY-MM-DD HH:MM:SS" of seconds since epoch in UTC.
+     *
+     * @details Civil date is computed from days directly, so no time zone
+     * database nor lock is involved.
+     *
+     * @param buffer Where to write, at least timestamp_prefix_size bytes.
+     * @param timestamp_sec Timestamp in seconds, offset already added.
+     */
+    inline void write_utc_prefix(char *buffer, const int64_t timestamp_sec)
+    {
+        constexpr int64_t day_to_sec = 86400;
+        int64_t days = timestamp_sec / day_to_sec;
+        int64_t rest = timestamp_sec % day_to_sec;
+        if (rest < 0)
+        {
+            rest += day_to_sec;
+            days--;
+        }
+        days += 719468;
+        int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+        int64_t day_of_era = days - era * 146097;
+        int64_t year_of_era = (day_of_era - day_of_era / 1460 +
+                               day_of_era / 36524 - day_of_era / 146096) /
+                              365;
+        int64_t day_of_year = day_of_era - (365 * year_of_era +
+                                            year_of_era / 4 -
+                                            year_of_era / 100);
+        int64_t month_index = (5 * day_of_year + 2) / 153;
+        int64_t day = day_of_year - (153 * month_index + 2) / 5 + 1;
+        int64_t month = month_index < 10 ? month_index + 3 : month_index - 9;
+        int64_t year = year_of_era + era * 400 + (month <= 2);
+        write_digits(buffer, year, 4);
+        buffer[4] = '-';
+        write_digits(buffer + 5, month, 2);
+        buffer[7] = '-';
+        write_digits(buffer + 8, day, 2);
+        buffer[10] = ' ';
+        write_digits(buffer + 11, rest / 3600, 2);
+        buffer[13] = ':';
+        write_digits(buffer + 14, rest / 60 % 60, 2);
+        buffer[16] = ':';
+        write_digits(buffer + 17, rest % 60, 2);
+    }
+
+    /**
+     * @brief Format timestamp with process wide time format settings.
+     *
+     * @details The "YYYY-MM-DD HH:MM:SS" prefix is cached per thread and only
+     * rebuilt when second or settings change, so most calls only write the
+     * fraction digits.
+     *
+     * @param timestamp_nano Timestamp in nanoseconds.
+     * @param buffer Where to write, at least timestamp_buffer_size bytes.
+     * @return size_t Length written, without terminating zero.
+     */
+    inline size_t format_timestamp(const int64_t timestamp_nano, char *buffer)
+    {
+        constexpr int64_t sec_to_nano = 1000000000;
+        struct prefix_cache
+        {
+            int64_t timestamp_sec = INT64_MIN;
+            int64_t settings = 0;
+            char prefix[timestamp_prefix_size + 1];
+        };
+        thread_local prefix_cache cache;
+        int64_t settings =
+            time_format_settings().load(std::memory_order_relaxed);
+        int64_t timestamp_sec = timestamp_nano / sec_to_nano;
+        int64_t fraction = timestamp_nano % sec_to_nano;
+        if (fraction < 0)
+        {
+            fraction += sec_to_nano;
+            timestamp_sec--;
+        }
+        if (cache.timestamp_sec != timestamp_sec || cache.settings != settings)
+        {
+            auto zone = static_cast<time_zone>((settings >> 8) & 0xff);
+            if (zone == time_zone::LOCAL)
+            {
+                std::tm lt = get_localtime_tm(timestamp_sec);
+                std::strftime(cache.prefix, timestamp_prefix_size + 1, "%F %T",
+                              &lt);
+            }
+            else
+            {
+                int64_t offset = zone == time_zone::FIXED ? settings >> 16 : 0;
+                write_utc_prefix(cache.prefix, timestamp_sec + offset);
+            }
+            cache.timestamp_sec = timestamp_sec;
+            cache.settings = settings;
+        }
+        std::memcpy(buffer, cache.prefix, timestamp_prefix_size);
+        int digits = static_cast<int>(settings & 0xff);
+        for (int i = digits; i < 9; i++)
+        {
+            fraction /= 10;
+        }
+        buffer[timestamp_prefix_size] = '.';
+        write_digits(buffer + timestamp_prefix_size + 1, fraction, digits);
+        size_t length = timestamp_prefix_size + 1 + digits;
+        buffer[length] = '\0';
+        return length;
+    }
+
+    /**
+     * @brief Get formatted timestamp string.
+     *
+     * @param timestamp_nano Timestamp in nanoseconds.
+     * @return std::string Formatted timestamp.
+     */
+    inline std::string get_timestamp_str(const int64_t timestamp_nano)
+    {
+        char buffer[timestamp_buffer_size];
+        size_t length = format_timestamp(timestamp_nano, buffer);
+        return std::string(buffer, length);
+    }
+} // namespace log2what
+#endif
\ No newline at end of file
@@ -12,7 +12,7 @@
 #define LOG2WHAT_WRITER_HPP
 
 #include "./common.hpp"
-#include <iomanip>
+#include "./time_format.hpp"
 #include <iostream>
 #include <string>
 
@@ -73,19 +73,22 @@ namespace log2what
                            const string &comment, const string &data,
                            const int64_t timestamp_nano = 0)
         {
-            constexpr int sec_to_nano = 1000000000;
-            constexpr int milli_to_nano = 1000000;
             int64_t nano =
                 timestamp_nano ? timestamp_nano : get_nano_timestamp();
-            int64_t sec = nano / sec_to_nano;
-            int64_t precision = (nano % sec_to_nano) / milli_to_nano;
-            std::cout << get_localtime_str(sec);
-            std::cout << "." << std::setw(3) << std::setfill('0') << precision;
+            char buffer[timestamp_buffer_size];
+            std::cout.write(buffer, format_timestamp(nano, buffer));
             std::cout << " " << to_string(level);
             std::cout << " " << module;
             std::cout << " |%| " << comment;
             std::cout << " |%| " << data << std::endl;
         }
+        /**
+         * @brief Flush logs held by writer.
+         *
+         * @details Writers that buffer or defer logs should override this and
+         * return only when all logs written before are handed to their sink.
+         */
+        virtual void flush() {}
     };
 } // namespace log2what
 #endif
\ No newline at end of file
@@ -0,0 +1,56 @@
+/**
+ * @file backend_bench.cpp
+ * @author TNumFive
+ * @brief Throughput of per-thread queues merged by backend against one
+ * shared queue of async_shell, with 1, 8, 32 and 64 producer threads.
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include "../async_shell/async_shell.hpp"
+#include "../base/log2what.hpp"
+#include "./bench.hpp"
+
+using namespace std;
+using namespace log2what;
+
+int main(int argc, char const *argv[])
+{
+    size_t total = static_cast<size_t>((1 << 21) * bench_scale(argc, argv));
+    printf("%-8s %8s %14s\n", "mode", "threads", "logs/s");
+    for (int threads : {1, 8, 32, 64})
+    {
+        size_t per_thread = total / threads;
+        {
+            // one mpsc queue shared by all producers.
+            log2one logger{"bench", unique_ptr<writer>{new async_shell{
+                                        unique_ptr<writer>{new null_writer},
+                                        8192}}};
+            double sec = run_threads(threads, [&](int) {
+                for (size_t i = 0; i < per_thread; i++)
+                {
+                    logger.info("comment", "data");
+                }
+            });
+            logger.flush();
+            printf("%-8s %8d %14.0f\n", "shared", threads,
+                   per_thread * threads / sec);
+        }
+        {
+            log2one logger{"bench", unique_ptr<writer>{new null_writer}};
+            logger.enable_backend(8192 / threads + 64);
+            double sec = run_threads(threads, [&](int) {
+                for (size_t i = 0; i < per_thread; i++)
+                {
+                    logger.info("comment", "data");
+                }
+            });
+            logger.flush();
+            printf("%-8s %8d %14.0f\n", "backend", threads,
+                   per_thread * threads / sec);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,100 @@
+/**
+ * @file bench.hpp
+ * @author TNumFive
+ * @brief Timing helpers shared by benchmarks.
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#ifndef LOG2WHAT_BENCH_BENCH_HPP
+#define LOG2WHAT_BENCH_BENCH_HPP
+
+#include "../base/writer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Writer that drops logs, so benchmarks measure the path before it.
+ */
+class null_writer : public log2what::writer
+{
+public:
+    void write(const log2what::log_level, const string &, const string &,
+               const string &, const int64_t) override
+    {
+    }
+};
+
+/**
+ * @brief Seconds since an arbitrary point, from steady clock.
+ *
+ * @return double Seconds.
+ */
+inline double now_sec()
+{
+    return std::chrono::duration<double>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+/**
+ * @brief Run body in given number of threads and time all of them.
+ *
+ * @tparam Body Type of body, called with index of thread.
+ * @param threads Number of threads.
+ * @param body Work of each thread.
+ * @return double Seconds until all threads finish.
+ */
+template <typename Body> double run_threads(const int threads, Body &&body)
+{
+    std::vector<std::thread> workers;
+    double start = now_sec();
+    for (int t = 0; t < threads; t++)
+    {
+        workers.emplace_back(body, t);
+    }
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+    return now_sec() - start;
+}
+
+/**
+ * @brief Get percentile of samples, sorts samples.
+ *
+ * @param samples Samples.
+ * @param ratio Percentile in [0, 1].
+ * @return double Sample at percentile, 0 if empty.
+ */
+inline double percentile(std::vector<double> &samples, const double ratio)
+{
+    if (samples.empty())
+    {
+        return 0;
+    }
+    std::sort(samples.begin(), samples.end());
+    size_t index = static_cast<size_t>(ratio * (samples.size() - 1));
+    return samples[index];
+}
+
+/**
+ * @brief Read scale of benchmark from command line, default 1.
+ *
+ * @param argc Number of arguments.
+ * @param argv Arguments.
+ * @return double Scale that multiplies iterations.
+ */
+inline double bench_scale(int argc, char const *argv[])
+{
+    return argc > 1 ? std::atof(argv[1]) : 1.0;
+}
+
+#endif
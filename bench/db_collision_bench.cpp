@@ -0,0 +1,69 @@
+/**
+ * @file db_collision_bench.cpp
+ * @author TNumFive
+ * @brief Sustained rows per second of db_writer when many logs share a
+ * timestamp, as when buffered_shell replays or threads log at once.
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include "../db_writer/db_cursor.hpp"
+#include "../db_writer/db_writer.hpp"
+#include "../base/common.hpp"
+#include "./bench.hpp"
+#include <unistd.h>
+
+using namespace std;
+using namespace log2what;
+
+int main(int argc, char const *argv[])
+{
+    constexpr int threads = 4;
+    size_t total = static_cast<size_t>((1 << 18) * bench_scale(argc, argv));
+    size_t per_thread = total / threads;
+    string dir = "/tmp/log2what_bench_" + to_string(getpid()) + "/";
+    string comment(80, 'c');
+    printf("files in %s\n", dir.c_str());
+    printf("%-12s %10s %12s %10s\n", "same_stamp", "rows", "rows/s", "stored");
+    for (size_t collisions : {1, 16, 256, 4096})
+    {
+        string path = dir + "collision_" + to_string(collisions) + ".db";
+        int64_t base = get_nano_timestamp();
+        double sec;
+        {
+            db_writer output{path};
+            // every thread walks the same timestamps, each repeated
+            // collisions / threads times, so collisions rows share one.
+            size_t repeat = max<size_t>(collisions / threads, 1);
+            sec = run_threads(threads, [&](int) {
+                for (size_t i = 0; i < per_thread; i++)
+                {
+                    output.write(log_level::INFO, "bench", comment, "",
+                                 base + static_cast<int64_t>(i / repeat));
+                }
+                output.flush();
+            });
+            sec = max(sec, 1e-9);
+        }
+        size_t stored = 0;
+        {
+            db_cursor cursor{path};
+            log item{0, log_level::TRACE, "", "", ""};
+            while (cursor.next(item))
+            {
+                stored++;
+            }
+        }
+        // read-only cursor leaves -wal and -shm files behind.
+        for (const char *suffix : {"", ".spill", "-wal", "-shm"})
+        {
+            unlink((path + suffix).c_str());
+        }
+        printf("%-12zu %10zu %12.0f %10zu\n", collisions, per_thread * threads,
+               per_thread * threads / sec, stored);
+    }
+    rmdir(dir.c_str());
+    return 0;
+}
@@ -0,0 +1,56 @@
+/**
+ * @file db_writer_bench.cpp
+ * @author TNumFive
+ * @brief Rows per second of db_writer at different batch sizes.
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include "../db_writer/db_writer.hpp"
+#include "../base/common.hpp"
+#include "./bench.hpp"
+#include <unistd.h>
+
+using namespace std;
+using namespace log2what;
+
+int main(int argc, char const *argv[])
+{
+    size_t total = static_cast<size_t>((1 << 17) * bench_scale(argc, argv));
+    string dir = "/tmp/log2what_bench_" + to_string(getpid()) + "/";
+    string comment(80, 'c');
+    printf("files in %s\n", dir.c_str());
+    printf("%-10s %10s %12s\n", "batch", "rows", "rows/s");
+    // batch of 0 lets db_writer adapt batch size, others flush every batch
+    // logs so each transaction holds exactly that many.
+    for (size_t batch : {0, 1, 16, 128, 1024, 8192})
+    {
+        size_t rows = batch ? min(total, batch * 2048) : total;
+        string path = dir + "batch_" + to_string(batch) + ".db";
+        double sec;
+        {
+            db_writer output{path, batch ? batch : 100};
+            double start = now_sec();
+            for (size_t i = 0; i < rows; i++)
+            {
+                output.write(log_level::INFO, "bench", comment, "",
+                             get_nano_timestamp());
+                if (batch && i % batch == batch - 1)
+                {
+                    output.flush();
+                }
+            }
+            output.flush();
+            sec = max(now_sec() - start, 1e-9);
+        }
+        unlink(path.c_str());
+        unlink((path + ".spill").c_str());
+        printf("%-10s %10zu %12.0f\n",
+               batch ? to_string(batch).c_str() : "adaptive", rows,
+               rows / sec);
+    }
+    rmdir(dir.c_str());
+    return 0;
+}
@@ -0,0 +1,73 @@
+/**
+ * @file file_writer_bench.cpp
+ * @author TNumFive
+ * @brief Throughput and latency of file_writer::write in STREAM, URING and
+ * MMAP modes, with 1 and 4 writing threads.
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include "../file_writer/file_writer.hpp"
+#include "./bench.hpp"
+#include <unistd.h>
+
+using namespace std;
+using namespace log2what;
+
+int main(int argc, char const *argv[])
+{
+    size_t total = static_cast<size_t>((1 << 20) * bench_scale(argc, argv));
+    string dir = "/tmp/log2what_bench_" + to_string(getpid()) + "/";
+    string comment(80, 'c');
+    struct
+    {
+        const char *name;
+        file_mode mode;
+    } modes[] = {{"stream", file_mode::STREAM},
+                 {"uring", file_mode::URING},
+                 {"mmap", file_mode::MMAP}};
+    printf("files in %s\n", dir.c_str());
+    printf("%-8s %8s %12s %10s %10s %10s\n", "mode", "threads", "logs/s",
+           "p50(ns)", "p99(ns)", "p999(ns)");
+    for (int threads : {1, 4})
+    {
+        size_t per_thread = total / threads;
+        for (auto &mode : modes)
+        {
+            vector<vector<double>> latency(threads);
+            double sec;
+            {
+                // few files of 64MB, so disk usage stays bounded.
+                file_writer output{mode.name, dir, 64 * MB, 4,
+                                   file_format::TEXT, mode.mode};
+                sec = run_threads(threads, [&](int t) {
+                    auto &samples = latency[t];
+                    samples.reserve(per_thread);
+                    for (size_t i = 0; i < per_thread; i++)
+                    {
+                        double start = now_sec();
+                        output.write(log_level::INFO, "bench", comment, "",
+                                     get_nano_timestamp());
+                        samples.push_back(now_sec() - start);
+                    }
+                });
+                output.flush();
+                sec = max(sec, 1e-9);
+            }
+            vector<double> samples;
+            for (auto &thread_samples : latency)
+            {
+                samples.insert(samples.end(), thread_samples.begin(),
+                               thread_samples.end());
+            }
+            printf("%-8s %8d %12.0f %10.0f %10.0f %10.0f\n", mode.name,
+                   threads, per_thread * threads / sec,
+                   percentile(samples, 0.5) * 1e9,
+                   percentile(samples, 0.99) * 1e9,
+                   percentile(samples, 0.999) * 1e9);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,84 @@
+/**
+ * @file time_format_bench.cpp
+ * @author TNumFive
+ * @brief Cost per timestamp of format_timestamp() against localtime_r plus
+ * strftime on every record, as text writers did before.
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include "../base/common.hpp"
+#include "../base/time_format.hpp"
+#include "./bench.hpp"
+
+using namespace std;
+using namespace log2what;
+
+/**
+ * @brief Timestamps one microsecond apart, so the second changes once every
+ * million logs.
+ */
+static constexpr int64_t step_nano = 1000;
+
+/**
+ * @brief Time formatting of count timestamps.
+ *
+ * @tparam Format Type of format, writes timestamp into buffer.
+ * @param count Number of timestamps.
+ * @param format Format under test.
+ * @return double Nanoseconds per timestamp.
+ */
+template <typename Format>
+static double time_format(const size_t count, Format &&format)
+{
+    char buffer[timestamp_buffer_size];
+    size_t checksum = 0;
+    int64_t nano = get_nano_timestamp();
+    double start = now_sec();
+    for (size_t i = 0; i < count; i++)
+    {
+        checksum += format(nano + static_cast<int64_t>(i) * step_nano, buffer);
+    }
+    double sec = now_sec() - start;
+    if (checksum == 0)
+    {
+        printf("unexpected empty output\n");
+    }
+    return sec * 1e9 / count;
+}
+
+int main(int argc, char const *argv[])
+{
+    constexpr int64_t sec_to_nano = 1000000000;
+    constexpr int64_t milli_to_nano = 1000000;
+    size_t count = static_cast<size_t>((1 << 22) * bench_scale(argc, argv));
+    printf("%-16s %10s\n", "mode", "ns/log");
+    double old_ns = time_format(count, [](int64_t nano, char *buffer) {
+        tm lt = get_localtime_tm(nano / sec_to_nano);
+        size_t length = strftime(buffer, timestamp_buffer_size, "%F %T", &lt);
+        return length + snprintf(buffer + length, 5, ".%03d",
+                                 static_cast<int>(nano % sec_to_nano /
+                                                  milli_to_nano));
+    });
+    printf("%-16s %10.1f\n", "strftime", old_ns);
+    struct
+    {
+        const char *name;
+        time_precision precision;
+        time_zone zone;
+    } modes[] = {
+        {"cached-local-ms", time_precision::MILLI, time_zone::LOCAL},
+        {"cached-local-ns", time_precision::NANO, time_zone::LOCAL},
+        {"cached-utc-ms", time_precision::MILLI, time_zone::UTC},
+        {"cached-fixed-us", time_precision::MICRO, time_zone::FIXED},
+    };
+    for (auto &mode : modes)
+    {
+        set_time_format(mode.precision, mode.zone, 8 * 3600);
+        double ns = time_format(count, format_timestamp);
+        printf("%-16s %10.1f\n", mode.name, ns);
+    }
+    return 0;
+}
@@ -11,13 +11,31 @@
 #ifndef LOG2WHAT_BUFFERED_SHELL_HPP
 #define LOG2WHAT_BUFFERED_SHELL_HPP
 #include "../base/writer.hpp"
-#include <list>
+#include "./log_ring.hpp"
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 namespace log2what
 {
     /**
      * @brief Shell that will write buffered log when triggered.
+     *
+     * @details Logs before trigger are kept in a log_ring, so buffering a log
+     * copies it once into preallocated memory. With per_thread set, every
+     * thread buffers into its own ring guarded by its own mutex, which only
+     * a trigger ever contends for. A trigger takes the rings of all threads
+     * and writes their logs merged by timestamp. Rings of exited threads are
+     * kept until their logs are written, then reused by new threads; at most
+     * max_exited_rings of them are kept, beyond that the oldest one is
+     * cleared and reused. With recorder_path set, rings are
+     * mapped from files, which keep the logs if the process crashes, see
+     * log_ring::install_fatal_handler() and tools/log2what_recover.cpp.
+     * Windows can also be set by time, see set_time_window(), and logs can
+     * be buffered and triggered by module, see set_module_partition().
      */
     class buffered_shell : public writer
     {
@@ -32,17 +50,32 @@ namespace log2what
          * @param writer_unique_ptr Writer pointer held.
          * @param before How many logs to be buffered.
          * @param after How many logs to write after triggered.
+         * @param before_bytes Max bytes of logs buffered.
+         * @param per_thread Buffer logs of each thread separately, before and
+         * before_bytes then apply to each thread.
+         * @param recorder_path File to map ring from, empty to keep ring on
+         * heap. With per_thread set, ring of each thread is mapped from
+         * recorder_path plus ".N", N counts from 0.
          */
         buffered_shell(const log_level mask = log_level::INFO,
                        unique_ptr_writer &&writer_unique_ptr =
                            unique_ptr_writer{new writer},
-                       const size_t before = 100, const size_t after = 10)
+                       const size_t before = 100, const size_t after = 10,
+                       const size_t before_bytes = 1 << 16,
+                       const bool per_thread = false,
+                       const string &recorder_path = "")
+            : thread_scope{0, 0, ""}
         {
+            static std::atomic<uint64_t> id_counter{0};
+            this->id = ++id_counter;
             this->mask = mask;
             this->writer_unique_ptr = std::move(writer_unique_ptr);
             this->before = before;
+            this->before_bytes = before_bytes;
             this->after = after;
-            this->left_to_write = 0;
+            this->per_thread = per_thread;
+            this->recorder_path = recorder_path;
+            this->recorder_serial.store(0);
         }
         /**
          * @brief Copy constructor deleted.
@@ -71,9 +104,17 @@ namespace log2what
          */
         buffered_shell &operator=(buffered_shell &&other) = delete;
         /**
-         * @brief Default destructor.
+         * @brief Destroy the buffered shell object, rings of threads still
+         * alive are dropped when those threads register another one.
          */
-        ~buffered_shell() override = default;
+        ~buffered_shell() override
+        {
+            lock_guard registry_lock{this->registry_mutex};
+            for (auto &&recorder_ptr : this->recorder_vector)
+            {
+                recorder_ptr->detached.store(true);
+            }
+        }
         /**
          * @brief Buffer logs until triggerd.
          *
@@ -81,59 +122,491 @@ namespace log2what
          * @param module Module name.
          * @param comment Content of log.
          * @param data Data attached.
+         * @param timestamp_nano Timestamp of log in nano.
          */
         void write(const log_level level, const string &module,
                    const string &comment, const string &data,
-                   const int64_t) override
+                   const int64_t timestamp_nano) override
         {
+            int64_t nano =
+                timestamp_nano ? timestamp_nano : get_nano_timestamp();
+            if (this->per_thread && level < this->mask &&
+                !this->thread_scope.writing_after.load())
+            {
+                this->record(level, module, comment, data, nano);
+                return;
+            }
             lock_guard lock{buffer_mutex};
+            scope &current =
+                this->per_thread ? this->thread_scope : this->get_scope(module);
             if (level >= this->mask)
             {
                 // triggered
-                if (this->left_to_write == 0)
+                if (this->per_thread)
                 {
-                    // new trigger
-                    this->writer_unique_ptr->write(
-                        level, "buffered_shell", "begin", "",
-                        log_list.front().timestamp_nano);
+                    this->write_recorded(current, level, nano);
                 }
-                for (auto &&i : log_list)
+                else
                 {
-                    this->writer_unique_ptr->write(i.level, i.module, i.comment,
-                                                   i.data, i.timestamp_nano);
+                    this->write_buffered(current, level, nano);
                 }
-                this->writer_unique_ptr->write(level, module, comment, data);
-                this->log_list.clear();
-                this->left_to_write = this->after;
+                this->writer_unique_ptr->write(level, module, comment, data,
+                                               nano);
+                current.left_to_write = this->after;
+                current.after_deadline = nano + this->after_nano;
+                current.writing_after.store(this->after_nano > 0 ||
+                                            this->after > 0);
                 return;
             }
-            if (this->left_to_write > 0)
+            if (current.writing_after.load())
             {
-                this->writer_unique_ptr->write(level, module, comment, data);
-                this->left_to_write--;
-                if (this->left_to_write == 0)
+                bool within = this->after_nano > 0
+                                  ? nano <= current.after_deadline
+                                  : current.left_to_write > 0;
+                if (within)
+                {
+                    this->writer_unique_ptr->write(level, module, comment,
+                                                   data, nano);
+                }
+                if (!within || (this->after_nano == 0 &&
+                                --current.left_to_write == 0))
                 {
                     this->writer_unique_ptr->write(level, "buffered_shell",
                                                    "ended", "");
+                    current.writing_after.store(false);
+                }
+                if (within)
+                {
+                    return;
                 }
-                return;
             }
-            this->log_list.emplace_back(get_nano_timestamp(), level, module,
-                                        comment, data);
-            if (this->log_list.size() > this->before)
+            if (this->per_thread)
             {
-                this->log_list.pop_front();
+                this->record(level, module, comment, data, nano);
+                return;
             }
+            current.ring.push(nano, level, module, comment, data);
+            this->drop_expired(current.ring, nano);
+        }
+        /**
+         * @brief Flush writer held, buffered logs are kept until triggered.
+         */
+        void flush() override
+        {
+            lock_guard lock{buffer_mutex};
+            this->writer_unique_ptr->flush();
+        }
+        /**
+         * @brief Limit windows by time, call before writing logs.
+         *
+         * @details Buffered logs older than before_milli relative to newest
+         * log are dropped as new logs come, each log is dropped once so this
+         * is amortized O(1). before and before_bytes still bound the ring.
+         * After a trigger, logs stamped within after_milli are written
+         * instead of counting after.
+         *
+         * @param before_milli Window before trigger, 0 for no time limit.
+         * @param after_milli Window after trigger, 0 to count after instead.
+         */
+        void set_time_window(const int64_t before_milli,
+                             const int64_t after_milli)
+        {
+            constexpr int64_t milli_to_nano = 1000000;
+            lock_guard lock{buffer_mutex};
+            this->before_nano = before_milli * milli_to_nano;
+            this->after_nano = after_milli * milli_to_nano;
+        }
+        /**
+         * @brief Buffer and trigger logs by module, call before writing logs.
+         *
+         * @details Each partition has its own ring and after window, a
+         * trigger only writes logs of its own partition, so a noisy module
+         * does not evict context of others. At most max_partitions exist,
+         * beyond that the least recently used one is cleared and reused, one
+         * not writing logs after trigger first, so rings and their files
+         * stay bounded however many modules come. Ignored with per_thread
+         * set.
+         *
+         * @param delimiter Partition by module prefix before first delimiter,
+         * '\0' to partition by whole module name.
+         * @param max_partitions Max partitions kept, at least 1.
+         */
+        void set_module_partition(const char delimiter = '\0',
+                                  const size_t max_partitions = 64)
+        {
+            lock_guard lock{buffer_mutex};
+            this->partitioned = true;
+            this->delimiter = delimiter;
+            this->max_partitions = std::max<size_t>(max_partitions, 1);
         }
 
     private:
+        /**
+         * @brief Max rings of exited threads kept with logs not written.
+         */
+        static constexpr size_t max_exited_rings = 64;
+        /**
+         * @brief Buffered logs and after window of one partition.
+         */
+        struct scope
+        {
+            log_ring ring;
+            /**
+             * @brief Set while logs after trigger are written, read without
+             * lock by per-thread writers.
+             */
+            std::atomic<bool> writing_after{false};
+            size_t left_to_write = 0;
+            int64_t after_deadline = 0;
+            /**
+             * @brief Serial of last write to partition, for eviction.
+             */
+            uint64_t last_used = 0;
+            scope(const size_t before, const size_t before_bytes,
+                  const string &file_path)
+                : ring{before, before_bytes, file_path}
+            {
+            }
+        };
+        /**
+         * @brief Ring of logs buffered by one thread.
+         */
+        struct recorder
+        {
+            std::mutex ring_mutex;
+            log_ring ring;
+            std::atomic<bool> closed{false};
+            std::atomic<bool> detached{false};
+            recorder(const size_t before, const size_t before_bytes,
+                     const string &file_path)
+                : ring{before, before_bytes, file_path}
+            {
+            }
+        };
+        using thread_recorder = std::pair<uint64_t, std::shared_ptr<recorder>>;
+        /**
+         * @brief Rings registered by current thread, closed on thread exit.
+         */
+        struct thread_recorders
+        {
+            uint64_t last_id = 0;
+            recorder *last_ptr = nullptr;
+            std::vector<thread_recorder> list;
+            ~thread_recorders()
+            {
+                for (auto &&i : this->list)
+                {
+                    i.second->closed.store(true);
+                }
+            }
+        };
+        uint64_t id;
         unique_ptr_writer writer_unique_ptr;
         log_level mask;
         size_t before;
+        size_t before_bytes;
         size_t after;
-        size_t left_to_write;
-        std::list<log> log_list;
+        int64_t before_nano = 0;
+        int64_t after_nano = 0;
+        bool per_thread;
+        bool partitioned = false;
+        char delimiter = '\0';
+        size_t max_partitions = 64;
+        /**
+         * @brief Serial of writes to partitions, guarded by buffer_mutex.
+         */
+        uint64_t use_serial = 0;
+        string recorder_path;
+        /**
+         * @brief Number of rings mapped from files with suffix so far.
+         */
+        std::atomic<size_t> recorder_serial;
         std::mutex buffer_mutex;
+        using scope_table = std::unordered_map<string, std::unique_ptr<scope>>;
+        /**
+         * @brief Partitions by key, only "" if not partitioned.
+         */
+        scope_table scope_map;
+        /**
+         * @brief After window of per-thread mode, its ring is unused.
+         */
+        scope thread_scope;
+        std::mutex registry_mutex;
+        std::vector<std::shared_ptr<recorder>> recorder_vector;
+        /**
+         * @brief Logs taken from rings by trigger, reused between triggers.
+         */
+        std::vector<log> merged;
+        /**
+         * @brief Get partition of module, create it if not exists.
+         *
+         * @details Once max_partitions exist, the least recently used one is
+         * cleared and taken for the new key instead, ring and file kept.
+         *
+         * @param module Module name.
+         * @return scope& Partition.
+         */
+        scope &get_scope(const string &module)
+        {
+            string key;
+            if (this->partitioned)
+            {
+                key = this->delimiter == '\0'
+                          ? module
+                          : module.substr(0, module.find(this->delimiter));
+            }
+            auto it = this->scope_map.find(key);
+            if (it != this->scope_map.end())
+            {
+                it->second->last_used = ++this->use_serial;
+                return *it->second;
+            }
+            if (this->scope_map.size() >= this->max_partitions)
+            {
+                auto node = this->scope_map.extract(this->least_used_scope());
+                scope &reused = *node.mapped();
+                if (reused.writing_after.load())
+                {
+                    this->writer_unique_ptr->write(
+                        log_level::INFO, "buffered_shell", "ended", "");
+                    reused.writing_after.store(false);
+                }
+                reused.ring.clear();
+                reused.last_used = ++this->use_serial;
+                node.key() = std::move(key);
+                return *this->scope_map.insert(std::move(node))
+                            .position->second;
+            }
+            string file_path = this->recorder_path;
+            if (file_path.size() && this->partitioned)
+            {
+                file_path += "." + std::to_string(this->recorder_serial++);
+            }
+            auto &scope_ptr = this->scope_map[key];
+            scope_ptr.reset(
+                new scope{this->before, this->before_bytes, file_path});
+            scope_ptr->last_used = ++this->use_serial;
+            return *scope_ptr;
+        }
+        /**
+         * @brief Find partition to evict, least recently used one that is
+         * not writing logs after trigger, or least recently used one.
+         *
+         * @return scope_table::iterator Partition to evict.
+         */
+        scope_table::iterator least_used_scope()
+        {
+            auto oldest = this->scope_map.end();
+            auto oldest_idle = this->scope_map.end();
+            for (auto it = this->scope_map.begin(); it != this->scope_map.end();
+                 ++it)
+            {
+                uint64_t used = it->second->last_used;
+                if (oldest == this->scope_map.end() ||
+                    used < oldest->second->last_used)
+                {
+                    oldest = it;
+                }
+                if (!it->second->writing_after.load() &&
+                    (oldest_idle == this->scope_map.end() ||
+                     used < oldest_idle->second->last_used))
+                {
+                    oldest_idle = it;
+                }
+            }
+            return oldest_idle != this->scope_map.end() ? oldest_idle : oldest;
+        }
+        /**
+         * @brief Drop logs older than before window.
+         *
+         * @param ring Ring to prune.
+         * @param nano Timestamp of newest log.
+         */
+        void drop_expired(log_ring &ring, const int64_t nano)
+        {
+            if (this->before_nano <= 0)
+            {
+                return;
+            }
+            while (!ring.empty() &&
+                   ring.front_timestamp() < nano - this->before_nano)
+            {
+                ring.pop_front();
+            }
+        }
+        /**
+         * @brief Write begin mark and logs of partition ring, then clear it.
+         *
+         * @param current Partition triggered.
+         * @param level Level of trigger.
+         * @param nano Timestamp of trigger.
+         */
+        void write_buffered(scope &current, const log_level level,
+                            const int64_t nano)
+        {
+            log_ring &ring = current.ring;
+            this->drop_expired(ring, nano);
+            if (!current.writing_after.load())
+            {
+                // new trigger
+                this->writer_unique_ptr->write(
+                    level, "buffered_shell", "begin", "",
+                    ring.empty() ? nano : ring.front_timestamp());
+            }
+            ring.for_each([&](const log &i) {
+                this->writer_unique_ptr->write(i.level, i.module, i.comment,
+                                               i.data, i.timestamp_nano);
+            });
+            ring.clear();
+        }
+        /**
+         * @brief Write begin mark and logs of all thread rings merged by
+         * timestamp, then clear them.
+         *
+         * @param current After window of per-thread mode.
+         * @param level Level of trigger.
+         * @param nano Timestamp of trigger.
+         */
+        void write_recorded(scope &current, const log_level level,
+                            const int64_t nano)
+        {
+            this->merged.clear();
+            lock_guard registry_lock{this->registry_mutex};
+            for (auto &&recorder_ptr : this->recorder_vector)
+            {
+                // rings of exited threads stay registered, empty, for reuse.
+                lock_guard ring_lock{recorder_ptr->ring_mutex};
+                this->drop_expired(recorder_ptr->ring, nano);
+                recorder_ptr->ring.for_each(
+                    [&](const log &i) { this->merged.push_back(i); });
+                recorder_ptr->ring.clear();
+            }
+            // logs of one thread are in order already, keep it on ties.
+            std::stable_sort(this->merged.begin(), this->merged.end(),
+                             [](const log &a, const log &b) {
+                                 return a.timestamp_nano < b.timestamp_nano;
+                             });
+            if (!current.writing_after.load())
+            {
+                // new trigger
+                this->writer_unique_ptr->write(
+                    level, "buffered_shell", "begin", "",
+                    this->merged.empty() ? nano
+                                         : this->merged.front().timestamp_nano);
+            }
+            for (auto &&i : this->merged)
+            {
+                this->writer_unique_ptr->write(i.level, i.module, i.comment,
+                                               i.data, i.timestamp_nano);
+            }
+        }
+        /**
+         * @brief Buffer log into ring of calling thread.
+         *
+         * @param level Log level.
+         * @param module Module name.
+         * @param comment Content of log.
+         * @param data Data attached.
+         * @param nano Timestamp of log.
+         */
+        void record(const log_level level, const string &module,
+                    const string &comment, const string &data,
+                    const int64_t nano)
+        {
+            recorder &local = this->local_recorder();
+            lock_guard ring_lock{local.ring_mutex};
+            local.ring.push(nano, level, module, comment, data);
+            this->drop_expired(local.ring, nano);
+        }
+        /**
+         * @brief Get ring of calling thread, register one if not exists.
+         *
+         * @return recorder& Ring of calling thread.
+         */
+        recorder &local_recorder()
+        {
+            thread_local thread_recorders local;
+            if (local.last_id == this->id)
+            {
+                return *local.last_ptr;
+            }
+            for (auto &&i : local.list)
+            {
+                if (i.first == this->id)
+                {
+                    local.last_id = this->id;
+                    local.last_ptr = i.second.get();
+                    return *local.last_ptr;
+                }
+            }
+            // drop rings whose shell is gone before registering new one.
+            auto &list = local.list;
+            list.erase(std::remove_if(list.begin(), list.end(),
+                                      [](const thread_recorder &i) {
+                                          return i.second->detached.load();
+                                      }),
+                       list.end());
+            auto recorder_ptr = this->reuse_recorder();
+            if (!recorder_ptr)
+            {
+                string file_path;
+                if (this->recorder_path.size())
+                {
+                    file_path = this->recorder_path + "." +
+                                std::to_string(this->recorder_serial++);
+                }
+                recorder_ptr = std::make_shared<recorder>(
+                    this->before, this->before_bytes, file_path);
+                lock_guard registry_lock{this->registry_mutex};
+                this->recorder_vector.push_back(recorder_ptr);
+            }
+            local.list.emplace_back(this->id, recorder_ptr);
+            local.last_id = this->id;
+            local.last_ptr = recorder_ptr.get();
+            return *local.last_ptr;
+        }
+        /**
+         * @brief Take ring of an exited thread for calling thread.
+         *
+         * @details An empty ring is taken first. Otherwise, once
+         * max_exited_rings rings of exited threads hold logs not written,
+         * the oldest one is cleared and taken, so rings stay bounded under
+         * thread churn.
+         *
+         * @return std::shared_ptr<recorder> Ring taken, nullptr if none.
+         */
+        std::shared_ptr<recorder> reuse_recorder()
+        {
+            lock_guard registry_lock{this->registry_mutex};
+            std::shared_ptr<recorder> oldest;
+            size_t exited = 0;
+            for (auto &&recorder_ptr : this->recorder_vector)
+            {
+                if (!recorder_ptr->closed.load())
+                {
+                    continue;
+                }
+                lock_guard ring_lock{recorder_ptr->ring_mutex};
+                if (recorder_ptr->ring.empty())
+                {
+                    recorder_ptr->closed.store(false);
+                    return recorder_ptr;
+                }
+                if (!oldest)
+                {
+                    oldest = recorder_ptr;
+                }
+                exited++;
+            }
+            if (exited < max_exited_rings)
+            {
+                return nullptr;
+            }
+            lock_guard ring_lock{oldest->ring_mutex};
+            oldest->ring.clear();
+            oldest->closed.store(false);
+            return oldest;
+        }
     };
 } // namespace log2what
 #endif
\ No newline at end of file
@@ -0,0 +1,496 @@
+/**
+ * @file log_ring.hpp
+ * @author TNumFive
+ * @brief Fixed-capacity ring of encoded logs in one byte arena.
+ * @version 0.1
+ * @date 2023-02-27
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef LOG2WHAT_LOG_RING_HPP
+#define LOG2WHAT_LOG_RING_HPP
+#include "../base/common.hpp"
+#include <atomic>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+namespace log2what
+{
+    /**
+     * @brief Magic bytes at the beginning of every log ring region.
+     *
+     * @details Region is "header | slot... | arena". Header and slots are
+     * log_ring_header and log_ring_slot, arena holds logs as
+     * "log_ring_record | module | comment | data". Slots from head, count of
+     * them wrapping around, point at logs from oldest to newest. All fields
+     * are in native byte order, so region is read on the machine it is
+     * written.
+     */
+    static constexpr char log_ring_magic[] = "\x7fL2WREC\x01";
+    static constexpr size_t log_ring_magic_size = sizeof(log_ring_magic) - 1;
+    static constexpr uint32_t log_ring_version = 1;
+
+    /**
+     * @brief Header of log ring region.
+     */
+    struct log_ring_header
+    {
+        char magic[log_ring_magic_size];
+        uint32_t version;
+        /**
+         * @brief Fatal signal caught by handler, 0 if none.
+         */
+        uint32_t fatal_signal;
+        uint64_t max_count;
+        uint64_t max_bytes;
+        uint64_t head;
+        uint64_t count;
+        /**
+         * @brief End of newest log in arena.
+         */
+        uint64_t tail;
+        /**
+         * @brief When fatal signal is caught, in nanoseconds.
+         */
+        int64_t fatal_timestamp;
+        uint64_t pid;
+    };
+
+    /**
+     * @brief Where a log is in arena.
+     */
+    struct log_ring_slot
+    {
+        uint64_t offset;
+        uint64_t size;
+        int64_t timestamp_nano;
+    };
+
+    /**
+     * @brief Fixed part of a log in arena.
+     */
+    struct log_ring_record
+    {
+        int64_t timestamp_nano;
+        uint32_t module_size;
+        uint32_t comment_size;
+        uint32_t data_size;
+        uint32_t level;
+    };
+
+    /**
+     * @brief Ring of the latest logs, limited by count and by bytes.
+     *
+     * @details Every log is stored as "header | module | comment | data" in
+     * an arena allocated once. New logs are copied after the newest one and
+     * overwrite the oldest ones in place, a log that does not fit before the
+     * end of arena starts over at the beginning. So pushing a log costs a
+     * few memcpy and never allocates. With file_path given, the region is a
+     * shared mapping of that file, so logs survive a crash of the process
+     * and can be read by tools/log2what_recover.cpp. Not thread safe.
+     */
+    class log_ring
+    {
+    public:
+        using string = std::string;
+        /**
+         * @brief Construct a new log ring object.
+         *
+         * @param max_count Max number of logs kept.
+         * @param max_bytes Size of arena, logs larger than it are dropped.
+         * @param file_path File mapped as region, empty to use heap. A
+         * region left by last run is renamed with suffix ".prev" first.
+         */
+        log_ring(const size_t max_count, const size_t max_bytes,
+                 const string &file_path = "")
+        {
+            size_t region_size = sizeof(log_ring_header) +
+                                 max_count * sizeof(log_ring_slot) +
+                                 max_bytes;
+            if (file_path.size() && !this->map_file(file_path, region_size))
+            {
+                std::cerr << "log2what::log_ring map file failed, use heap";
+                std::cerr << std::endl;
+            }
+            if (this->region == nullptr)
+            {
+                // uint64_t keeps slots aligned.
+                this->heap_region.resize((region_size + 7) / 8);
+                this->region = reinterpret_cast<char *>(&this->heap_region[0]);
+            }
+            this->header = reinterpret_cast<log_ring_header *>(this->region);
+            this->slots = reinterpret_cast<log_ring_slot *>(
+                this->region + sizeof(log_ring_header));
+            this->arena = this->region + sizeof(log_ring_header) +
+                          max_count * sizeof(log_ring_slot);
+            std::memset(this->header, 0, sizeof(log_ring_header));
+            this->header->version = log_ring_version;
+            this->header->max_count = max_count;
+            this->header->max_bytes = max_bytes;
+            this->header->pid = ::getpid();
+            // magic last, so a region is only recognized when complete.
+            std::atomic_signal_fence(std::memory_order_release);
+            std::memcpy(this->header->magic, log_ring_magic,
+                        log_ring_magic_size);
+            if (this->fd >= 0 && !log_ring::track(this->header))
+            {
+                std::cerr << "log2what::log_ring more than " << max_tracked;
+                std::cerr << " rings mapped, fatal handler skips " << file_path;
+                std::cerr << std::endl;
+            }
+        }
+        /**
+         * @brief Copy constructor deleted.
+         *
+         * @param other Other ring.
+         */
+        log_ring(const log_ring &other) = delete;
+        /**
+         * @brief Copy assign constructor deleted.
+         *
+         * @param other Other ring.
+         * @return log_ring& Self.
+         */
+        log_ring &operator=(const log_ring &other) = delete;
+        /**
+         * @brief Move constructor deleted.
+         *
+         * @param other Other ring.
+         */
+        log_ring(log_ring &&other) = delete;
+        /**
+         * @brief Move assign constructor deleted.
+         *
+         * @param other Other ring.
+         * @return log_ring& Self.
+         */
+        log_ring &operator=(log_ring &&other) = delete;
+        /**
+         * @brief Destroy the log ring object, file of region is kept if it
+         * still holds logs, and removed otherwise.
+         */
+        ~log_ring()
+        {
+            if (this->fd < 0)
+            {
+                return;
+            }
+            log_ring::untrack(this->header);
+            bool written = this->empty();
+            ::munmap(this->region, this->region_size);
+            ::close(this->fd);
+            if (written)
+            {
+                ::unlink(this->file_path.c_str());
+            }
+        }
+        /**
+         * @brief Copy log into ring, evicting oldest logs if needed.
+         *
+         * @param timestamp_nano Timestamp in nanoseconds.
+         * @param level Log level.
+         * @param module Module name.
+         * @param comment Content of log.
+         * @param data Data attached.
+         */
+        void push(const int64_t timestamp_nano, const log_level level,
+                  const string &module, const string &comment,
+                  const string &data)
+        {
+            log_ring_header &state = *this->header;
+            size_t size = sizeof(log_ring_record) + module.size() +
+                          comment.size() + data.size();
+            if (state.max_count == 0 || size > state.max_bytes)
+            {
+                return;
+            }
+            if (state.count == state.max_count)
+            {
+                this->pop_front();
+            }
+            size_t offset = state.tail;
+            bool wrapped = offset + size > state.max_bytes;
+            if (wrapped)
+            {
+                offset = 0;
+            }
+            // oldest logs follow tail, evict them until the claimed bytes
+            // are free.
+            while (state.count > 0)
+            {
+                const log_ring_slot &oldest = this->slots[state.head];
+                bool overlaps = oldest.offset < offset + size &&
+                                oldest.offset + oldest.size > offset;
+                if (!overlaps && !(wrapped && oldest.offset >= state.tail))
+                {
+                    break;
+                }
+                this->pop_front();
+            }
+            log_ring_record record{timestamp_nano,
+                                   static_cast<uint32_t>(module.size()),
+                                   static_cast<uint32_t>(comment.size()),
+                                   static_cast<uint32_t>(data.size()),
+                                   static_cast<uint32_t>(level)};
+            char *cursor = this->arena + offset;
+            std::memcpy(cursor, &record, sizeof(record));
+            cursor += sizeof(record);
+            std::memcpy(cursor, module.data(), module.size());
+            cursor += module.size();
+            std::memcpy(cursor, comment.data(), comment.size());
+            cursor += comment.size();
+            std::memcpy(cursor, data.data(), data.size());
+            this->slots[this->index_of(state.count)] =
+                log_ring_slot{offset, size, timestamp_nano};
+            // a crash may stop push anywhere, count the log only when whole.
+            std::atomic_signal_fence(std::memory_order_release);
+            state.count++;
+            state.tail = offset + size;
+        }
+        /**
+         * @brief Drop oldest log.
+         */
+        void pop_front()
+        {
+            log_ring_header &state = *this->header;
+            if (state.count == 0)
+            {
+                return;
+            }
+            state.head = (state.head + 1) % state.max_count;
+            state.count--;
+            if (state.count == 0)
+            {
+                this->clear();
+            }
+        }
+        /**
+         * @brief Drop all logs.
+         */
+        void clear()
+        {
+            this->header->count = 0;
+            std::atomic_signal_fence(std::memory_order_release);
+            this->header->head = 0;
+            this->header->tail = 0;
+        }
+        /**
+         * @brief Number of logs kept.
+         *
+         * @return size_t Number of logs.
+         */
+        size_t size() const { return this->header->count; }
+        /**
+         * @brief Check if no log is kept.
+         *
+         * @return true Yes.
+         * @return false No.
+         */
+        bool empty() const { return this->header->count == 0; }
+        /**
+         * @brief Timestamp of oldest log.
+         *
+         * @return int64_t Timestamp in nanoseconds, undefined if empty.
+         */
+        int64_t front_timestamp() const
+        {
+            return this->slots[this->header->head].timestamp_nano;
+        }
+        /**
+         * @brief Decode logs from oldest to newest.
+         *
+         * @tparam Func Type of callback.
+         * @param func Called with const log&, which is reused between calls.
+         */
+        template <typename Func> void for_each(Func &&func) const
+        {
+            log item{0, log_level::TRACE, "", "", ""};
+            for (size_t i = 0; i < this->header->count; i++)
+            {
+                const log_ring_slot &current = this->slots[this->index_of(i)];
+                const char *cursor = this->arena + current.offset;
+                log_ring_record record;
+                std::memcpy(&record, cursor, sizeof(record));
+                cursor += sizeof(record);
+                item.timestamp_nano = record.timestamp_nano;
+                item.level = static_cast<log_level>(record.level);
+                item.module.assign(cursor, record.module_size);
+                cursor += record.module_size;
+                item.comment.assign(cursor, record.comment_size);
+                cursor += record.comment_size;
+                item.data.assign(cursor, record.data_size);
+                func(static_cast<const log &>(item));
+            }
+        }
+        /**
+         * @brief Mark regions of all file-backed rings when a fatal signal
+         * arrives, then let previous handler of the signal run.
+         *
+         * @details Handler only stores into mapped memory and calls
+         * clock_gettime, sigaction and raise, which are async-signal-safe.
+         * Pages of a shared mapping outlive the process, so no sync is
+         * needed. Calling it again leaves signals already handled as is, so
+         * previous handler is never the handler itself.
+         *
+         * @param signals Signals to handle.
+         */
+        static void
+        install_fatal_handler(const std::vector<int> &signals = {
+                                  SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT})
+        {
+            struct sigaction action;
+            std::memset(&action, 0, sizeof(action));
+            action.sa_handler = &log_ring::on_fatal;
+            sigemptyset(&action.sa_mask);
+            for (int signal : signals)
+            {
+                struct sigaction current;
+                if (signal <= 0 || signal >= NSIG ||
+                    ::sigaction(signal, nullptr, &current) != 0 ||
+                    current.sa_handler == &log_ring::on_fatal)
+                {
+                    continue;
+                }
+                ::sigaction(signal, &action, &previous_actions[signal]);
+            }
+        }
+
+    private:
+        /**
+         * @brief Max file-backed rings marked by fatal handler.
+         */
+        static constexpr size_t max_tracked = 64;
+        static inline std::atomic<log_ring_header *> tracked[max_tracked];
+        static inline struct sigaction previous_actions[NSIG];
+        /**
+         * @brief Owns region when it is on heap.
+         */
+        std::vector<uint64_t> heap_region;
+        char *region = nullptr;
+        size_t region_size = 0;
+        int fd = -1;
+        string file_path;
+        log_ring_header *header;
+        log_ring_slot *slots;
+        char *arena;
+        /**
+         * @brief Index of slot of i-th log from oldest.
+         *
+         * @param i Position from oldest.
+         * @return size_t Index in slots.
+         */
+        size_t index_of(const size_t i) const
+        {
+            return (this->header->head + i) % this->header->max_count;
+        }
+        /**
+         * @brief Map file as region, keeping region of last run aside.
+         *
+         * @param file_path File to map.
+         * @param region_size Size of region.
+         * @return true If mapped.
+         * @return false If failed.
+         */
+        bool map_file(const string &file_path, const size_t region_size)
+        {
+            struct stat file_stat;
+            if (::stat(file_path.c_str(), &file_stat) == 0 &&
+                file_stat.st_size > 0)
+            {
+                string previous = file_path + ".prev";
+                std::rename(file_path.c_str(), previous.c_str());
+            }
+            int file_fd = ::open(file_path.c_str(),
+                                 O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (file_fd < 0)
+            {
+                return false;
+            }
+            void *base = MAP_FAILED;
+            if (::ftruncate(file_fd, region_size) == 0)
+            {
+                base = ::mmap(nullptr, region_size, PROT_READ | PROT_WRITE,
+                              MAP_SHARED, file_fd, 0);
+            }
+            if (base == MAP_FAILED)
+            {
+                ::close(file_fd);
+                return false;
+            }
+            this->fd = file_fd;
+            this->file_path = file_path;
+            this->region = static_cast<char *>(base);
+            this->region_size = region_size;
+            return true;
+        }
+        /**
+         * @brief Let fatal handler mark region.
+         *
+         * @param region_header Header of region.
+         * @return true If tracked.
+         * @return false If max_tracked regions are tracked already.
+         */
+        static bool track(log_ring_header *region_header)
+        {
+            for (auto &slot : tracked)
+            {
+                log_ring_header *expected = nullptr;
+                if (slot.compare_exchange_strong(expected, region_header))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+        /**
+         * @brief Stop marking region.
+         *
+         * @param region_header Header of region.
+         */
+        static void untrack(log_ring_header *region_header)
+        {
+            for (auto &slot : tracked)
+            {
+                log_ring_header *expected = region_header;
+                if (slot.compare_exchange_strong(expected, nullptr))
+                {
+                    return;
+                }
+            }
+        }
+        /**
+         * @brief Fatal signal handler.
+         *
+         * @param signal Signal caught.
+         */
+        static void on_fatal(const int signal)
+        {
+            timespec now;
+            ::clock_gettime(CLOCK_REALTIME, &now);
+            for (auto &slot : tracked)
+            {
+                log_ring_header *region_header = slot.load();
+                if (region_header != nullptr)
+                {
+                    region_header->fatal_timestamp =
+                        static_cast<int64_t>(now.tv_sec) * 1000000000 +
+                        now.tv_nsec;
+                    region_header->fatal_signal = signal;
+                }
+            }
+            ::sigaction(signal, &previous_actions[signal], nullptr);
+            ::raise(signal);
+        }
+    };
+} // namespace log2what
+#endif
@@ -0,0 +1,487 @@
+/**
+ * @file db_cursor.cpp
+ * @author TNumFive
+ * @brief Implementation of db_cursor.
+ * @version 0.1
+ * @date 2023-02-24
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "./db_cursor.hpp"
+#include "../base/queue.hpp"
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <functional>
+#include <sqlite3.h>
+#include <sys/stat.h>
+#include <thread>
+
+using namespace std;
+using namespace log2what;
+
+/**
+ * @brief How long to wait when database is locked by writer.
+ */
+static constexpr int busy_timeout_milli = 1000;
+/**
+ * @brief How many rows a reader thread reads ahead.
+ */
+static constexpr size_t read_ahead_size = 1024;
+
+/**
+ * @brief Check if name is a partition of database, "NAME.YYYYmmdd_HHMMSS_mmm".
+ *
+ * @param name File name.
+ * @param prefix File name of database with trailing '.'.
+ * @return true Yes.
+ * @return false No.
+ */
+static bool is_partition_name(const string &name, const string &prefix)
+{
+    constexpr size_t suffix_size = 19;
+    if (name.size() != prefix.size() + suffix_size ||
+        name.compare(0, prefix.size(), prefix) != 0)
+    {
+        return false;
+    }
+    tm lt;
+    memset(&lt, 0, sizeof(lt));
+    const char *end = strptime(name.c_str() + prefix.size(), "%Y%m%d_%H%M%S",
+                               &lt);
+    return end != nullptr && *end == '_' && strlen(end) == 4;
+}
+
+struct db_cursor::source
+{
+    sqlite3 *db_ptr = nullptr;
+    /**
+     * @brief One query per level, each streamed in timestamp order by index
+     * (level, timestamp) and merged by step().
+     */
+    vector<sqlite3_stmt *> stmt_vector;
+    /**
+     * @brief Set when query of same index holds a row not read yet.
+     */
+    vector<bool> row_ready;
+    vector<string> sql_vector;
+    string error_str;
+    spsc_queue<log> log_queue{read_ahead_size};
+    wait_event not_empty;
+    wait_event not_full;
+    atomic<bool> done{false};
+    thread reader;
+    /**
+     * @brief Destroy the source object, reader thread is joined by cursor.
+     */
+    ~source()
+    {
+        this->finalize();
+        sqlite3_close(this->db_ptr);
+    }
+    /**
+     * @brief Check if any query is left.
+     *
+     * @return true Yes.
+     * @return false No.
+     */
+    bool active() const { return this->stmt_vector.size(); }
+    /**
+     * @brief Finalize all queries.
+     */
+    void finalize()
+    {
+        for (sqlite3_stmt *stmt : this->stmt_vector)
+        {
+            sqlite3_finalize(stmt);
+        }
+        this->stmt_vector.clear();
+        this->row_ready.clear();
+    }
+    /**
+     * @brief Record error of connection.
+     *
+     * @param what What failed.
+     */
+    void fail(const string &what)
+    {
+        this->error_str = what;
+        if (this->db_ptr != nullptr)
+        {
+            this->error_str.append(": ").append(sqlite3_errmsg(this->db_ptr));
+        }
+    }
+    /**
+     * @brief Open database and prepare query.
+     *
+     * @param path Path of database.
+     * @param from_nano Least timestamp in nanoseconds.
+     * @param to_nano Greatest timestamp in nanoseconds.
+     * @param levels Levels wanted.
+     * @param module Module wanted, empty for all modules.
+     * @return true If query is ready, or database has no log in range.
+     * @return false If failed.
+     */
+    bool open(const string &path, const int64_t from_nano,
+              const int64_t to_nano, const vector<int> &levels,
+              const string &module)
+    {
+        if (SQLITE_OK != sqlite3_open_v2(path.c_str(), &this->db_ptr,
+                                         SQLITE_OPEN_READONLY, nullptr))
+        {
+            this->fail(path + ": open db failed");
+            return false;
+        }
+        sqlite3_busy_timeout(this->db_ptr, busy_timeout_milli);
+        int version = 0;
+        sqlite3_stmt *stmt = nullptr;
+        if (SQLITE_OK == sqlite3_prepare_v2(this->db_ptr,
+                                            "pragma user_version;", -1, &stmt,
+                                            nullptr) &&
+            SQLITE_ROW == sqlite3_step(stmt))
+        {
+            version = sqlite3_column_int(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+        if (version < 2 || version > db_schema_version)
+        {
+            this->error_str = path + ": unsupported schema version " +
+                              std::to_string(version);
+            return false;
+        }
+        if (version >= 3 && !this->overlaps(from_nano, to_nano))
+        {
+            return true;
+        }
+        // with a single level, index (level, timestamp) or
+        // (module_id, timestamp) yields rows in order, so no sort is needed.
+        for (int level : levels)
+        {
+            string sql = "select log.timestamp, log.level, module.name, "
+                         "log.comment, log.data, log.id from log "
+                         "left join module on module.id = log.module_id "
+                         "where log.level = " +
+                         std::to_string(level) +
+                         " and log.timestamp between ?1 and ?2";
+            if (module.size())
+            {
+                sql.append(" and log.module_id = "
+                           "(select id from module where name = ?3)");
+            }
+            sql.append(" order by log.timestamp, log.id;");
+            sqlite3_stmt *stmt = nullptr;
+            if (SQLITE_OK != sqlite3_prepare_v2(this->db_ptr, sql.c_str(),
+                                                sql.size(), &stmt, nullptr))
+            {
+                this->fail(path + ": prepare query failed");
+                return false;
+            }
+            sqlite3_bind_int64(stmt, 1, from_nano);
+            sqlite3_bind_int64(stmt, 2, to_nano);
+            if (module.size())
+            {
+                sqlite3_bind_text(stmt, 3, module.c_str(), module.size(),
+                                  SQLITE_TRANSIENT);
+            }
+            this->stmt_vector.push_back(stmt);
+            this->row_ready.push_back(false);
+            this->sql_vector.push_back(sql);
+        }
+        return true;
+    }
+    /**
+     * @brief Get query plans of queries.
+     *
+     * @return string Details of plans, one line each.
+     */
+    string query_plan()
+    {
+        string plan;
+        for (auto &sql : this->sql_vector)
+        {
+            string explain = "explain query plan " + sql;
+            sqlite3_stmt *stmt = nullptr;
+            if (SQLITE_OK == sqlite3_prepare_v2(this->db_ptr, explain.c_str(),
+                                                explain.size(), &stmt,
+                                                nullptr))
+            {
+                while (SQLITE_ROW == sqlite3_step(stmt))
+                {
+                    const char *detail = reinterpret_cast<const char *>(
+                        sqlite3_column_text(stmt, 3));
+                    plan.append(detail ? detail : "").append("\n");
+                }
+            }
+            sqlite3_finalize(stmt);
+        }
+        return plan;
+    }
+    /**
+     * @brief Check if time range of database overlaps the query.
+     *
+     * @param from_nano Least timestamp in nanoseconds.
+     * @param to_nano Greatest timestamp in nanoseconds.
+     * @return true Yes.
+     * @return false No, or database has no log.
+     */
+    bool overlaps(const int64_t from_nano, const int64_t to_nano)
+    {
+        sqlite3_stmt *stmt = nullptr;
+        bool found = false;
+        if (SQLITE_OK ==
+                sqlite3_prepare_v2(this->db_ptr,
+                                   "select first, last from log_range;", -1,
+                                   &stmt, nullptr) &&
+            SQLITE_ROW == sqlite3_step(stmt))
+        {
+            found = sqlite3_column_int64(stmt, 0) <= to_nano &&
+                    sqlite3_column_int64(stmt, 1) >= from_nano;
+        }
+        sqlite3_finalize(stmt);
+        return found;
+    }
+    /**
+     * @brief Read next row of query.
+     *
+     * @param item Where the log is stored.
+     * @return true If a log is read.
+     * @return false If no more log or query failed.
+     */
+    bool step(log &item)
+    {
+        size_t i = 0;
+        while (i < this->stmt_vector.size())
+        {
+            if (this->row_ready[i])
+            {
+                i++;
+                continue;
+            }
+            int ret = sqlite3_step(this->stmt_vector[i]);
+            if (ret == SQLITE_ROW)
+            {
+                this->row_ready[i++] = true;
+                continue;
+            }
+            if (ret != SQLITE_DONE)
+            {
+                this->fail("step query failed");
+                this->finalize();
+                return false;
+            }
+            sqlite3_finalize(this->stmt_vector[i]);
+            this->stmt_vector.erase(this->stmt_vector.begin() + i);
+            this->row_ready.erase(this->row_ready.begin() + i);
+        }
+        if (this->stmt_vector.empty())
+        {
+            return false;
+        }
+        // earliest row by (timestamp, id) among queries.
+        auto key = [&](const size_t index) {
+            sqlite3_stmt *stmt = this->stmt_vector[index];
+            return make_pair(sqlite3_column_int64(stmt, 0),
+                             sqlite3_column_int64(stmt, 5));
+        };
+        size_t best = 0;
+        for (i = 1; i < this->stmt_vector.size(); i++)
+        {
+            if (key(i) < key(best))
+            {
+                best = i;
+            }
+        }
+        sqlite3_stmt *stmt = this->stmt_vector[best];
+        this->row_ready[best] = false;
+        auto text = [&](const int column, string &out) {
+            const char *value = reinterpret_cast<const char *>(
+                sqlite3_column_text(stmt, column));
+            out.assign(value ? value : "", sqlite3_column_bytes(stmt, column));
+        };
+        item.timestamp_nano = sqlite3_column_int64(stmt, 0);
+        item.level = static_cast<log_level>(sqlite3_column_int(stmt, 1));
+        text(2, item.module);
+        text(3, item.comment);
+        text(4, item.data);
+        return true;
+    }
+    /**
+     * @brief Loop of reader thread, reads ahead into log_queue.
+     *
+     * @param stopping Set when cursor is destroyed.
+     */
+    void read_in_background(const atomic<bool> &stopping)
+    {
+        log item{0, log_level::TRACE, "", "", ""};
+        auto &log_queue = this->log_queue;
+        while (!stopping.load() && this->step(item))
+        {
+            if (!log_queue.try_push(std::move(item)))
+            {
+                this->not_full.wait_until([&]() {
+                    return stopping.load() ||
+                           log_queue.try_push(std::move(item));
+                });
+            }
+            this->not_empty.notify();
+        }
+        this->done.store(true);
+        this->not_empty.notify();
+    }
+};
+
+db_cursor::db_cursor(const string &file_path, const int64_t from_nano,
+                     const int64_t to_nano, const int level_mask,
+                     const string &module)
+{
+    vector<string> path_vector;
+    struct stat file_stat;
+    if (::stat(file_path.c_str(), &file_stat) == 0)
+    {
+        path_vector.push_back(file_path);
+    }
+    size_t delimiter = file_path.find_last_of('/');
+    string dir = file_path.substr(0, delimiter + 1);
+    string prefix = file_path.substr(delimiter + 1) + ".";
+    auto dir_ptr = opendir(dir.empty() ? "." : dir.c_str());
+    if (dir_ptr != nullptr)
+    {
+        for (auto entry = readdir(dir_ptr); entry != nullptr;
+             entry = readdir(dir_ptr))
+        {
+            if (is_partition_name(entry->d_name, prefix))
+            {
+                path_vector.push_back(dir + entry->d_name);
+            }
+        }
+        closedir(dir_ptr);
+    }
+    sort(path_vector.begin(), path_vector.end());
+    if (path_vector.empty())
+    {
+        this->error_str = file_path + ": no database found";
+        return;
+    }
+    vector<int> levels;
+    for (int level = static_cast<int>(log_level::TRACE);
+         level <= static_cast<int>(log_level::ERROR); level <<= 1)
+    {
+        if (level & level_mask)
+        {
+            levels.push_back(level);
+        }
+    }
+    if (levels.empty())
+    {
+        return;
+    }
+    for (auto &path : path_vector)
+    {
+        unique_ptr<source> src{new source};
+        if (!src->open(path, from_nano, to_nano, levels, module))
+        {
+            this->error_str = src->error_str;
+            this->source_vector.clear();
+            return;
+        }
+        if (src->active())
+        {
+            this->source_vector.push_back(std::move(src));
+        }
+    }
+    if (this->source_vector.size() < 2)
+    {
+        return;
+    }
+    for (auto &src : this->source_vector)
+    {
+        src->reader = thread{&source::read_in_background, src.get(),
+                             cref(this->stopping)};
+    }
+}
+
+db_cursor::~db_cursor()
+{
+    this->stopping.store(true);
+    for (auto &src : this->source_vector)
+    {
+        src->not_full.notify();
+    }
+    // readers watch stopping, so they are joined before it is destroyed.
+    for (auto &src : this->source_vector)
+    {
+        if (src->reader.joinable())
+        {
+            src->reader.join();
+        }
+    }
+}
+
+string db_cursor::query_plan() const
+{
+    string plan;
+    for (auto &src : this->source_vector)
+    {
+        plan.append(src->query_plan());
+    }
+    return plan;
+}
+
+bool db_cursor::next(log &item)
+{
+    if (!this->good() || this->source_vector.empty())
+    {
+        return false;
+    }
+    if (this->source_vector.size() == 1)
+    {
+        source &src = *this->source_vector[0];
+        bool read = src.step(item);
+        this->error_str = src.error_str;
+        return read;
+    }
+    auto later = greater<pair<int64_t, size_t>>{};
+    if (!this->started)
+    {
+        for (size_t i = 0; i < this->source_vector.size(); i++)
+        {
+            this->push_head(i);
+        }
+        this->started = true;
+    }
+    if (this->heap.empty() || !this->good())
+    {
+        return false;
+    }
+    pop_heap(this->heap.begin(), this->heap.end(), later);
+    size_t index = this->heap.back().second;
+    this->heap.pop_back();
+    source &src = *this->source_vector[index];
+    item = std::move(*src.log_queue.front());
+    src.log_queue.pop();
+    src.not_full.notify();
+    this->push_head(index);
+    return true;
+}
+
+void db_cursor::push_head(const size_t index)
+{
+    source &src = *this->source_vector[index];
+    auto &log_queue = src.log_queue;
+    src.not_empty.wait_until(
+        [&]() { return log_queue.front() != nullptr || src.done.load(); });
+    // a log pushed right before done is only seen after done is loaded.
+    log *front = log_queue.front();
+    if (front != nullptr)
+    {
+        this->heap.emplace_back(front->timestamp_nano, index);
+        push_heap(this->heap.begin(), this->heap.end(),
+                  greater<pair<int64_t, size_t>>{});
+    }
+    else if (src.error_str.size())
+    {
+        this->error_str = src.error_str;
+    }
+}
@@ -0,0 +1,145 @@
+/**
+ * @file db_cursor.hpp
+ * @author TNumFive
+ * @brief Cursor that reads logs written by db_writer.
+ * @version 0.1
+ * @date 2023-02-24
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef LOG2WHAT_DB_CURSOR_HPP
+#define LOG2WHAT_DB_CURSOR_HPP
+
+#include "../base/common.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace log2what
+{
+    /**
+     * @brief Version of database schema written by db_writer, stored in
+     * "pragma user_version".
+     *
+     * @details Version 2 has table module(id, name) and table
+     * log(id, timestamp, level, module_id, comment, data), id of log only
+     * grows. Version 3 adds table log_range(id, first, last), one row with
+     * least and greatest timestamp in the database.
+     */
+    static constexpr int db_schema_version = 3;
+
+    /**
+     * @brief Cursor over logs of a database written by db_writer.
+     *
+     * @details Logs are streamed in timestamp order, using indexes on
+     * (level, timestamp) and (module_id, timestamp) created by db_writer.
+     * Every wanted level is queried on its own, so rows come out of index
+     * in order and are merged without sorting. Cursor opens its own
+     * read-only connections, so it can be used while db_writer is writing
+     * the same database without locking it. Partitions of file_path whose
+     * time range overlaps the query are read in parallel, one thread each,
+     * and merged by timestamp.
+     */
+    class db_cursor
+    {
+    public:
+        using string = std::string;
+        /**
+         * @brief Construct a new db cursor object and start query.
+         *
+         * @param file_path File path given to db_writer.
+         * @param from_nano Least timestamp in nanoseconds, inclusive.
+         * @param to_nano Greatest timestamp in nanoseconds, inclusive.
+         * @param level_mask Levels wanted, see get_level_mask().
+         * @param module Module wanted, empty for all modules.
+         */
+        db_cursor(const string &file_path, const int64_t from_nano = INT64_MIN,
+                  const int64_t to_nano = INT64_MAX,
+                  const int level_mask = get_level_mask(log_level::TRACE),
+                  const string &module = "");
+        /**
+         * @brief Copy constructor deleted.
+         *
+         * @param other Other cursor.
+         */
+        db_cursor(const db_cursor &other) = delete;
+        /**
+         * @brief Copy assign constructor deleted.
+         *
+         * @param other Other cursor.
+         * @return db_cursor& Self.
+         */
+        db_cursor &operator=(const db_cursor &other) = delete;
+        /**
+         * @brief Move constructor deleted.
+         *
+         * @param other Other cursor.
+         */
+        db_cursor(db_cursor &&other) = delete;
+        /**
+         * @brief Move assign constructor deleted.
+         *
+         * @param other Other cursor.
+         * @return db_cursor& Self.
+         */
+        db_cursor &operator=(db_cursor &&other) = delete;
+        /**
+         * @brief Destroy the db cursor object and close connection.
+         */
+        ~db_cursor();
+        /**
+         * @brief Read next log.
+         *
+         * @param item Where the log is stored.
+         * @return true If a log is read.
+         * @return false If no more log or query failed.
+         */
+        bool next(log &item);
+        /**
+         * @brief Check if query has not failed.
+         *
+         * @return true Yes.
+         * @return false No, see error().
+         */
+        bool good() const { return this->error_str.empty(); }
+        /**
+         * @brief Get reason of failure.
+         *
+         * @return const string& Error message, empty if good.
+         */
+        const string &error() const { return this->error_str; }
+        /**
+         * @brief Get plans sqlite chose for queries, for checking that no
+         * sort is done before the first row.
+         *
+         * @return string Details of plans, one line each.
+         */
+        string query_plan() const;
+
+    private:
+        /**
+         * @brief Query on one database file, defined in db_cursor.cpp.
+         */
+        struct source;
+        std::vector<std::unique_ptr<source>> source_vector;
+        /**
+         * @brief Min heap of timestamp of front log and index of source.
+         */
+        std::vector<std::pair<int64_t, size_t>> heap;
+        bool started = false;
+        std::atomic<bool> stopping{false};
+        string error_str;
+        /**
+         * @brief Wait for next log of source and push it into heap.
+         *
+         * @param index Index of source.
+         */
+        void push_head(const size_t index);
+    };
+} // namespace log2what
+
+#endif
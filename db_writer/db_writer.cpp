@@ -9,17 +9,38 @@
  *
  */
 #include "./db_writer.hpp"
+#include "./db_cursor.hpp"
 #include "../base/common.hpp"
 #include "../base/log2what.hpp"
+#include "../base/queue.hpp"
+#include "../base/time_format.hpp"
+#include "../base/binary_log.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <ctime>
 #include <dirent.h>
-#include <list>
+#include <fcntl.h>
+#include <iostream>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <set>
 #include <sqlite3.h>
+#include <sstream>
+#include <string_view>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
 
 using namespace std;
 using namespace log2what;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
 
 /**
  * @brief Every log has 5 columns.
@@ -35,9 +56,375 @@ static constexpr size_t limit_variable_number = 32766;
  * @brief The max number of logs to be buffered.
  */
 static constexpr size_t max_buffer_size = limit_variable_number / log_column;
+/**
+ * @brief Number of cached insert statements, the k-th inserts 2^k logs.
+ */
+static constexpr size_t stmt_cache_size = 13;
+/**
+ * @brief The max number of logs inserted by one statement.
+ */
+static constexpr size_t max_chunk_size = size_t{1} << (stmt_cache_size - 1);
+static_assert(max_chunk_size <= max_buffer_size, "too many variables");
+/**
+ * @brief How long to wait when database is locked by a reader.
+ */
+static constexpr int busy_timeout_milli = 1000;
+/**
+ * @brief Nanoseconds of a second.
+ */
+static constexpr int64_t sec_to_nano = 1000000000;
+/**
+ * @brief Length of ".YYYYmmdd_HHMMSS_mmm" after path of partition, with
+ * terminating zero.
+ */
+static constexpr size_t partition_suffix_size = 21;
+/**
+ * @brief Extension of spill file after file path of database.
+ */
+static constexpr char spill_extension[] = ".spill";
+/**
+ * @brief Magic bytes at the beginning of spill file.
+ */
+static constexpr char spill_magic[] = "\x7fL2WSPL\x01";
+static constexpr size_t spill_magic_size = sizeof(spill_magic) - 1;
+/**
+ * @brief Size of spill file header, "magic | u64 replay offset".
+ */
+static constexpr size_t spill_header_size =
+    spill_magic_size + sizeof(uint64_t);
+/**
+ * @brief Bytes of spill file read for one replay.
+ */
+static constexpr size_t spill_read_size = 1 << 20;
+
+/**
+ * @brief Get suffix of partition created at given time.
+ *
+ * @param timestamp_milli Start of partition in milliseconds.
+ * @return string ".YYYYmmdd_HHMMSS_mmm" in local time.
+ */
+static string get_partition_suffix(const int64_t timestamp_milli)
+{
+    char suffix[partition_suffix_size];
+    tm lt = get_localtime_tm(timestamp_milli / 1000);
+    strftime(suffix, sizeof(suffix), ".%Y%m%d_%H%M%S_", &lt);
+    write_digits(suffix + partition_suffix_size - 4, timestamp_milli % 1000, 3);
+    suffix[partition_suffix_size - 1] = '\0';
+    return suffix;
+}
+
+/**
+ * @brief Get start time of partition from its path.
+ *
+ * @param path Path of partition.
+ * @return int64_t Timestamp in milliseconds, 0 if path is malformed.
+ */
+static int64_t get_partition_timestamp(const string &path)
+{
+    constexpr size_t suffix_size = partition_suffix_size - 1;
+    if (path.size() < suffix_size || path[path.size() - suffix_size] != '.')
+    {
+        return 0;
+    }
+    tm lt;
+    memset(&lt, 0, sizeof(lt));
+    const char *suffix = path.c_str() + path.size() - suffix_size + 1;
+    const char *end = strptime(suffix, "%Y%m%d_%H%M%S", &lt);
+    if (end == nullptr || *end != '_' || strlen(end) != 4)
+    {
+        return 0;
+    }
+    lt.tm_isdst = -1;
+    return static_cast<int64_t>(mktime(&lt)) * 1000 + atoi(end + 1);
+}
+
+/**
+ * @brief Read all bytes at given offset.
+ *
+ * @param fd File descriptor.
+ * @param data Where to store.
+ * @param size Number of bytes.
+ * @param offset Offset in file.
+ * @return true If all read.
+ * @return false If failed or file is shorter.
+ */
+static bool read_at(const int fd, char *data, size_t size, off_t offset)
+{
+    while (size > 0)
+    {
+        ssize_t done = ::pread(fd, data, size, offset);
+        if (done < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (done <= 0)
+        {
+            return false;
+        }
+        data += done;
+        size -= done;
+        offset += done;
+    }
+    return true;
+}
+
+/**
+ * @brief Log parsed from an encoded record, texts point into the record.
+ */
+struct log_view
+{
+    int64_t timestamp_nano = 0;
+    log_level level = log_level::TRACE;
+    std::string_view module;
+    std::string_view comment;
+    std::string_view data;
+};
+
+/**
+ * @brief Encode log as a MODULE record with id 0 followed by a LOG record,
+ * the form logs take both in queue and in spill file.
+ *
+ * @param record Buffer to append to, reserved once.
+ * @param level Log level.
+ * @param module Module name.
+ * @param comment Content of log.
+ * @param data Data attached.
+ * @param timestamp_nano Timestamp of log in nano.
+ */
+static void encode_log(string &record, const log_level level,
+                       const string &module, const string &comment,
+                       const string &data, const int64_t timestamp_nano)
+{
+    record.reserve(record.size() + binary_module_fixed_size + module.size() +
+                   binary_log_fixed_size + comment.size() + data.size());
+    append_module_record(record, 0, module);
+    append_log_record(record, timestamp_nano, level, 0, comment, data);
+}
+
+/**
+ * @brief Parse next encoded log, a MODULE record followed by a LOG record.
+ *
+ * @param buffer Bytes of queued record or read from spill file.
+ * @param parsed Bytes parsed before, moved forward if a log is parsed.
+ * @param item Where the log is stored, valid while buffer is unchanged.
+ * @return true If a whole log is parsed.
+ * @return false If buffer ends or record is malformed.
+ */
+static bool parse_spilled(const string &buffer, size_t &parsed,
+                          log_view &item)
+{
+    const char *begin = buffer.data() + parsed;
+    const char *end = buffer.data() + buffer.size();
+    const char *cursor = begin;
+    for (auto type : {binary_record_type::MODULE, binary_record_type::LOG})
+    {
+        if (end - cursor < static_cast<ptrdiff_t>(sizeof(uint32_t)))
+        {
+            return false;
+        }
+        uint32_t length = read_binary<uint32_t>(cursor);
+        const char *record_end = cursor + length;
+        if (length > static_cast<size_t>(end - cursor) ||
+            length == 0 || read_binary<uint8_t>(cursor) !=
+                               static_cast<uint8_t>(type))
+        {
+            return false;
+        }
+        if (type == binary_record_type::MODULE)
+        {
+            if (length < binary_module_fixed_size - sizeof(uint32_t))
+            {
+                return false;
+            }
+            read_binary<uint32_t>(cursor);
+            item.module = std::string_view(cursor, record_end - cursor);
+        }
+        else
+        {
+            if (length < binary_log_fixed_size - sizeof(uint32_t))
+            {
+                return false;
+            }
+            item.timestamp_nano = read_binary<int64_t>(cursor);
+            item.level = static_cast<log_level>(read_binary<uint8_t>(cursor));
+            read_binary<uint32_t>(cursor);
+            uint32_t comment_size = read_binary<uint32_t>(cursor);
+            if (comment_size > static_cast<size_t>(record_end - cursor))
+            {
+                return false;
+            }
+            item.comment = std::string_view(cursor, comment_size);
+            item.data = std::string_view(cursor + comment_size,
+                                         record_end - cursor - comment_size);
+        }
+        cursor = record_end;
+    }
+    parsed += cursor - begin;
+    return true;
+}
+
+/**
+ * @brief How many logs can wait for the flush thread.
+ */
+static constexpr size_t queue_capacity = 8192;
+
+/**
+ * @brief Capacity a queue cell may keep after its log is taken.
+ */
+static constexpr size_t cell_capacity_limit = 4096;
+
+/**
+ * @brief Logs staged for insert, stored by column.
+ *
+ * @details Timestamps, levels and module ids are kept in arrays, comment
+ * and data of all logs are packed into one byte arena and located by
+ * offsets.
+ * Statements bind directly into the arena, which must not grow between
+ * binding and stepping. clear() keeps capacity, so once the arrays have
+ * grown to the usual batch, staging allocates nothing.
+ */
+class log_batch
+{
+public:
+    using level_type = std::underlying_type_t<log_level>;
+    /**
+     * @brief Text columns of a log.
+     */
+    enum field : size_t
+    {
+        COMMENT = 0,
+        DATA = 1,
+        FIELD_NUM = 2
+    };
+    /**
+     * @brief Copy log into batch.
+     *
+     * @param item Log to copy.
+     * @param module_id Id of module of log.
+     */
+    void append(const log_view &item, const int64_t module_id)
+    {
+        this->timestamp_vector.push_back(item.timestamp_nano);
+        this->level_vector.push_back(static_cast<level_type>(item.level));
+        this->module_id_vector.push_back(module_id);
+        this->append_text(item.comment);
+        this->append_text(item.data);
+    }
+    /**
+     * @brief Number of logs staged.
+     *
+     * @return size_t Number of logs.
+     */
+    size_t size() const { return this->timestamp_vector.size(); }
+    /**
+     * @brief Check if no log is staged.
+     *
+     * @return true Yes.
+     * @return false No.
+     */
+    bool empty() const { return this->timestamp_vector.empty(); }
+    /**
+     * @brief Drop all logs and keep memory for next batch.
+     */
+    void clear()
+    {
+        this->timestamp_vector.clear();
+        this->level_vector.clear();
+        this->module_id_vector.clear();
+        this->offset_vector.clear();
+        this->arena.clear();
+    }
+    /**
+     * @brief Get timestamp of log.
+     *
+     * @param i Index of log.
+     * @return int64_t Timestamp in nanoseconds.
+     */
+    int64_t timestamp(const size_t i) const
+    {
+        return this->timestamp_vector[i];
+    }
+    /**
+     * @brief Get level of log.
+     *
+     * @param i Index of log.
+     * @return level_type Level as integer.
+     */
+    level_type level(const size_t i) const { return this->level_vector[i]; }
+    /**
+     * @brief Get module id of log.
+     *
+     * @param i Index of log.
+     * @return int64_t Id in module table.
+     */
+    int64_t module_id(const size_t i) const
+    {
+        return this->module_id_vector[i];
+    }
+    /**
+     * @brief Get text column of log.
+     *
+     * @param i Index of log.
+     * @param f Which column.
+     * @return const char* Start of text in arena, not zero terminated.
+     */
+    const char *text(const size_t i, const field f) const
+    {
+        return this->arena.data() + this->offset_vector[i * FIELD_NUM + f];
+    }
+    /**
+     * @brief Get size of text column of log.
+     *
+     * @param i Index of log.
+     * @param f Which column.
+     * @return size_t Size of text.
+     */
+    size_t text_size(const size_t i, const field f) const
+    {
+        size_t index = i * FIELD_NUM + f;
+        size_t end = index + 1 < this->offset_vector.size()
+                         ? this->offset_vector[index + 1]
+                         : this->arena.size();
+        return end - this->offset_vector[index];
+    }
+
+private:
+    vector<int64_t> timestamp_vector;
+    vector<level_type> level_vector;
+    vector<int64_t> module_id_vector;
+    /**
+     * @brief Start of each text column in arena, the column ends where the
+     * next one starts.
+     */
+    vector<size_t> offset_vector;
+    string arena;
+    /**
+     * @brief Copy text into arena.
+     *
+     * @param text Text to copy.
+     */
+    void append_text(const std::string_view text)
+    {
+        this->offset_vector.push_back(this->arena.size());
+        this->arena.append(text);
+    }
+};
 
 /**
  * @brief Helper class of sqlite3
+ *
+ * @details Writers encode each log in place into a reused cell of a bounded
+ * lock-free queue, in the layout of the spill file. A flush thread per
+ * database owns the connection, it collects logs until a batch is full or
+ * the oldest log has waited max_latency_milli, then inserts all
+ * collected logs by multi-row statements inside one transaction. Insert
+ * statements are prepared once per power of two size and cached, a batch
+ * is split into cached chunks. Batch size starts at buffer_size and follows
+ * the arrival rate, aiming at about four commits per max_latency_milli.
+ * With partitions, logs go to database files named file_path plus
+ * ".YYYYmmdd_HHMMSS_mmm", a new one is started when logs enter the next
+ * time window or the current one grows over partition_bytes, and old ones
+ * are unlinked beyond partition_num.
  */
 class sqlite3_helper
 {
@@ -46,15 +433,33 @@ public:
      * @brief Construct a new sqlite3 helper object.
      *
      * @param file_path Path of database.
-     * @param buffer_size Buffer size of log's buffer.
+     * @param buffer_size Initial number of logs committed at once.
      * @param logger_unique_ptr Logger used to write database's logs.
+     * @param max_latency_milli Max time a log waits before committed.
+     * @param use_wal Use WAL journal mode.
+     * @param partition_sec Length of time window of a partition, 0 to not
+     * partition by time.
+     * @param partition_bytes Size to start next partition, 0 to not
+     * partition by size.
+     * @param partition_num Max partitions kept, 0 for no limit.
      */
     sqlite3_helper(const string file_path, const size_t buffer_size,
                    unique_ptr<log2one> &&logger_unique_ptr =
-                       unique_ptr<log2one>(new log2one))
+                       unique_ptr<log2one>(new log2one),
+                   const int64_t max_latency_milli = 1000,
+                   const bool use_wal = true, const int64_t partition_sec = 0,
+                   const size_t partition_bytes = 0,
+                   const size_t partition_num = 0)
+        : log_queue{queue_capacity}
     {
         this->logger_unique_ptr = std::move(logger_unique_ptr);
         this->file_path = file_path;
+        this->max_latency = milliseconds(max_latency_milli);
+        this->use_wal = use_wal;
+        this->partition_nano = partition_sec > 0 ? partition_sec * sec_to_nano
+                                                 : 0;
+        this->partition_bytes = partition_bytes;
+        this->partition_num = partition_num;
         size_t delimiter = file_path.find_last_of('/');
         string file_dir = file_path.substr(0, delimiter);
         auto dir_ptr = opendir(file_dir.c_str());
@@ -66,18 +471,23 @@ public:
         {
             closedir(dir_ptr);
         }
-        if (SQLITE_OK != sqlite3_open(file_path.c_str(), &this->db_ptr))
+        this->buffer_size = buffer_size == 0 ? 1
+                            : buffer_size <= max_chunk_size
+                                ? buffer_size
+                                : max_chunk_size;
+        if (this->partitioned())
         {
-            this->logger_unique_ptr->error("open db failed",
-                                           sqlite3_errmsg(this->db_ptr));
-            return;
+            this->scan_partitions();
+            this->switch_partition(get_nano_timestamp());
         }
-        if (SQLITE_OK != this->create_table())
+        else
         {
-            return;
+            this->open_db(this->file_path);
         }
-        this->reload_stmt_ptr(buffer_size <= max_buffer_size ? buffer_size
-                                                             : max_buffer_size);
+        this->open_spill();
+        this->running.store(true);
+        this->flush_thread = thread{&sqlite3_helper::flush_in_background,
+                                    this};
     }
     /**
      * @brief Copy constructor deleted.
@@ -106,104 +516,599 @@ public:
      */
     sqlite3_helper &operator=(sqlite3_helper &&other) = delete;
     /**
-     * @brief Destroy the sqlite3 helper object.
+     * @brief Destroy the sqlite3 helper object, logs queued are committed
+     * before database is closed.
      */
     ~sqlite3_helper()
     {
-        if (this->log_list.size())
+        this->running.store(false);
+        this->not_empty.notify();
+        if (this->flush_thread.joinable())
+        {
+            this->flush_thread.join();
+        }
+        this->close_db();
+        if (this->spill_fd >= 0)
+        {
+            ::close(this->spill_fd);
+        }
+    }
+    /**
+     * @brief Queue log for flush thread.
+     *
+     * @param level Log level.
+     * @param module Module name.
+     * @param comment Content of log.
+     * @param data Data attached.
+     * @param timestamp_nano Timestamp of log in nano.
+     */
+    void write(const log_level level, const string &module,
+               const string &comment, const string &data,
+               const int64_t timestamp_nano)
+    {
+        auto &log_queue = this->log_queue;
+        auto fill = [&](string &record) {
+            record.clear();
+            encode_log(record, level, module, comment, data, timestamp_nano);
+        };
+        // once spilled, logs keep going to spill file until it is replayed.
+        if (this->spilling.load() || !log_queue.try_fill(fill))
+        {
+            thread_local string record;
+            fill(record);
+            if (!this->spill(record))
+            {
+                this->not_full.wait_until(
+                    [&]() { return log_queue.try_fill(fill); });
+            }
+        }
+        this->not_empty.notify();
+    }
+    /**
+     * @brief Wait until logs queued before are committed.
+     */
+    void flush()
+    {
+        size_t spill_target = this->spilled_bytes.load();
+        size_t target = this->log_queue.pushed();
+        size_t current = this->flush_target.load();
+        while (current < target &&
+               !this->flush_target.compare_exchange_weak(current, target))
+        {
+        }
+        this->not_empty.notify();
+        this->committed.wait_until([&]() {
+            return this->committed_count.load() >= target &&
+                   this->replayed_bytes.load() >= spill_target;
+        });
+    }
+
+private:
+    string file_path;
+    /**
+     * @brief Batch size, adapted to arrival rate by flush thread.
+     */
+    size_t buffer_size;
+    /**
+     * @brief Smoothed arrival rate in logs per second, negative until the
+     * first commit.
+     */
+    double arrival_rate = -1;
+    steady_clock::time_point last_commit = steady_clock::now();
+    steady_clock::duration max_latency;
+    bool use_wal;
+    int64_t partition_nano;
+    size_t partition_bytes;
+    size_t partition_num;
+    /**
+     * @brief Paths of partitions, oldest first.
+     */
+    set<string> partition_set;
+    /**
+     * @brief Time window of opened partition.
+     */
+    int64_t partition_window = 0;
+    /**
+     * @brief Path of opened database.
+     */
+    string db_path;
+    sqlite3 *db_ptr = nullptr;
+    /**
+     * @brief Insert statements prepared lazily, the k-th inserts 2^k logs.
+     */
+    sqlite3_stmt *stmt_cache[stmt_cache_size] = {};
+    sqlite3_stmt *module_insert_stmt = nullptr;
+    sqlite3_stmt *module_select_stmt = nullptr;
+    /**
+     * @brief Ids of modules already in module table, used by flush thread.
+     */
+    unordered_map<string, int64_t> module_id_map;
+    unique_ptr<log2one> logger_unique_ptr;
+    /**
+     * @brief Logs encoded by encode_log() into reused cells, so queueing
+     * allocates nothing once cells have grown to usual log size.
+     */
+    mpsc_cell_queue<string> log_queue;
+    wait_event not_empty;
+    wait_event not_full;
+    wait_event committed;
+    atomic<bool> running{false};
+    /**
+     * @brief Logs pushed before this count should be committed at once.
+     */
+    atomic<size_t> flush_target{0};
+    atomic<size_t> committed_count{0};
+    /**
+     * @brief Logs popped by flush thread and not committed yet.
+     */
+    log_batch batch;
+    /**
+     * @brief Spill file, -1 if unavailable.
+     */
+    int spill_fd = -1;
+    /**
+     * @brief Guard of spill_end, taken by writers only when queue is full.
+     */
+    mutex spill_mutex;
+    size_t spill_end = spill_header_size;
+    /**
+     * @brief Set while spill file has logs not replayed, new logs are then
+     * spilled too so order is kept.
+     */
+    atomic<bool> spilling{false};
+    /**
+     * @brief Bytes ever spilled and replayed, compared by flush().
+     */
+    atomic<size_t> spilled_bytes{0};
+    atomic<size_t> replayed_bytes{0};
+    /**
+     * @brief Offset of next log to replay, used by flush thread.
+     */
+    size_t replay_offset = spill_header_size;
+    /**
+     * @brief End of spilled logs already synced to disk, used by flush
+     * thread.
+     */
+    size_t synced_end = spill_header_size;
+    string spill_buffer;
+    /**
+     * @brief Module name looked up in module_id_map, keeps its capacity.
+     */
+    string module_key;
+    thread flush_thread;
+
+    /**
+     * @brief Open database, set journal mode and create tables.
+     *
+     * @param path Path of database.
+     */
+    void open_db(const string &path)
+    {
+        this->db_path = path;
+        if (SQLITE_OK != sqlite3_open(path.c_str(), &this->db_ptr))
+        {
+            this->logger_unique_ptr->error("open db failed",
+                                           sqlite3_errmsg(this->db_ptr));
+            sqlite3_close(this->db_ptr);
+            this->db_ptr = nullptr;
+            return;
+        }
+        sqlite3_busy_timeout(this->db_ptr, busy_timeout_milli);
+        if (this->use_wal)
+        {
+            // with WAL, NORMAL only syncs at checkpoint and stays consistent.
+            this->exec("pragma journal_mode=WAL;");
+            this->exec("pragma synchronous=NORMAL;");
+        }
+        this->create_table();
+    }
+    /**
+     * @brief Finalize statements and close database.
+     */
+    void close_db()
+    {
+        for (auto &stmt : this->stmt_cache)
+        {
+            this->finalize_stmt(stmt);
+        }
+        this->finalize_stmt(this->module_insert_stmt);
+        this->finalize_stmt(this->module_select_stmt);
+        if (this->db_ptr != nullptr)
+        {
+            if (SQLITE_OK != sqlite3_close(this->db_ptr))
+            {
+                this->logger_unique_ptr->error("close db failed",
+                                               sqlite3_errmsg(this->db_ptr));
+            }
+            this->db_ptr = nullptr;
+        }
+    }
+    /**
+     * @brief Check if logs are written to partitions.
+     *
+     * @return true Yes.
+     * @return false No, all logs go to file_path.
+     */
+    bool partitioned() const
+    {
+        return this->partition_nano > 0 || this->partition_bytes > 0;
+    }
+    /**
+     * @brief Get time window of timestamp.
+     *
+     * @param timestamp_nano Timestamp in nanoseconds.
+     * @return int64_t Index of window since epoch, 0 if not partitioned by
+     * time.
+     */
+    int64_t get_window(const int64_t timestamp_nano) const
+    {
+        if (this->partition_nano == 0)
+        {
+            return 0;
+        }
+        int64_t window = timestamp_nano / this->partition_nano;
+        return timestamp_nano % this->partition_nano < 0 ? window - 1
+                                                         : window;
+    }
+    /**
+     * @brief Find partitions left by earlier runs.
+     */
+    void scan_partitions()
+    {
+        size_t delimiter = this->file_path.find_last_of('/');
+        string dir = this->file_path.substr(0, delimiter + 1);
+        string prefix = this->file_path.substr(delimiter + 1) + ".";
+        auto dir_ptr = opendir(dir.empty() ? "." : dir.c_str());
+        if (dir_ptr == nullptr)
+        {
+            return;
+        }
+        for (auto entry = readdir(dir_ptr); entry != nullptr;
+             entry = readdir(dir_ptr))
+        {
+            string name = entry->d_name;
+            if (name.size() == prefix.size() + partition_suffix_size - 1 &&
+                name.compare(0, prefix.size(), prefix) == 0 &&
+                get_partition_timestamp(dir + name) != 0)
+            {
+                this->partition_set.insert(dir + name);
+            }
+        }
+        closedir(dir_ptr);
+    }
+    /**
+     * @brief Check if logs of timestamp should go to a new partition.
+     *
+     * @details Size counts the "-wal" file as well, since in WAL mode rows
+     * stay there until checkpoint.
+     *
+     * @param timestamp_nano Timestamp of next log to insert.
+     * @return true If window passed or size exceeded.
+     * @return false No.
+     */
+    bool partition_full(const int64_t timestamp_nano) const
+    {
+        if (this->get_window(timestamp_nano) > this->partition_window)
+        {
+            return true;
+        }
+        if (!this->partition_bytes)
+        {
+            return false;
+        }
+        size_t size = 0;
+        struct stat file_stat;
+        if (::stat(this->db_path.c_str(), &file_stat) == 0)
+        {
+            size += file_stat.st_size;
+        }
+        if (::stat((this->db_path + "-wal").c_str(), &file_stat) == 0)
+        {
+            size += file_stat.st_size;
+        }
+        return size >= this->partition_bytes;
+    }
+    /**
+     * @brief Close current partition and open the one for timestamp.
+     *
+     * @details The newest partition is reopened at startup if it is of the
+     * same window and has room. Module ids are copied into new partitions,
+     * so ids resolved for staged logs stay valid.
+     *
+     * @param timestamp_nano Timestamp of next log to insert.
+     */
+    void switch_partition(const int64_t timestamp_nano)
+    {
+        bool reopen = this->db_ptr == nullptr && this->partition_set.size();
+        this->close_db();
+        int64_t window = this->get_window(timestamp_nano);
+        if (reopen)
+        {
+            const string &newest = *this->partition_set.rbegin();
+            this->db_path = newest;
+            this->partition_window =
+                this->get_window(get_partition_timestamp(newest) * 1000000);
+            if (this->partition_window == window &&
+                !this->partition_full(timestamp_nano))
+            {
+                this->open_db(newest);
+                return;
+            }
+        }
+        int64_t timestamp_milli =
+            this->partition_nano ? window * (this->partition_nano / 1000000)
+                                 : timestamp_nano / 1000000;
+        if (this->partition_set.size())
+        {
+            timestamp_milli = std::max(
+                timestamp_milli,
+                get_partition_timestamp(*this->partition_set.rbegin()) + 1);
+        }
+        string path = this->file_path + get_partition_suffix(timestamp_milli);
+        this->partition_window = window;
+        this->partition_set.insert(path);
+        this->open_db(path);
+        if (this->db_ptr != nullptr && this->module_id_map.size())
+        {
+            this->copy_modules();
+        }
+        this->remove_expired_partitions();
+    }
+    /**
+     * @brief Insert modules known to new partition with the same ids.
+     */
+    void copy_modules()
+    {
+        sqlite3_stmt *stmt = nullptr;
+        if (SQLITE_OK != sqlite3_prepare_v2(
+                             this->db_ptr,
+                             "insert or ignore into module values(?,?);", -1,
+                             &stmt, nullptr))
+        {
+            this->module_id_map.clear();
+            return;
+        }
+        this->exec("begin;");
+        for (auto &entry : this->module_id_map)
+        {
+            sqlite3_bind_int64(stmt, 1, entry.second);
+            sqlite3_bind_text(stmt, 2, entry.first.c_str(), entry.first.size(),
+                              SQLITE_STATIC);
+            sqlite3_step(stmt);
+            sqlite3_reset(stmt);
+        }
+        this->exec("commit;");
+        sqlite3_finalize(stmt);
+    }
+    /**
+     * @brief Unlink oldest partitions beyond partition_num.
+     */
+    void remove_expired_partitions()
+    {
+        while (this->partition_num &&
+               this->partition_set.size() > this->partition_num)
+        {
+            string oldest = *this->partition_set.begin();
+            this->partition_set.erase(this->partition_set.begin());
+            for (const char *suffix : {"", "-wal", "-shm"})
+            {
+                string path = oldest + suffix;
+                if (::unlink(path.c_str()) != 0 && errno != ENOENT)
+                {
+                    this->logger_unique_ptr->error("remove partition failed",
+                                                   path);
+                }
+            }
+        }
+    }
+    /**
+     * @brief Execute sql without result.
+     *
+     * @param sql Sql to execute.
+     * @return int Return SQLITE_OK if no error happened.
+     */
+    int exec(const char *sql)
+    {
+        int ret = sqlite3_exec(this->db_ptr, sql, nullptr, nullptr, nullptr);
+        if (ret != SQLITE_OK)
+        {
+            this->logger_unique_ptr->error(string{sql} + " failed",
+                                           sqlite3_errmsg(this->db_ptr));
+        }
+        return ret;
+    }
+    /**
+     * @brief Create tables for logs when first open database.
+     *
+     * @details Table log of schema before version 2 has timestamp as
+     * primary key and module text in every row, its rows are copied into
+     * the new tables and it is dropped, all in one transaction. Table
+     * log_range of version 3 is filled from logs already in the database.
+     * Secondary indexes used by db_cursor are created here too, so readers
+     * never take the write lock.
+     *
+     * @return int Return SQLITE_OK if no error happened.
+     */
+    int create_table()
+    {
+        constexpr char create_table[] =
+            "create table if not exists module("
+            "id integer primary key,"
+            "name text unique not null"
+            ");"
+            "create table if not exists log("
+            "id integer primary key,"
+            "timestamp int not null,"
+            "level int,"
+            "module_id int,"
+            "comment text,"
+            "data text"
+            ");"
+            "create table if not exists log_range("
+            "id integer primary key,"
+            "first int not null,"
+            "last int not null"
+            ");";
+        constexpr char create_index[] =
+            "create index if not exists log_level_timestamp "
+            "on log(level, timestamp);"
+            "create index if not exists log_module_timestamp "
+            "on log(module_id, timestamp);";
+        int version = 0;
+        sqlite3_stmt *stmt = nullptr;
+        if (SQLITE_OK == sqlite3_prepare_v2(this->db_ptr,
+                                            "pragma user_version;", -1, &stmt,
+                                            nullptr) &&
+            SQLITE_ROW == sqlite3_step(stmt))
+        {
+            version = sqlite3_column_int(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+        if (version >= db_schema_version)
+        {
+            // databases of earlier runs may lack indexes once built lazily.
+            return this->exec(create_index);
+        }
+        int ret = this->exec("begin;");
+        bool has_v1 = version < 2 && this->has_table("log");
+        if (ret == SQLITE_OK && has_v1)
+        {
+            ret = this->exec("alter table log rename to log_v1;");
+        }
+        if (ret == SQLITE_OK)
+        {
+            ret = this->exec(create_table);
+        }
+        if (ret == SQLITE_OK && has_v1)
+        {
+            ret = this->exec(
+                "insert or ignore into module(name) select distinct module "
+                "from log_v1 where module is not null;"
+                "insert into log(timestamp, level, module_id, comment, data) "
+                "select log_v1.timestamp, log_v1.level, module.id, "
+                "log_v1.comment, log_v1.data from log_v1 left join module "
+                "on module.name = log_v1.module order by log_v1.timestamp;"
+                "drop table log_v1;");
+        }
+        if (ret == SQLITE_OK)
+        {
+            ret = this->exec(create_index);
+        }
+        if (ret == SQLITE_OK)
+        {
+            ret = this->exec("insert into log_range select 1, min(timestamp), "
+                             "max(timestamp) from log having count(*) > 0;");
+        }
+        if (ret == SQLITE_OK)
         {
-            this->flush_if_full();
-            if (this->log_list.size())
-            {
-                this->reload_stmt_ptr(this->log_list.size());
-                this->flush();
-            }
+            string sql = "pragma user_version=" +
+                         std::to_string(db_schema_version) + ";";
+            ret = this->exec(sql.c_str());
         }
-        if (this->stmt_ptr != nullptr)
+        if (ret == SQLITE_OK)
         {
-            if (SQLITE_OK != sqlite3_finalize(this->stmt_ptr))
-            {
-                this->logger_unique_ptr->error(
-                    "destructing, finalize stmt failed",
-                    sqlite3_errmsg(this->db_ptr));
-            }
-            this->stmt_ptr = nullptr;
+            ret = this->exec("commit;");
         }
-        if (this->db_ptr != nullptr)
+        if (ret != SQLITE_OK)
         {
-            if (SQLITE_OK != sqlite3_close(this->db_ptr))
-            {
-                this->logger_unique_ptr->error("destructing, close db failed",
-                                               sqlite3_errmsg(this->db_ptr));
-            }
-            this->db_ptr = nullptr;
+            this->logger_unique_ptr->error("create_table failed",
+                                           sqlite3_errmsg(this->db_ptr));
+            this->exec("rollback;");
         }
+        return ret;
     }
     /**
-     * @brief Buffer and write logs to database.
+     * @brief Check if table exists.
      *
-     * @param level Log level.
-     * @param module Module name.
-     * @param comment Content of log.
-     * @param data Data attached.
-     * @param timestamp_nano Timestamp of log in nano.
+     * @param name Name of table.
+     * @return true Yes.
+     * @return false No.
      */
-    void write(const log_level level, const string &module,
-               const string &comment, const string &data,
-               const int64_t timestamp_nano)
+    bool has_table(const char *name)
     {
-        lock_guard<mutex> db_lock{this->db_mutex};
-        this->log_list.emplace_back(timestamp_nano, level, module, comment,
-                                    data);
-        this->flush_if_full();
+        constexpr char select[] =
+            "select 1 from sqlite_master where type='table' and name=?;";
+        sqlite3_stmt *stmt = nullptr;
+        bool found = false;
+        if (SQLITE_OK ==
+            sqlite3_prepare_v2(this->db_ptr, select, -1, &stmt, nullptr))
+        {
+            sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+            found = SQLITE_ROW == sqlite3_step(stmt);
+        }
+        sqlite3_finalize(stmt);
+        return found;
     }
-
-private:
-    string file_path;
-    size_t buffer_size;
-    sqlite3 *db_ptr;
-    sqlite3_stmt *stmt_ptr;
-    list<log> log_list;
-    unique_ptr<log2one> logger_unique_ptr;
-    mutex db_mutex;
-
     /**
-     * @brief Create table for logs when first open database.
+     * @brief Get id of module, add it to module table if absent.
      *
-     * @return int Return SQLITE_OK if no error happened.
+     * @param name Module name.
+     * @return int64_t Id of module, 0 if database failed.
      */
-    int create_table()
+    int64_t get_module_id(const std::string_view name)
     {
-        constexpr char create_table[] = "create table if not exists log("
-                                        "timestamp int primary key not null,"
-                                        "level int,"
-                                        "module text,"
-                                        "comment text,"
-                                        "data text"
-                                        ");";
-        int ret =
-            sqlite3_exec(this->db_ptr, create_table, nullptr, nullptr, nullptr);
-        if (ret != SQLITE_OK)
+        string &module = this->module_key;
+        module.assign(name.data(), name.size());
+        auto it = this->module_id_map.find(module);
+        if (it != this->module_id_map.end())
         {
-            this->logger_unique_ptr->error("create_table failed",
+            return it->second;
+        }
+        if (this->db_ptr == nullptr)
+        {
+            return 0;
+        }
+        if (this->module_insert_stmt == nullptr)
+        {
+            sqlite3_prepare_v2(this->db_ptr,
+                               "insert or ignore into module(name) values(?);",
+                               -1, &this->module_insert_stmt, nullptr);
+            sqlite3_prepare_v2(this->db_ptr,
+                               "select id from module where name=?;", -1,
+                               &this->module_select_stmt, nullptr);
+        }
+        int64_t id = 0;
+        sqlite3_stmt *stmts[] = {this->module_insert_stmt,
+                                 this->module_select_stmt};
+        for (sqlite3_stmt *stmt : stmts)
+        {
+            if (stmt == nullptr)
+            {
+                continue;
+            }
+            sqlite3_bind_text(stmt, 1, module.c_str(), module.size(),
+                              SQLITE_STATIC);
+            if (SQLITE_ROW == sqlite3_step(stmt))
+            {
+                id = sqlite3_column_int64(stmt, 0);
+            }
+            sqlite3_reset(stmt);
+        }
+        if (id == 0)
+        {
+            this->logger_unique_ptr->error("get module id failed",
                                            sqlite3_errmsg(this->db_ptr));
+            return 0;
         }
-        return ret;
+        this->module_id_map.emplace(module, id);
+        return id;
     }
     /**
      * @brief Prepare statement of inserting logs.
      *
      * @param buffer_size Write how many logs at once.
+     * @param stmt Where the statement is stored.
      * @return int Return SQLITE_OK if no error happened.
      */
-    int prepare_stmt(const size_t buffer_size)
+    int prepare_stmt(const size_t buffer_size, sqlite3_stmt **stmt)
     {
-        constexpr char insert[] = "insert into log values";
+        constexpr char insert[] =
+            "insert into log(timestamp,level,module_id,comment,data) values";
         constexpr char values[] = "(?,?,?,?,?),";
         constexpr char last_value[] = "(?,?,?,?,?);";
         int ret = SQLITE_OK;
         string sql{insert};
-        for (size_t i = 0; i < buffer_size - 1; i++)
+        for (size_t i = 0; i + 1 < buffer_size; i++)
         {
             sql.append(values);
         }
@@ -211,171 +1116,664 @@ private:
         {
             sql.append(last_value);
         }
-        ret = sqlite3_prepare_v2(this->db_ptr, sql.c_str(), sql.size(),
-                                 &this->stmt_ptr, nullptr);
+        ret = sqlite3_prepare_v2(this->db_ptr, sql.c_str(), sql.size(), stmt,
+                                 nullptr);
         if (ret != SQLITE_OK)
         {
-            this->logger_unique_ptr->error("prepare stmt_ptr failed",
+            this->logger_unique_ptr->error("prepare stmt failed",
                                            sqlite3_errmsg(this->db_ptr));
+            *stmt = nullptr;
         }
         return ret;
     }
     /**
-     * @brief Release the old statement and prepare a new one.
+     * @brief Finalize statement if prepared.
      *
-     * @param buffer_size Write how many logs at once.
-     * @return int Return SQLITE_OK if no error happened.
+     * @param stmt Statement to finalize.
      */
-    int reload_stmt_ptr(const size_t buffer_size)
+    void finalize_stmt(sqlite3_stmt *&stmt)
     {
-        int ret = SQLITE_OK;
-        this->buffer_size = buffer_size;
-        if (this->stmt_ptr != nullptr)
+        if (stmt != nullptr && SQLITE_OK != sqlite3_finalize(stmt))
         {
-            ret = sqlite3_finalize(this->stmt_ptr);
-            if (ret != SQLITE_OK)
-            {
-                this->logger_unique_ptr->error(
-                    "finalize stmt_ptr failed when reload stmt_ptr",
-                    sqlite3_errmsg(this->db_ptr));
-                return ret;
-            }
+            this->logger_unique_ptr->error("finalize stmt failed",
+                                           sqlite3_errmsg(this->db_ptr));
         }
-        ret = this->prepare_stmt(buffer_size);
-        return ret;
+        stmt = nullptr;
     }
     /**
-     * @brief Flush buffered logs to database.
-     * 
-     * @details Please make sure that enough logs have been buffered.
-     * 
+     * @brief Insert 2^k logs of batch by one cached statement.
+     *
+     * @details Tables created here never reject a bound row, but checks or
+     * triggers users add to log table may. If a row violates a constraint
+     * the whole statement fails, so the chunk is split in halves and
+     * retried, and only rows failing alone are written by logger of helper.
+     * Other errors send the whole chunk to logger of helper.
+     *
+     * @param k Exponent of number of logs.
+     * @param first Index of first log in batch.
      * @return int Return SQLITE_OK if no error happened.
      */
-    int flush()
+    int insert(const size_t k, const size_t first)
     {
-        using level_type = std::underlying_type_t<log_level>;
-        int ret = SQLITE_OK;
-        size_t param_index = 0;
-        list<log> temp_log_list;
-        for (size_t i = 0; i < this->buffer_size; i++)
-        {
-            temp_log_list.push_back(std::move(this->log_list.front()));
-            this->log_list.pop_front();
-            auto &temp_log = temp_log_list.back();
-            ret = sqlite3_bind_int64(this->stmt_ptr, ++param_index,
-                                     temp_log.timestamp_nano);
+        sqlite3_stmt *stmt = this->get_stmt(k);
+        size_t count = size_t{1} << k;
+        static constexpr const char *bind_error[log_batch::FIELD_NUM] = {
+            "bind comment failed", "bind data failed"};
+        const log_batch &batch = this->batch;
+        int ret = stmt == nullptr ? SQLITE_MISUSE : SQLITE_OK;
+        int param_index = 0;
+        for (size_t i = first; ret == SQLITE_OK && i < first + count; i++)
+        {
+            ret = sqlite3_bind_int64(stmt, ++param_index, batch.timestamp(i));
             if (ret != SQLITE_OK)
             {
                 this->logger_unique_ptr->error("bind timestamp failed",
                                                sqlite3_errmsg(this->db_ptr));
                 break;
             }
-            ret = sqlite3_bind_int64(this->stmt_ptr, ++param_index,
-                                     static_cast<level_type>(temp_log.level));
+            ret = sqlite3_bind_int64(stmt, ++param_index, batch.level(i));
             if (ret != SQLITE_OK)
             {
                 this->logger_unique_ptr->error("bind level failed",
                                                sqlite3_errmsg(this->db_ptr));
                 break;
             }
-            ret = sqlite3_bind_text(this->stmt_ptr, ++param_index,
-                                    temp_log.module.c_str(),
-                                    temp_log.module.size(), SQLITE_STATIC);
+            ret = sqlite3_bind_int64(stmt, ++param_index, batch.module_id(i));
             if (ret != SQLITE_OK)
             {
                 this->logger_unique_ptr->error("bind module failed",
-                                               sqlite3_errmsg(db_ptr));
+                                               sqlite3_errmsg(this->db_ptr));
                 break;
             }
-            ret = sqlite3_bind_text(this->stmt_ptr, ++param_index,
-                                    temp_log.comment.c_str(),
-                                    temp_log.comment.size(), SQLITE_STATIC);
-            if (ret != SQLITE_OK)
+            for (size_t f = 0; ret == SQLITE_OK && f < log_batch::FIELD_NUM;
+                 f++)
             {
-                this->logger_unique_ptr->error("bind comment failed",
-                                               sqlite3_errmsg(db_ptr));
-                break;
+                auto column = static_cast<log_batch::field>(f);
+                ret = sqlite3_bind_text(stmt, ++param_index,
+                                        batch.text(i, column),
+                                        batch.text_size(i, column),
+                                        SQLITE_STATIC);
+                if (ret != SQLITE_OK)
+                {
+                    this->logger_unique_ptr->error(
+                        bind_error[f], sqlite3_errmsg(this->db_ptr));
+                }
             }
-            ret = sqlite3_bind_text(this->stmt_ptr, ++param_index,
-                                    temp_log.data.c_str(), temp_log.data.size(),
-                                    SQLITE_STATIC);
-            if (ret != SQLITE_OK)
+        }
+        if (ret == SQLITE_OK)
+        {
+            ret = sqlite3_step(stmt);
+            ret = ret == SQLITE_DONE ? SQLITE_OK : ret;
+        }
+        if (stmt != nullptr)
+        {
+            // reset repeats error of step, it only matters after success.
+            int reset_ret = sqlite3_reset(stmt);
+            if (ret == SQLITE_OK && reset_ret != SQLITE_OK)
             {
-                this->logger_unique_ptr->error("bind data failed",
+                this->logger_unique_ptr->error("reset stmt failed",
                                                sqlite3_errmsg(db_ptr));
-                break;
             }
         }
+        if ((ret & 0xff) == SQLITE_CONSTRAINT && k > 0)
+        {
+            // rows before the failing one are rolled back with the statement.
+            int first_ret = this->insert(k - 1, first);
+            int second_ret = this->insert(k - 1, first + count / 2);
+            return first_ret != SQLITE_OK ? first_ret : second_ret;
+        }
+        if (ret != SQLITE_OK)
+        {
+            this->logger_unique_ptr->error("step stmt failed",
+                                           sqlite3_errmsg(db_ptr));
+            this->report_failed(first, first + count);
+        }
+        return ret;
+    }
+    /**
+     * @brief Write logs of batch that are not committed by logger of helper.
+     *
+     * @param first Index of first log.
+     * @param last Index after last log.
+     */
+    void report_failed(const size_t first, const size_t last)
+    {
+        const log_batch &batch = this->batch;
+        for (size_t i = first; i < last; i++)
+        {
+            stringstream ss;
+            ss << "{\"comment\":\"";
+            ss.write(batch.text(i, log_batch::COMMENT),
+                     batch.text_size(i, log_batch::COMMENT));
+            ss << "\", \"data\":\"";
+            ss.write(batch.text(i, log_batch::DATA),
+                     batch.text_size(i, log_batch::DATA));
+            ss << "\"}";
+            this->logger_unique_ptr->write(
+                static_cast<log_level>(batch.level(i)),
+                to_string(batch.timestamp(i)), ss.str());
+        }
+    }
+    /**
+     * @brief Get cached statement inserting 2^k logs, prepare it if absent.
+     *
+     * @param k Exponent of number of logs.
+     * @return sqlite3_stmt* Statement, nullptr if prepare failed.
+     */
+    sqlite3_stmt *get_stmt(const size_t k)
+    {
+        sqlite3_stmt *&stmt = this->stmt_cache[k];
+        if (stmt == nullptr && this->db_ptr != nullptr)
+        {
+            this->prepare_stmt(size_t{1} << k, &stmt);
+        }
+        return stmt;
+    }
+    /**
+     * @brief Insert logs of batch in one transaction.
+     *
+     * @details Logs are split into chunks of decreasing power of two sizes,
+     * for example 100 logs are inserted as 64, 32 and 4, so no statement
+     * is prepared for an odd size. Time range of database is widened in the
+     * same transaction. A busy commit keeps the transaction open and is
+     * retried; if the transaction cannot begin or commit, its logs are
+     * written by logger of helper like rows failing in insert().
+     *
+     * @param first Index of first log.
+     * @param last Index after last log.
+     */
+    void commit_range(const size_t first, const size_t last)
+    {
+        constexpr char update_range[] =
+            "insert into log_range values(1,?1,?2) on conflict(id) do update "
+            "set first=min(first,?1),last=max(last,?2);";
+        constexpr int commit_attempts = 3;
+        if (this->db_ptr == nullptr || SQLITE_OK != this->exec("begin;"))
+        {
+            this->report_failed(first, last);
+            return;
+        }
+        int64_t min_timestamp = INT64_MAX;
+        int64_t max_timestamp = INT64_MIN;
+        for (size_t i = first; i < last; i++)
+        {
+            min_timestamp = std::min(min_timestamp, this->batch.timestamp(i));
+            max_timestamp = std::max(max_timestamp, this->batch.timestamp(i));
+        }
+        for (size_t next = first; next < last;)
+        {
+            size_t k = stmt_cache_size - 1;
+            while ((size_t{1} << k) > last - next)
+            {
+                k--;
+            }
+            this->insert(k, next);
+            next += size_t{1} << k;
+        }
+        sqlite3_stmt *stmt = nullptr;
+        int ret = sqlite3_prepare_v2(this->db_ptr, update_range, -1, &stmt,
+                                     nullptr);
         if (ret == SQLITE_OK)
         {
-            ret = sqlite3_step(this->stmt_ptr);
-            if (ret != SQLITE_DONE)
+            sqlite3_bind_int64(stmt, 1, min_timestamp);
+            sqlite3_bind_int64(stmt, 2, max_timestamp);
+            ret = sqlite3_step(stmt) == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
+        }
+        if (ret != SQLITE_OK)
+        {
+            this->logger_unique_ptr->error("update log range failed",
+                                           sqlite3_errmsg(this->db_ptr));
+        }
+        sqlite3_finalize(stmt);
+        ret = this->exec("commit;");
+        for (int i = 1; i < commit_attempts && (ret & 0xff) == SQLITE_BUSY;
+             i++)
+        {
+            ret = this->exec("commit;");
+        }
+        if (ret != SQLITE_OK)
+        {
+            if (!sqlite3_get_autocommit(this->db_ptr))
             {
-                this->logger_unique_ptr->error("step stmt failed",
-                                               sqlite3_errmsg(db_ptr));
+                this->exec("rollback;");
+            }
+            this->report_failed(first, last);
+        }
+    }
+    /**
+     * @brief Insert all logs of batch, one transaction per partition.
+     *
+     * @details Logs are cut where their time window passes the one of the
+     * opened partition. A log stamped before that window, queued late, goes
+     * to the opened partition, whose time range then covers it.
+     */
+    void commit_batch()
+    {
+        size_t size = this->batch.size();
+        size_t first = 0;
+        while (first < size)
+        {
+            size_t last = size;
+            if (this->partitioned())
+            {
+                if (this->partition_full(this->batch.timestamp(first)))
+                {
+                    this->switch_partition(this->batch.timestamp(first));
+                }
+                last = first + 1;
+                while (last < size && this->get_window(this->batch.timestamp(
+                                          last)) <= this->partition_window)
+                {
+                    last++;
+                }
+            }
+            this->commit_range(first, last);
+            first = last;
+        }
+        this->adapt_buffer_size(size);
+        this->batch.clear();
+    }
+    /**
+     * @brief Update arrival rate and choose next batch size.
+     *
+     * @details Rate is measured between two commits and smoothed, batch
+     * size is rounded up to power of two so a full batch is one chunk.
+     *
+     * @param committed Number of logs just committed.
+     */
+    void adapt_buffer_size(const size_t committed)
+    {
+        constexpr double smoothing = 0.25;
+        constexpr double commits_per_latency = 4;
+        auto now = steady_clock::now();
+        double elapsed =
+            std::chrono::duration<double>(now - this->last_commit).count();
+        this->last_commit = now;
+        if (elapsed <= 0)
+        {
+            return;
+        }
+        double rate = committed / elapsed;
+        this->arrival_rate =
+            this->arrival_rate < 0
+                ? rate
+                : this->arrival_rate + smoothing * (rate - this->arrival_rate);
+        double latency =
+            std::chrono::duration<double>(this->max_latency).count();
+        double target = this->arrival_rate * latency / commits_per_latency;
+        size_t size = 1;
+        while (size < target && size < max_chunk_size)
+        {
+            size <<= 1;
+        }
+        this->buffer_size = size;
+    }
+    /**
+     * @brief Pop all queued logs into batch.
+     *
+     * @return true If any log popped.
+     * @return false If queue is empty.
+     */
+    bool collect()
+    {
+        bool any = false;
+        log_view item;
+        while (string *record = this->log_queue.front())
+        {
+            size_t parsed = 0;
+            parse_spilled(*record, parsed, item);
+            this->batch.append(item, this->get_module_id(item.module));
+            if (record->capacity() > cell_capacity_limit)
+            {
+                // one huge log should not pin its memory in the queue.
+                string().swap(*record);
             }
+            this->log_queue.pop();
+            this->not_full.notify();
+            any = true;
+        }
+        return any;
+    }
+    /**
+     * @brief Open spill file, and find logs left by last run.
+     *
+     * @details File is "magic | u64 replay offset | records", every log is
+     * a MODULE record with id 0 followed by a LOG record, in the layout of
+     * binary log files of file_writer. A log cut by crash at the end is
+     * dropped.
+     */
+    void open_spill()
+    {
+        string path = this->file_path + spill_extension;
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0)
+        {
+            this->logger_unique_ptr->error("open spill file failed", path);
+            return;
+        }
+        struct stat file_stat;
+        char header[spill_header_size];
+        uint64_t offset = spill_header_size;
+        if (::fstat(fd, &file_stat) == 0 &&
+            static_cast<size_t>(file_stat.st_size) >= spill_header_size &&
+            read_at(fd, header, spill_header_size, 0) &&
+            memcmp(header, spill_magic, spill_magic_size) == 0)
+        {
+            const char *cursor = header + spill_magic_size;
+            offset = read_binary<uint64_t>(cursor);
         }
         else
         {
-            this->logger_unique_ptr->error("error happened when try step stmt");
-            for (auto &temp_log : temp_log_list)
+            file_stat.st_size = 0;
+        }
+        size_t end = file_stat.st_size;
+        if (offset < spill_header_size || offset > end)
+        {
+            offset = end = spill_header_size;
+        }
+        string left(end - offset, '\0');
+        if (left.size() && !read_at(fd, &left[0], left.size(), offset))
+        {
+            left.clear();
+        }
+        log_view item;
+        size_t parsed = 0;
+        while (parse_spilled(left, parsed, item))
+        {
+        }
+        end = offset + parsed;
+        if (::ftruncate(fd, end) != 0 ||
+            !this->write_spill_header(fd, offset) || ::fdatasync(fd) != 0)
+        {
+            this->logger_unique_ptr->error("init spill file failed", path);
+            ::close(fd);
+            return;
+        }
+        this->spill_fd = fd;
+        this->spill_end = end;
+        this->replay_offset = offset;
+        this->synced_end = end;
+        this->spilled_bytes.store(end - offset);
+        this->spilling.store(end > offset);
+    }
+    /**
+     * @brief Write magic and replay offset at the beginning of spill file.
+     *
+     * @param fd Spill file.
+     * @param offset Offset of next log to replay.
+     * @return true If written.
+     * @return false If failed.
+     */
+    bool write_spill_header(const int fd, const uint64_t offset)
+    {
+        string header{spill_magic, spill_magic_size};
+        append_binary<uint64_t>(header, offset);
+        return pwrite_all(fd, header.data(), header.size(), 0);
+    }
+    /**
+     * @brief Append log to spill file, called by writers.
+     *
+     * @param record Log encoded by encode_log().
+     * @return true If spilled.
+     * @return false If spill file is unavailable, log should be queued.
+     */
+    bool spill(const string &record)
+    {
+        if (this->spill_fd < 0)
+        {
+            return false;
+        }
+        lock_guard<mutex> spill_lock{this->spill_mutex};
+        if (!pwrite_all(this->spill_fd, record.data(), record.size(),
+                        this->spill_end))
+        {
+            std::cerr << "log2what::db_writer spill failed" << std::endl;
+            return false;
+        }
+        this->spill_end += record.size();
+        this->spilled_bytes.fetch_add(record.size());
+        this->spilling.store(true);
+        return true;
+    }
+    /**
+     * @brief Sync logs spilled since last call, called by flush thread once
+     * per batch so writers never wait for disk.
+     */
+    void sync_spill()
+    {
+        size_t end;
+        {
+            lock_guard<mutex> spill_lock{this->spill_mutex};
+            end = this->spill_end;
+        }
+        if (end == this->synced_end)
+        {
+            return;
+        }
+        if (::fdatasync(this->spill_fd) != 0)
+        {
+            this->logger_unique_ptr->error("sync spill file failed",
+                                           this->file_path);
+            return;
+        }
+        this->synced_end = end;
+    }
+    /**
+     * @brief Read a spilled log larger than one read.
+     *
+     * @param end End of spilled logs.
+     * @param parsed Set to bytes of the log.
+     * @param item Where the log is stored.
+     * @return true If parsed.
+     * @return false If spill file is broken.
+     */
+    bool read_whole_spilled(const size_t end, size_t &parsed,
+                            log_view &item)
+    {
+        size_t size = 0;
+        char length[sizeof(uint32_t)];
+        for (int i = 0; i < 2; i++)
+        {
+            const char *cursor = length;
+            if (this->replay_offset + size + sizeof(length) > end ||
+                !read_at(this->spill_fd, length, sizeof(length),
+                         this->replay_offset + size))
             {
-                stringstream ss;
-                ss << "{\"comment\":\"" << temp_log.comment << "\", "
-                   << "\"data\":\"" << temp_log.data << "\"}";
-                this->logger_unique_ptr->write(
-                    temp_log.level, to_string(temp_log.timestamp_nano),
-                    ss.str());
+                return false;
             }
+            size += sizeof(length) + read_binary<uint32_t>(cursor);
         }
-        ret = sqlite3_reset(this->stmt_ptr);
-        if (ret != SQLITE_OK)
+        if (this->replay_offset + size > end)
         {
-            this->logger_unique_ptr->error("reset stmt failed",
-                                           sqlite3_errmsg(db_ptr));
+            return false;
         }
-        return ret;
+        this->spill_buffer.resize(size);
+        return read_at(this->spill_fd, &this->spill_buffer[0], size,
+                       this->replay_offset) &&
+               parse_spilled(this->spill_buffer, parsed, item);
+    }
+    /**
+     * @brief Commit a chunk of spilled logs, stop spilling when all are
+     * replayed.
+     *
+     * @details Replay offset is saved after commit, so a crash may replay a
+     * chunk twice but never loses one. Emptied file is synced before it is
+     * reused, or a stale offset could point into new logs after power loss.
+     */
+    void replay()
+    {
+        size_t end;
+        {
+            lock_guard<mutex> spill_lock{this->spill_mutex};
+            end = this->spill_end;
+            if (this->replay_offset >= end)
+            {
+                // no writer can spill now, start over from an empty file.
+                this->replay_offset = this->spill_end = spill_header_size;
+                this->synced_end = spill_header_size;
+                if (::ftruncate(this->spill_fd, spill_header_size) != 0 ||
+                    !this->write_spill_header(this->spill_fd,
+                                              spill_header_size) ||
+                    ::fdatasync(this->spill_fd) != 0)
+                {
+                    this->logger_unique_ptr->error("reset spill file failed",
+                                                   this->file_path);
+                }
+                this->spilling.store(false);
+                return;
+            }
+        }
+        size_t size = std::min(end - this->replay_offset, spill_read_size);
+        this->spill_buffer.resize(size);
+        if (!read_at(this->spill_fd, &this->spill_buffer[0], size,
+                     this->replay_offset))
+        {
+            this->logger_unique_ptr->error("read spill file failed",
+                                           this->file_path);
+            return;
+        }
+        log_view item;
+        size_t parsed = 0;
+        while (this->batch.size() < max_chunk_size &&
+               parse_spilled(this->spill_buffer, parsed, item))
+        {
+            this->batch.append(item, this->get_module_id(item.module));
+        }
+        if (parsed == 0)
+        {
+            if (this->read_whole_spilled(end, parsed, item))
+            {
+                this->batch.append(item, this->get_module_id(item.module));
+            }
+            else
+            {
+                this->logger_unique_ptr->error(
+                    "broken spill file, rest skipped", this->file_path);
+                parsed = end - this->replay_offset;
+            }
+        }
+        this->commit_batch();
+        this->replay_offset += parsed;
+        this->write_spill_header(this->spill_fd, this->replay_offset);
+        this->replayed_bytes.fetch_add(parsed);
     }
     /**
-     * @brief Flush logs to database if enough logs have been buffered.
+     * @brief Loop of flush thread.
+     *
+     * @details Deadline starts when the first log of a batch is popped. It
+     * is checked when the thread wakes up, which is at most about 10ms late
+     * with BLOCK strategy. Logs queued while committing join the next
+     * batch, so under load every transaction takes all that is waiting.
+     * Spilled logs are synced once per batch, and replayed once logs queued
+     * before them are committed.
      */
-    void flush_if_full()
+    void flush_in_background()
     {
-        while (this->log_list.size() >= this->buffer_size)
+        auto deadline = steady_clock::time_point::max();
+        auto due = [&]() {
+            return this->batch.size() >= this->buffer_size ||
+                   !this->running.load() || this->spilling.load() ||
+                   this->flush_target.load() > this->committed_count.load() ||
+                   (!this->batch.empty() && steady_clock::now() >= deadline);
+        };
+        while (true)
         {
-            this->flush();
+            // collect may wait for database, so it is kept out of wait_until
+            // which holds the lock writers take to notify.
+            bool was_empty = this->batch.empty();
+            if (this->collect() && was_empty)
+            {
+                deadline = steady_clock::now() + this->max_latency;
+            }
+            if (!due())
+            {
+                this->not_empty.wait_until(
+                    [&]() { return !this->log_queue.empty() || due(); });
+                continue;
+            }
+            this->collect();
+            if (this->batch.size())
+            {
+                this->commit_batch();
+            }
+            deadline = steady_clock::time_point::max();
+            this->committed_count.store(this->log_queue.popped());
+            if (this->spilling.load())
+            {
+                this->sync_spill();
+            }
+            if (this->spilling.load() && this->log_queue.empty())
+            {
+                this->replay();
+            }
+            this->committed.notify();
+            if (!this->running.load() && this->log_queue.empty() &&
+                !this->spilling.load())
+            {
+                break;
+            }
         }
     }
 };
 
+/**
+ * @brief Helper and number of writers using it.
+ */
+struct helper_entry
+{
+    unique_ptr<sqlite3_helper> helper;
+    size_t writers = 0;
+};
+
+/**
+ * @brief Guard of helper_map, only taken when writers are created or
+ * destroyed.
+ */
 static mutex life_cycle_mutex;
 /**
  * @brief Center map that stores all helper of opened sqlite3 database.
  */
-static map<string, unique_ptr<sqlite3_helper>> helper_map;
+static map<string, helper_entry> helper_map;
 
 db_writer::db_writer(const string &file_path, const size_t buffer_szie,
-                     unique_ptr_writer &&writer_unique_ptr)
+                     unique_ptr_writer &&writer_unique_ptr,
+                     const int64_t max_latency_milli, const bool use_wal,
+                     const int64_t partition_sec, const size_t partition_bytes,
+                     const size_t partition_num)
 {
     lock_guard<mutex> life_cycle_lock{::life_cycle_mutex};
     this->file_path = file_path;
-    if (helper_map.count(file_path))
+    auto &entry = helper_map[file_path];
+    if (!entry.helper)
     {
-        return;
+        auto logger_unique_ptr = unique_ptr<log2one>{
+            new log2one{"db_writer", std::move(writer_unique_ptr)}};
+        entry.helper.reset(new sqlite3_helper{
+            file_path, buffer_szie, std::move(logger_unique_ptr),
+            max_latency_milli, use_wal, partition_sec, partition_bytes,
+            partition_num});
+    }
+    entry.writers++;
+    this->helper = entry.helper.get();
+}
+
+db_writer::~db_writer()
+{
+    lock_guard<mutex> life_cycle_lock{::life_cycle_mutex};
+    auto it = helper_map.find(this->file_path);
+    if (it != helper_map.end() && --it->second.writers == 0)
+    {
+        // flush buffered logs and close database with the last writer.
+        helper_map.erase(it);
     }
-    auto logger_unique_ptr = unique_ptr<log2one>{
-        new log2one{"db_writer", std::move(writer_unique_ptr)}};
-    helper_map[file_path].reset(new sqlite3_helper{
-        file_path, buffer_szie, std::move(logger_unique_ptr)});
 }
 
 void db_writer::write(const log_level level, const string &module,
                       const string &comment, const string &data,
                       const int64_t timestamp_nano)
 {
-    unique_lock<mutex> life_cycle_lock{::life_cycle_mutex};
-    auto &helper = helper_map[this->file_path];
-    life_cycle_lock.unlock();
     int64_t timestamp = timestamp_nano ? timestamp_nano : get_nano_timestamp();
-    helper->write(level, module, comment, data, timestamp);
-}
\ No newline at end of file
+    this->helper->write(level, module, comment, data, timestamp);
+}
+
+void db_writer::flush() { this->helper->flush(); }
@@ -12,11 +12,22 @@
 #define LOG2WHAT_DB_WRITER_HPP
 
 #include "../base/writer.hpp"
+#include <memory>
+
+class sqlite3_helper;
 
 namespace log2what
 {
     /**
      * @brief Writer that writes log to database(sqlite3).
+     *
+     * @details write() only queues the log, a flush thread per database
+     * commits queued logs in one transaction when a batch is full or the
+     * oldest log has waited max_latency_milli. With partition_sec or
+     * partition_bytes set, logs go to database files named file_path plus
+     * ".YYYYmmdd_HHMMSS_mmm", and db_cursor reads all of them. When the
+     * queue is full, logs are appended to file_path plus ".spill" instead
+     * of blocking, and replayed in order once the database catches up.
      */
     class db_writer : public writer
     {
@@ -27,13 +38,27 @@ namespace log2what
          * @brief Construct a new db writer object.
          *
          * @param file_path File path of sqlite3 database file.
-         * @param buffer_szie Buffer how many logs before writing to database.
+         * @param buffer_szie Initial number of logs committed at once, then
+         * adapted to arrival rate.
          * @param writer_uptr Writer for db_writer's own logs.
+         * @param max_latency_milli Max time a log waits before committed.
+         * @param use_wal Use WAL journal mode, with synchronous=NORMAL.
+         * @param partition_sec Start a new database file for every time
+         * window of this length, aligned to epoch, 0 to not partition by
+         * time.
+         * @param partition_bytes Start a new database file when current one
+         * grows over this size, 0 to not partition by size.
+         * @param partition_num Max database files kept, older ones are
+         * unlinked, 0 for no limit.
          */
         db_writer(const string &file_path = "./log/log2.db",
                   const size_t buffer_szie = 100,
                   unique_ptr_writer &&writer_uptr = unique_ptr_writer{
-                      new writer});
+                      new writer},
+                  const int64_t max_latency_milli = 1000,
+                  const bool use_wal = true, const int64_t partition_sec = 0,
+                  const size_t partition_bytes = 0,
+                  const size_t partition_num = 0);
         /**
          * @brief Copy constructor deleted.
          *
@@ -61,11 +86,12 @@ namespace log2what
          */
         db_writer &operator=(db_writer &&other) = delete;
         /**
-         * @brief Destroy the db writer object
+         * @brief Destroy the db writer object, helper is destroyed with the
+         * last writer of the same database.
          */
-        ~db_writer() override{};
+        ~db_writer() override;
         /**
-         * @brief Buffer logs and write all buffered at once.
+         * @brief Queue log for flush thread of database.
          *
          * @param level Log level.
          * @param module Module name.
@@ -76,9 +102,18 @@ namespace log2what
         void write(const log_level level, const string &module,
                    const string &comment, const string &data,
                    const int64_t timestamp_nano) override;
+        /**
+         * @brief Wait until logs queued before are committed.
+         */
+        void flush() override;
 
     private:
         string file_path;
+        /**
+         * @brief Helper of the database, shared by writers of the same
+         * database and resolved once at construction.
+         */
+        ::sqlite3_helper *helper;
     };
 } // namespace log2what
 
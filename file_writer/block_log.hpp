@@ -0,0 +1,214 @@
+/**
+ * @file block_log.hpp
+ * @author TNumFive
+ * @brief Layout of block-compressed log files written by file_writer.
+ * @version 0.1
+ * @date 2023-02-20
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details Codec is chosen at build time: define LOG2WHAT_COMPRESS_LZ4 and
+ * link -llz4, LOG2WHAT_COMPRESS_ZSTD and link -lzstd, or
+ * LOG2WHAT_COMPRESS_ZLIB and link -lz. Without any of them no codec is
+ * compiled in, and file_writer writes text instead.
+ */
+#ifndef LOG2WHAT_BLOCK_LOG_HPP
+#define LOG2WHAT_BLOCK_LOG_HPP
+
+#include "../base/binary_log.hpp"
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#if defined LOG2WHAT_COMPRESS_LZ4
+#define LOG2WHAT_HAS_COMPRESSION 1
+#include <lz4.h>
+#elif defined LOG2WHAT_COMPRESS_ZSTD
+#define LOG2WHAT_HAS_COMPRESSION 1
+#include <zstd.h>
+#elif defined LOG2WHAT_COMPRESS_ZLIB
+#define LOG2WHAT_HAS_COMPRESSION 1
+#include <zlib.h>
+#else
+#define LOG2WHAT_HAS_COMPRESSION 0
+#endif
+
+namespace log2what
+{
+    /**
+     * @brief Magic bytes at the beginning of every block log file.
+     *
+     * @details File is "header | block... | index | footer". Header is
+     * "magic | u32 codec | u32 block size". Every block is "u32 stored size |
+     * u32 raw size | i64 first timestamp | i64 last timestamp | payload",
+     * payload is compressed text logs. Index and footer are written when file
+     * is closed, so a file cut by crash has blocks only, which can still be
+     * found by walking block headers.
+     */
+    static constexpr char block_log_magic[] = "\x7fL2WBLK\x01";
+    static constexpr size_t block_log_magic_size = sizeof(block_log_magic) - 1;
+
+    /**
+     * @brief Magic bytes at the end of a closed block log file.
+     */
+    static constexpr char block_index_magic[] = "L2WINDEX";
+    static constexpr size_t block_index_magic_size =
+        sizeof(block_index_magic) - 1;
+
+    /**
+     * @brief Size of file header.
+     */
+    static constexpr size_t block_log_header_size =
+        block_log_magic_size + sizeof(uint32_t) + sizeof(uint32_t);
+
+    /**
+     * @brief Size of block header.
+     */
+    static constexpr size_t block_header_size =
+        sizeof(uint32_t) + sizeof(uint32_t) + sizeof(int64_t) +
+        sizeof(int64_t);
+
+    /**
+     * @brief Size of index entry, "i64 first | i64 last | u64 offset".
+     */
+    static constexpr size_t block_index_entry_size =
+        sizeof(int64_t) + sizeof(int64_t) + sizeof(uint64_t);
+
+    /**
+     * @brief Size of footer, "u64 index offset | u64 block count | magic".
+     */
+    static constexpr size_t block_footer_size =
+        sizeof(uint64_t) + sizeof(uint64_t) + block_index_magic_size;
+
+    /**
+     * @brief Codec of block payload.
+     */
+    enum class block_codec : uint32_t
+    {
+        NONE = 0,
+        ZLIB = 1,
+        LZ4 = 2,
+        ZSTD = 3
+    };
+
+#if defined LOG2WHAT_COMPRESS_LZ4
+    static constexpr block_codec compiled_block_codec = block_codec::LZ4;
+#elif defined LOG2WHAT_COMPRESS_ZSTD
+    static constexpr block_codec compiled_block_codec = block_codec::ZSTD;
+#elif defined LOG2WHAT_COMPRESS_ZLIB
+    static constexpr block_codec compiled_block_codec = block_codec::ZLIB;
+#else
+    static constexpr block_codec compiled_block_codec = block_codec::NONE;
+#endif
+
+    /**
+     * @brief Where a block is and what time it covers.
+     */
+    struct block_index_entry
+    {
+        int64_t first_timestamp;
+        int64_t last_timestamp;
+        uint64_t offset;
+    };
+
+#if LOG2WHAT_HAS_COMPRESSION
+
+    /**
+     * @brief Max size of compressed data.
+     *
+     * @param raw_size Size of data to compress.
+     * @return size_t Max size after compression.
+     */
+    inline size_t compress_bound(const size_t raw_size)
+    {
+#if defined LOG2WHAT_COMPRESS_LZ4
+        return LZ4_compressBound(raw_size);
+#elif defined LOG2WHAT_COMPRESS_ZSTD
+        return ZSTD_compressBound(raw_size);
+#else
+        return compressBound(raw_size);
+#endif
+    }
+
+    /**
+     * @brief Append block of compressed raw data.
+     *
+     * @param buffer Buffer to append to.
+     * @param raw Raw data.
+     * @param first_timestamp Min timestamp of logs in block.
+     * @param last_timestamp Max timestamp of logs in block.
+     * @return true If compressed.
+     * @return false If compression failed, buffer is unchanged.
+     */
+    inline bool append_block(std::string &buffer, const std::string &raw,
+                             const int64_t first_timestamp,
+                             const int64_t last_timestamp)
+    {
+        size_t start = buffer.size();
+        size_t bound = compress_bound(raw.size());
+        buffer.resize(start + block_header_size + bound);
+        char *dst = &buffer[start + block_header_size];
+        size_t stored = 0;
+#if defined LOG2WHAT_COMPRESS_LZ4
+        int ret = LZ4_compress_default(raw.data(), dst, raw.size(), bound);
+        stored = ret > 0 ? ret : 0;
+#elif defined LOG2WHAT_COMPRESS_ZSTD
+        size_t ret = ZSTD_compress(dst, bound, raw.data(), raw.size(), 3);
+        stored = ZSTD_isError(ret) ? 0 : ret;
+#else
+        uLongf size = bound;
+        int ret = compress2(reinterpret_cast<Bytef *>(dst), &size,
+                            reinterpret_cast<const Bytef *>(raw.data()),
+                            raw.size(), Z_BEST_SPEED);
+        stored = ret == Z_OK ? size : 0;
+#endif
+        if (stored == 0 && raw.size())
+        {
+            buffer.resize(start);
+            return false;
+        }
+        std::string header;
+        append_binary<uint32_t>(header, stored);
+        append_binary<uint32_t>(header, raw.size());
+        append_binary<int64_t>(header, first_timestamp);
+        append_binary<int64_t>(header, last_timestamp);
+        buffer.resize(start + block_header_size + stored);
+        std::memcpy(&buffer[start], header.data(), block_header_size);
+        return true;
+    }
+
+    /**
+     * @brief Decompress payload of block.
+     *
+     * @param payload Compressed data.
+     * @param stored_size Size of compressed data.
+     * @param raw_size Size of raw data.
+     * @param out Raw data.
+     * @return true If decompressed.
+     * @return false If payload is broken.
+     */
+    inline bool decompress_block(const char *payload, const size_t stored_size,
+                                 const size_t raw_size, std::string &out)
+    {
+        out.resize(raw_size);
+        if (raw_size == 0)
+        {
+            return true;
+        }
+#if defined LOG2WHAT_COMPRESS_LZ4
+        int ret = LZ4_decompress_safe(payload, &out[0], stored_size, raw_size);
+        return ret >= 0 && static_cast<size_t>(ret) == raw_size;
+#elif defined LOG2WHAT_COMPRESS_ZSTD
+        size_t ret = ZSTD_decompress(&out[0], raw_size, payload, stored_size);
+        return !ZSTD_isError(ret) && ret == raw_size;
+#else
+        uLongf size = raw_size;
+        int ret = uncompress(reinterpret_cast<Bytef *>(&out[0]), &size,
+                             reinterpret_cast<const Bytef *>(payload),
+                             stored_size);
+        return ret == Z_OK && size == raw_size;
+#endif
+    }
+#endif
+} // namespace log2what
+#endif
\ No newline at end of file
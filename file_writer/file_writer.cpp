@@ -10,12 +10,28 @@
  */
 #include "./file_writer.hpp"
 #include "../base/common.hpp"
+#include "../base/time_format.hpp"
+#include "../base/binary_log.hpp"
+#include "./block_log.hpp"
+#include "./uring_queue.hpp"
+#include "../base/queue.hpp"
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
 #include <dirent.h>
+#include <fcntl.h>
 #include <fstream>
-#include <iomanip>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <set>
+#include <thread>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
 using namespace log2what;
 using namespace std;
 using std::chrono::milliseconds;
@@ -35,25 +51,106 @@ public:
      * @param file_name Name of log file.
      * @param file_size The max size of log file.
      * @param file_num The file name of log file rotation.
+     * @param format Format of log file.
+     * @param mode How log file is written.
+     * @param rotation When log file is rotated.
+     * @param retention_bytes Max total size of closed log files.
+     * @param retention_sec Max age of closed log files.
      */
     file_helper(const string &file_dir, const string &file_name,
-                const size_t file_size, size_t file_num)
+                const size_t file_size, size_t file_num,
+                const file_format format, const file_mode mode,
+                const rotation_policy rotation, const size_t retention_bytes,
+                const int64_t retention_sec)
     {
         mkdir(file_dir);
         this->file_dir = file_dir;
         this->file_name = file_name;
         this->file_size = file_size;
         this->file_num = file_num;
-        lock_guard<mutex> file_lock{this->file_mutex};
-        this->open_log_file();
+        this->rotation = static_cast<int>(rotation);
+        this->retention_bytes = retention_bytes;
+        this->retention_sec = retention_sec;
+        this->format = format;
+        if (format == file_format::COMPRESSED && !LOG2WHAT_HAS_COMPRESSION)
+        {
+            std::cerr << "log2what::file_writer no codec, write text instead";
+            std::cerr << std::endl;
+            this->format = file_format::TEXT;
+        }
+        this->mode = mode;
+        if ((mode == file_mode::MMAP && this->format != file_format::TEXT) ||
+            this->format == file_format::COMPRESSED)
+        {
+            this->mode = file_mode::STREAM;
+        }
+        if (this->mode == file_mode::URING)
+        {
+            this->uring.reset(new uring_queue{uring_depth, write_buffer_limit});
+            if (this->uring->ready())
+            {
+                this->uring->lend(this->write_buffer);
+            }
+            else
+            {
+                this->uring.reset();
+                this->mode = file_mode::STREAM;
+            }
+        }
+        this->current_segment.store(nullptr);
+        for (auto &name : this->filtered_ls(file_name, file_dir))
+        {
+            struct stat file_stat;
+            string file_path = file_dir + name;
+            if (::stat(file_path.c_str(), &file_stat) == 0)
+            {
+                this->file_map[name] = file_stat.st_size;
+                this->closed_bytes += file_stat.st_size;
+            }
+        }
+        {
+            lock_guard<mutex> file_lock{this->file_mutex};
+            if (this->open_log_file() && this->mode == file_mode::MMAP)
+            {
+                this->map_segment();
+            }
+        }
+        this->rotation_thread = thread{&file_helper::rotate_in_background,
+                                       this};
     }
     /**
-     * @brief Default destructor.
+     * @brief Write buffered logs and close log file.
      */
-    ~file_helper() = default;
+    ~file_helper()
+    {
+        {
+            lock_guard<mutex> index_lock{this->index_mutex};
+            this->stopping = true;
+        }
+        this->rotation_cv.notify_one();
+        this->rotation_thread.join();
+        if (this->rename_pending)
+        {
+            lock_guard<mutex> index_lock{this->index_mutex};
+            this->name_current_segment();
+        }
+        lock_guard<mutex> file_lock{this->file_mutex};
+        this->unmap_segment();
+        this->flush_buffer();
+        this->close_log_file();
+        if (this->next_fd >= 0)
+        {
+            // pre-created segment never used.
+            ::close(this->next_fd);
+            remove((this->file_dir + this->next_name).c_str());
+        }
+    }
     /**
      * @brief Write log to file.
      *
+     * @details Log is rendered into a reused buffer, which is handed to kernel
+     * once it is large enough, so no allocation happens in steady state.
+     *
      * @param level Log level.
      * @param module Module name.
      * @param comment Content of log.
@@ -64,52 +161,832 @@ public:
                const string &comment, const string &data,
                const int64_t timestamp_nano)
     {
-        constexpr int sec_to_milli = 1000;
-        constexpr int milli_to_nano = 1000000;
-        constexpr char fixed_part[] = "2022-07-30 17:02:38.795 T |%|  |%| \n";
-        constexpr int fixed_length = sizeof(fixed_part);
-        int64_t timestamp_milli = timestamp_nano / milli_to_nano;
-        int64_t timestamp_sec = timestamp_milli / sec_to_milli;
-        int64_t precision = timestamp_milli % sec_to_milli;
+        constexpr char fixed_part[] = " T |%|  |%| \n";
+        constexpr int fixed_length = timestamp_buffer_size + sizeof(fixed_part);
         size_t size_to_write = fixed_length;
+        if (this->format == file_format::BINARY)
+        {
+            // module record may be needed when module is new to this file.
+            size_to_write = binary_module_fixed_size + binary_log_fixed_size;
+        }
         size_to_write += module.length();
         size_to_write += comment.length();
         size_to_write += data.length();
+        if (this->mode == file_mode::MMAP)
+        {
+            this->write_mapped(level, module, comment, data, timestamp_nano);
+            return;
+        }
         lock_guard<mutex> file_lock{this->file_mutex};
-        if (this->out.tellp() > this->file_size - size_to_write)
+        bool size_exceeded =
+            this->pending_size(size_to_write) > this->file_size;
+        if (size_exceeded && this->format == file_format::COMPRESSED &&
+            this->fd >= 0 && this->write_buffer.size() >= min_block_size)
         {
-            if (!this->open_log_file())
+            // open block is charged at its worst case, compress it to learn
+            // what it really takes before giving up the file.
+            this->write_block();
+            size_exceeded =
+                this->pending_size(size_to_write) > this->file_size;
+        }
+        if (this->fd < 0 || timestamp_nano >= this->rotation_deadline ||
+            (size_exceeded && this->rotate_by(rotation_policy::SIZE)))
+        {
+            if (!this->open_log_file(timestamp_nano))
             {
                 std::cerr << "log2what::file_writer open file failed";
                 std::cerr << std::endl;
                 return;
             }
         }
-        this->out << get_localtime_str(timestamp_sec);
-        this->out << "." << setw(3) << setfill('0') << precision;
-        this->out << " " << to_string(level);
-        this->out << " " << module;
-        this->out << " |%| " << comment;
-        this->out << " |%| " << data << "\n";
+        if (this->format == file_format::BINARY)
+        {
+            this->write_binary(level, module, comment, data, timestamp_nano);
+        }
+        else if (this->format == file_format::COMPRESSED)
+        {
+            this->render_text(this->write_buffer, level, module, comment, data,
+                              timestamp_nano);
+            this->block_first_timestamp =
+                min(this->block_first_timestamp, timestamp_nano);
+            this->block_last_timestamp =
+                max(this->block_last_timestamp, timestamp_nano);
+        }
+        else if (comment.size() + data.size() > write_buffer_limit)
+        {
+            this->write_large_text(level, module, comment, data,
+                                   timestamp_nano);
+            return;
+        }
+        else
+        {
+            this->render_text(this->write_buffer, level, module, comment, data,
+                              timestamp_nano);
+        }
+        if (this->write_buffer.size() >= write_buffer_limit)
+        {
+            this->flush_buffer();
+        }
+    }
+    /**
+     * @brief Hand buffered logs to kernel.
+     *
+     * @details Compressed files only write full blocks, flushing small blocks
+     * would ruin compression, so buffered logs wait for rotation or close.
+     */
+    void flush()
+    {
+        lock_guard<mutex> file_lock{this->file_mutex};
+        if (this->format == file_format::COMPRESSED)
+        {
+            return;
+        }
+        this->flush_buffer();
+        if (this->uring)
+        {
+            this->uring->wait_all();
+        }
     }
 
 private:
-    ofstream out;
+    /**
+     * @brief Buffered bytes that trigger a write to kernel.
+     */
+    static constexpr size_t write_buffer_limit = 64 * KB;
+    /**
+     * @brief Max buffers in flight when written through io_uring.
+     */
+    static constexpr unsigned uring_depth = 8;
+    int fd = -1;
+    /**
+     * @brief Bytes written to current file, without buffered ones.
+     */
+    size_t file_written = 0;
     string file_dir;
     string file_name;
     size_t file_size;
     size_t file_num;
+    /**
+     * @brief Bits of rotation_policy.
+     */
+    int rotation;
+    size_t retention_bytes;
+    int64_t retention_sec;
+    /**
+     * @brief Timestamp in nanoseconds when current file is rotated, cached so
+     * no clock is read per log.
+     */
+    int64_t rotation_deadline = INT64_MAX;
+    file_format format;
+    file_mode mode;
     mutex file_mutex;
+    /**
+     * @brief Module ids defined in current binary log file.
+     */
+    unordered_map<string, uint32_t> module_id_map;
+    /**
+     * @brief Reused buffer of rendered logs not written yet.
+     */
+    string write_buffer;
+    /**
+     * @brief Writes submitted through io_uring, nullptr unless mode is URING.
+     */
+    unique_ptr<uring_queue> uring;
+    /**
+     * @brief Guard of file_map and next segment, shared with rotation thread.
+     */
+    mutex index_mutex;
+    /**
+     * @brief Names of existing log files in order and their sizes, scanned
+     * once at startup. Size of current file is 0 until it is closed.
+     */
+    map<string, size_t> file_map;
+    /**
+     * @brief Total size of closed log files in file_map.
+     */
+    size_t closed_bytes = 0;
+    /**
+     * @brief Name of current log file.
+     */
+    string current_name;
+    /**
+     * @brief Time in milliseconds current log file was switched to.
+     */
+    int64_t current_opened = 0;
+    /**
+     * @brief Set when current log file still has the name of its creation,
+     * rotation thread then renames it.
+     */
+    bool rename_pending = false;
+    /**
+     * @brief Next segment created by rotation thread, -1 if not ready.
+     */
+    int next_fd = -1;
+    string next_name;
+    bool stopping = false;
+    condition_variable rotation_cv;
+    thread rotation_thread;
+    /**
+     * @brief Index of blocks written to current compressed file.
+     */
+    vector<block_index_entry> block_index;
+    int64_t block_first_timestamp = INT64_MAX;
+    int64_t block_last_timestamp = INT64_MIN;
+    /**
+     * @brief Reused buffer of compressed block.
+     */
+    string block_buffer;
+    /**
+     * @brief Least raw size of a block closed early to fit file_size, files
+     * end once the open block is smaller, so blocks never become tiny.
+     */
+    static constexpr size_t min_block_size = 4 * KB;
+    /**
+     * @brief Size of current file after buffer and given log are written.
+     *
+     * @details For compressed file, blocks written count at their compressed
+     * size, the open block at the worst case of compressed size, plus index
+     * and footer, so closed file never exceeds file_size. The open block is
+     * compressed early when its worst case does not fit, see write().
+     *
+     * @param size_to_write Size of log to write.
+     * @return size_t Size in bytes.
+     */
+    size_t pending_size(const size_t size_to_write) const
+    {
+        size_t raw_size = this->write_buffer.size() + size_to_write;
+#if LOG2WHAT_HAS_COMPRESSION
+        if (this->format == file_format::COMPRESSED)
+        {
+            size_t index_size =
+                (this->block_index.size() + 1) * block_index_entry_size;
+            return this->file_written + block_header_size +
+                   compress_bound(raw_size) + index_size + block_footer_size;
+        }
+#endif
+        return this->file_written + raw_size;
+    }
+    /**
+     * @brief Write all given pieces to log file, retry on partial writes.
+     *
+     * @param pieces Pieces to write.
+     * @param count Number of pieces.
+     * @return true If all written.
+     * @return false If write failed.
+     */
+    bool write_all(iovec *pieces, int count)
+    {
+        if (this->uring)
+        {
+            // writes in flight come first.
+            this->uring->wait_all();
+        }
+        while (count > 0)
+        {
+            ssize_t written =
+                ::pwritev(this->fd, pieces, count, this->file_written);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                std::cerr << "log2what::file_writer write failed";
+                std::cerr << std::endl;
+                return false;
+            }
+            this->file_written += written;
+            while (count > 0 && static_cast<size_t>(written) >=
+                                    pieces->iov_len)
+            {
+                written -= pieces->iov_len;
+                pieces++;
+                count--;
+            }
+            if (count > 0)
+            {
+                pieces->iov_base = static_cast<char *>(pieces->iov_base) +
+                                   written;
+                pieces->iov_len -= written;
+            }
+        }
+        return true;
+    }
+    /**
+     * @brief Write buffered logs to log file and clear buffer.
+     */
+    void flush_buffer()
+    {
+        if (this->format == file_format::COMPRESSED)
+        {
+            this->write_block();
+            return;
+        }
+        size_t size = this->write_buffer.size();
+        if (this->fd >= 0 && size && this->uring && this->uring->ready())
+        {
+            this->uring->submit(this->fd, this->write_buffer,
+                                this->file_written);
+            this->file_written += size;
+        }
+        else if (this->fd >= 0 && size)
+        {
+            iovec piece{&this->write_buffer[0], size};
+            this->write_all(&piece, 1);
+        }
+        this->write_buffer.clear();
+    }
+    /**
+     * @brief Compress buffered logs as one block and write it.
+     */
+    void write_block()
+    {
+#if LOG2WHAT_HAS_COMPRESSION
+        if (this->fd >= 0 && this->write_buffer.size())
+        {
+            this->block_buffer.clear();
+            if (append_block(this->block_buffer, this->write_buffer,
+                             this->block_first_timestamp,
+                             this->block_last_timestamp))
+            {
+                this->block_index.push_back({this->block_first_timestamp,
+                                             this->block_last_timestamp,
+                                             this->file_written});
+                iovec piece{&this->block_buffer[0], this->block_buffer.size()};
+                this->write_all(&piece, 1);
+            }
+            else
+            {
+                std::cerr << "log2what::file_writer compress failed";
+                std::cerr << std::endl;
+            }
+        }
+#endif
+        this->write_buffer.clear();
+        this->block_first_timestamp = INT64_MAX;
+        this->block_last_timestamp = INT64_MIN;
+    }
+    /**
+     * @brief Write index of blocks and footer, ends compressed file.
+     */
+    void write_block_index()
+    {
+        string index;
+        for (auto &entry : this->block_index)
+        {
+            append_binary<int64_t>(index, entry.first_timestamp);
+            append_binary<int64_t>(index, entry.last_timestamp);
+            append_binary<uint64_t>(index, entry.offset);
+        }
+        append_binary<uint64_t>(index, this->file_written);
+        append_binary<uint64_t>(index, this->block_index.size());
+        index.append(block_index_magic, block_index_magic_size);
+        iovec piece{&index[0], index.size()};
+        this->write_all(&piece, 1);
+        this->block_index.clear();
+    }
+    /**
+     * @brief Render text log into buffer.
+     *
+     * @param buffer Buffer to append to.
+     * @param level Log level.
+     * @param module Module name.
+     * @param comment Content of log.
+     * @param data Data attached.
+     * @param timestamp_nano Timestamp of log in nanoseconds.
+     */
+    void render_text(string &buffer, const log_level level,
+                     const string &module, const string &comment,
+                     const string &data, const int64_t timestamp_nano)
+    {
+        char head[timestamp_buffer_size + 3];
+        size_t length = format_timestamp(timestamp_nano, head);
+        head[length++] = ' ';
+        head[length++] = to_char(level);
+        head[length++] = ' ';
+        buffer.append(head, length);
+        buffer.append(module);
+        buffer.append(" |%| ", 5);
+        buffer.append(comment);
+        buffer.append(" |%| ", 5);
+        buffer.append(data);
+        buffer.push_back('\n');
+    }
+    /**
+     * @brief Write text log with large comment or data without copying them.
+     *
+     * @param level Log level.
+     * @param module Module name.
+     * @param comment Content of log.
+     * @param data Data attached.
+     * @param timestamp_nano Timestamp of log in nanoseconds.
+     */
+    void write_large_text(const log_level level, const string &module,
+                          const string &comment, const string &data,
+                          const int64_t timestamp_nano)
+    {
+        char head[timestamp_buffer_size + 3];
+        size_t length = format_timestamp(timestamp_nano, head);
+        head[length++] = ' ';
+        head[length++] = to_char(level);
+        head[length++] = ' ';
+        char separator[] = " |%| ";
+        char newline[] = "\n";
+        iovec pieces[] = {
+            {&this->write_buffer[0], this->write_buffer.size()},
+            {head, length},
+            {const_cast<char *>(module.data()), module.size()},
+            {separator, 5},
+            {const_cast<char *>(comment.data()), comment.size()},
+            {separator, 5},
+            {const_cast<char *>(data.data()), data.size()},
+            {newline, 1}};
+        this->write_all(pieces, sizeof(pieces) / sizeof(iovec));
+        this->write_buffer.clear();
+    }
+    /**
+     * @brief Memory mapped log file.
+     *
+     * @details Writers reserve [offset, offset + length) with an atomic add on
+     * reserved, the only writer whose range crosses capacity rotates. Users
+     * counts writers holding the segment, so rotation can wait for copies in
+     * flight before unmapping. File size grows in steps of grow_step ahead of
+     * reservations, so readers see a valid prefix padded with zero bytes.
+     * Growing only to the bytes copied would cost a ftruncate per log, which
+     * is what this mode avoids, so the padding is documented instead.
+     * The struct is reused for every file mapped, generation tells writers
+     * holding a pointer that the file behind it changed.
+     */
+    struct mapped_segment
+    {
+        int fd = -1;
+        char *base = nullptr;
+        size_t capacity = 0;
+        atomic<int64_t> deadline{INT64_MAX};
+        atomic<uint64_t> generation{0};
+        /**
+         * @brief Offset of the first range crossing capacity.
+         */
+        atomic<size_t> end{SIZE_MAX};
+        alignas(cache_line_size) atomic<size_t> reserved{0};
+        alignas(cache_line_size) atomic<int> users{0};
+        atomic<size_t> visible{0};
+        mutex grow_mutex;
+    };
+    /**
+     * @brief Bytes the mapped file grows at a time.
+     */
+    static constexpr size_t grow_step = 64 * KB;
+    /**
+     * @brief Segment being written, nullptr while rotating.
+     */
+    atomic<mapped_segment *> current_segment;
+    /**
+     * @brief The only segment struct, writers may still touch it (never the
+     * memory it mapped) after the file behind it is rotated.
+     */
+    mapped_segment segment_state;
+    /**
+     * @brief Copy rendered log into mapped file without taking a mutex.
+     *
+     * @param level Log level.
+     * @param module Module name.
+     * @param comment Content of log.
+     * @param data Data attached.
+     * @param timestamp_nano Timestamp of log in nanoseconds.
+     */
+    void write_mapped(const log_level level, const string &module,
+                      const string &comment, const string &data,
+                      const int64_t timestamp_nano)
+    {
+        thread_local string line;
+        line.clear();
+        this->render_text(line, level, module, comment, data, timestamp_nano);
+        size_t length = line.size();
+        if (length > this->file_size)
+        {
+            std::cerr << "log2what::file_writer log larger than file_size";
+            std::cerr << std::endl;
+            return;
+        }
+        while (true)
+        {
+            mapped_segment *segment = this->current_segment.load();
+            if (segment == nullptr)
+            {
+                if (!this->rotate_segment(nullptr, 0, timestamp_nano))
+                {
+                    std::cerr << "log2what::file_writer open file failed";
+                    std::cerr << std::endl;
+                    return;
+                }
+                continue;
+            }
+            uint64_t generation = segment->generation.load();
+            if (timestamp_nano >= segment->deadline.load())
+            {
+                this->rotate_segment(segment, generation, timestamp_nano);
+                continue;
+            }
+            segment->users.fetch_add(1);
+            if (this->current_segment.load() != segment ||
+                segment->generation.load() != generation)
+            {
+                segment->users.fetch_sub(1);
+                continue;
+            }
+            size_t offset = segment->reserved.fetch_add(length);
+            if (offset + length <= segment->capacity)
+            {
+                if (offset + length <= segment->visible.load() ||
+                    this->grow_segment(*segment, offset + length))
+                {
+                    memcpy(segment->base + offset, line.data(), length);
+                }
+                else
+                {
+                    this->write_unbacked(*segment, offset, line);
+                }
+                segment->users.fetch_sub(1);
+                return;
+            }
+            if (offset <= segment->capacity)
+            {
+                // first range crossing capacity, offset is the used size.
+                segment->end.store(offset);
+                segment->users.fetch_sub(1);
+                this->rotate_segment(segment, generation, timestamp_nano);
+                continue;
+            }
+            segment->users.fetch_sub(1);
+            while (this->current_segment.load() == segment &&
+                   segment->generation.load() == generation)
+            {
+                this_thread::yield();
+            }
+        }
+    }
+    /**
+     * @brief Grow file size so that mapped range is backed by file.
+     *
+     * @param segment Segment to grow.
+     * @param needed Least size needed.
+     * @return true If range up to needed is backed.
+     * @return false If file cannot grow, mapped range must not be touched.
+     */
+    bool grow_segment(mapped_segment &segment, const size_t needed)
+    {
+        lock_guard<mutex> grow_lock{segment.grow_mutex};
+        if (needed <= segment.visible.load())
+        {
+            return true;
+        }
+        size_t target = (needed + grow_step - 1) / grow_step * grow_step;
+        target = min(target, segment.capacity);
+        if (::ftruncate(segment.fd, target) != 0)
+        {
+            return false;
+        }
+        segment.visible.store(target);
+        return true;
+    }
+    /**
+     * @brief Write reserved range by a system call when file cannot grow,
+     * touching the unbacked mapping would raise SIGBUS.
+     *
+     * @param segment Segment reserved in.
+     * @param offset Offset of range.
+     * @param line Rendered log.
+     */
+    void write_unbacked(mapped_segment &segment, const size_t offset,
+                        const string &line)
+    {
+        lock_guard<mutex> grow_lock{segment.grow_mutex};
+        if (!pwrite_all(segment.fd, line.data(), line.size(), offset))
+        {
+            std::cerr << "log2what::file_writer write failed";
+            std::cerr << std::endl;
+            return;
+        }
+        // file is extended by the write, so is what is backed.
+        size_t end = offset + line.size();
+        if (end > segment.visible.load())
+        {
+            segment.visible.store(end);
+        }
+    }
+    /**
+     * @brief Retire given segment and map a new log file.
+     *
+     * @param segment Segment to retire, nullptr if none is mapped.
+     * @param generation Generation of segment seen by caller.
+     * @param timestamp_nano Timestamp of log that triggers rotation.
+     * @return true If a segment is mapped after rotation.
+     * @return false If open or map failed.
+     */
+    bool rotate_segment(mapped_segment *segment, const uint64_t generation,
+                        const int64_t timestamp_nano)
+    {
+        lock_guard<mutex> file_lock{this->file_mutex};
+        mapped_segment *current = this->current_segment.load();
+        if (current != segment ||
+            (segment != nullptr && segment->generation.load() != generation))
+        {
+            // rotated by others.
+            return true;
+        }
+        if (segment != nullptr)
+        {
+            this->release_segment(*segment);
+        }
+        return this->open_log_file(timestamp_nano) && this->map_segment();
+    }
+    /**
+     * @brief Map log file opened, keep what is already in it.
+     *
+     * @return true If mapped.
+     * @return false If map failed.
+     */
+    bool map_segment()
+    {
+        void *base = ::mmap(nullptr, this->file_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED, this->fd, 0);
+        if (base == MAP_FAILED)
+        {
+            return false;
+        }
+        // reserve blocks without changing size, best effort.
+        ::fallocate(this->fd, FALLOC_FL_KEEP_SIZE, 0, this->file_size);
+        mapped_segment &segment = this->segment_state;
+        segment.fd = this->fd;
+        segment.base = static_cast<char *>(base);
+        segment.capacity = this->file_size;
+        segment.deadline.store(this->rotation_deadline);
+        segment.end.store(SIZE_MAX);
+        segment.reserved.store(this->file_written);
+        segment.visible.store(this->file_written);
+        // writers holding the struct see a new generation before using it.
+        segment.generation.fetch_add(1);
+        this->current_segment.store(&segment);
+        return true;
+    }
+    /**
+     * @brief Stop writers using segment, unmap it and cut file to used size.
+     *
+     * @param segment Segment to release.
+     */
+    void release_segment(mapped_segment &segment)
+    {
+        this->current_segment.store(nullptr);
+        while (segment.users.load() != 0)
+        {
+            this_thread::yield();
+        }
+        // no range is reserved any more, end is set if any crossed capacity.
+        size_t used = min(segment.reserved.load(), segment.end.load());
+        ::munmap(segment.base, segment.capacity);
+        segment.base = nullptr;
+        ::ftruncate(segment.fd, used);
+        this->file_written = used;
+    }
+    /**
+     * @brief Release current segment if any, used on destruction.
+     */
+    void unmap_segment()
+    {
+        mapped_segment *segment = this->current_segment.load();
+        if (segment != nullptr)
+        {
+            this->release_segment(*segment);
+        }
+    }
+    /**
+     * @brief Cut zero bytes and broken last line left by a crash.
+     *
+     * @details Mapped files are padded with zero bytes, and a crash may leave
+     * the last line half copied. Cut the file after the last newline before
+     * the padding, so new logs never follow garbage. Zero bytes of ranges
+     * reserved but never copied before a crash stay in the middle.
+     */
+    void recover_tail()
+    {
+        constexpr size_t block_size = 4 * KB;
+        char block[block_size];
+        size_t end = this->file_written;
+        while (end > 0)
+        {
+            size_t begin = end > block_size ? end - block_size : 0;
+            ssize_t got = ::pread(this->fd, block, end - begin, begin);
+            if (got != static_cast<ssize_t>(end - begin))
+            {
+                return;
+            }
+            size_t i = end - begin;
+            while (i > 0 && block[i - 1] != '\n')
+            {
+                i--;
+            }
+            if (i > 0)
+            {
+                end = begin + i;
+                break;
+            }
+            end = begin;
+        }
+        if (end != this->file_written && ::ftruncate(this->fd, end) == 0)
+        {
+            this->file_written = end;
+        }
+    }
+    /**
+     * @brief Encode log as binary records into write buffer.
+     *
+     * @param level Log level.
+     * @param module Module name.
+     * @param comment Content of log.
+     * @param data Data attached.
+     * @param timestamp_nano Timestamp of log in nanoseconds.
+     */
+    void write_binary(const log_level level, const string &module,
+                      const string &comment, const string &data,
+                      const int64_t timestamp_nano)
+    {
+        auto it = this->module_id_map.find(module);
+        if (it == this->module_id_map.end())
+        {
+            uint32_t id = this->module_id_map.size();
+            it = this->module_id_map.emplace(module, id).first;
+            append_module_record(this->write_buffer, id, module);
+        }
+        append_log_record(this->write_buffer, timestamp_nano, level,
+                          it->second, comment, data);
+    }
+    /**
+     * @brief Check if log file is of the format of this helper.
+     *
+     * @param file_path Path of log file.
+     * @return true Yes, or file is empty.
+     * @return false No.
+     */
+    bool is_same_format(const string &file_path)
+    {
+        static_assert(binary_log_magic_size == block_log_magic_size,
+                      "magic of all formats has the same size");
+        char magic[binary_log_magic_size] = {};
+        ifstream in{file_path, ios::binary};
+        in.read(magic, binary_log_magic_size);
+        if (in.gcount() == 0)
+        {
+            // empty segment left by rotation thread.
+            return true;
+        }
+        file_format kind = file_format::TEXT;
+        if (in.gcount() == binary_log_magic_size &&
+            memcmp(magic, binary_log_magic, sizeof(magic)) == 0)
+        {
+            kind = file_format::BINARY;
+        }
+        else if (in.gcount() == block_log_magic_size &&
+                 memcmp(magic, block_log_magic, sizeof(magic)) == 0)
+        {
+            kind = file_format::COMPRESSED;
+        }
+        return kind == this->format;
+    }
+    /**
+     * @brief Flags to open log file with.
+     *
+     * @return int Flags.
+     */
+    int open_flags() const
+    {
+        // mmap needs read access.
+        int flags = O_RDWR | O_CREAT | O_CLOEXEC;
+        if (!this->uring && this->mode != file_mode::MMAP)
+        {
+            // writes in flight and writes of mapped ranges carry their own
+            // offsets, O_APPEND ignores them.
+            flags |= O_APPEND;
+        }
+        return flags;
+    }
+    /**
+     * @brief Open existing log file for appending.
+     *
+     * @param file_path Path of log file.
+     */
+    void open_fd(const string &file_path)
+    {
+        this->fd = ::open(file_path.c_str(), this->open_flags(), 0644);
+        struct stat file_stat;
+        this->file_written = 0;
+        if (this->fd >= 0 && ::fstat(this->fd, &file_stat) == 0)
+        {
+            this->file_written = file_stat.st_size;
+        }
+        if (this->file_written && this->format == file_format::TEXT)
+        {
+            this->recover_tail();
+        }
+    }
+    /**
+     * @brief Close log file if opened.
+     */
+    void close_log_file()
+    {
+        if (this->fd >= 0 && this->format == file_format::COMPRESSED)
+        {
+            this->write_block_index();
+        }
+        if (this->uring)
+        {
+            this->uring->wait_all();
+        }
+        if (this->fd >= 0)
+        {
+            ::close(this->fd);
+            this->fd = -1;
+        }
+    }
+    /**
+     * @brief Reset state of new opened file, write magic for binary file.
+     *
+     * @return true If file is opened.
+     * @return false If file is not opened.
+     */
+    bool init_log_file()
+    {
+        this->module_id_map.clear();
+        if (this->fd < 0)
+        {
+            return false;
+        }
+        if (this->format == file_format::BINARY && this->file_written == 0)
+        {
+            this->write_buffer.append(binary_log_magic, binary_log_magic_size);
+        }
+        if (this->format == file_format::COMPRESSED && this->file_written == 0)
+        {
+            // buffer holds raw block, so header is written directly.
+            string header{block_log_magic, block_log_magic_size};
+            auto codec = static_cast<uint32_t>(compiled_block_codec);
+            append_binary<uint32_t>(header, codec);
+            append_binary<uint32_t>(header, write_buffer_limit);
+            iovec piece{&header[0], header.size()};
+            this->write_all(&piece, 1);
+        }
+        return true;
+    }
     /**
      * @brief Generate log file suffix.
      *
+     * @param timestamp Time in milliseconds the suffix tells.
      * @return string Generated suffix string.
      */
-    inline string generate_log_file_suffix()
+    inline string generate_log_file_suffix(const int64_t timestamp)
     {
         constexpr int sec_to_milli = 1000;
         char buffer[21];
-        int64_t timestamp = get_timestamp<milliseconds>();
         tm lt = get_localtime_tm(timestamp / sec_to_milli);
         strftime(buffer, sizeof(buffer), ".%Y%m%d_%H%M%S", &lt);
         sprintf(&buffer[16], "_%03ld", timestamp % sec_to_milli);
@@ -185,58 +1062,358 @@ private:
         return {};
     }
     /**
-     * @brief Open log file.
-     * 
-     * @details Open old log file if exists when fstream is closed; Open new
-     * file if log file max nums not exceeded; Reuse and rename old log file if
-     * log file max nums met.
-     * 
-     * @return true If open log file succeeded.
-     * @return false If open log file failed.
+     * @brief Check if log file is rotated by given policy.
+     *
+     * @param policy SIZE, HOURLY or DAILY.
+     * @return true Yes.
+     * @return false No.
      */
-    bool open_log_file()
+    bool rotate_by(const rotation_policy policy) const
     {
-        auto file_set = this->filtered_ls(this->file_name, this->file_dir);
-        if (!this->out.is_open() && file_set.size())
+        return this->rotation & static_cast<int>(policy);
+    }
+    /**
+     * @brief Get creation time of log file from its name.
+     *
+     * @param name Name of log file.
+     * @return int64_t Timestamp in milliseconds, 0 if name is malformed.
+     */
+    int64_t get_file_timestamp(const string &name) const
+    {
+        // ".YYYYmmdd_HHMMSS_mmm" at the end of name.
+        constexpr size_t suffix_size = 20;
+        if (name.size() < suffix_size)
         {
-            // file not opened but old log files already exist.
-            this->out.open(this->file_dir + *(file_set.rbegin()), ios::app);
-            return this->out.is_open();
+            return 0;
         }
-        // file opened, close file and try open new file.
-        if (this->out.is_open())
+        tm lt;
+        memset(&lt, 0, sizeof(lt));
+        const char *suffix = name.c_str() + name.size() - suffix_size + 1;
+        const char *end = strptime(suffix, "%Y%m%d_%H%M%S", &lt);
+        if (end == nullptr || *end != '_')
         {
-            this->out.close();
+            return 0;
         }
-        string new_path = this->file_dir + this->file_name;
-        new_path.append(log_extension).append(this->generate_log_file_suffix());
-        if (file_set.size() < this->file_num)
+        lt.tm_isdst = -1;
+        return static_cast<int64_t>(mktime(&lt)) * 1000 + atoi(end + 1);
+    }
+    /**
+     * @brief Get when log file created at given time is rotated by time.
+     *
+     * @details Hours and days are those of local time. Computed once per
+     * file, so writers only compare timestamps.
+     *
+     * @param timestamp_milli Creation time in milliseconds.
+     * @return int64_t Deadline in nanoseconds, INT64_MAX if not rotated by
+     * time.
+     */
+    int64_t get_rotation_deadline(const int64_t timestamp_milli) const
+    {
+        constexpr int64_t sec_to_nano = 1000000000;
+        bool hourly = this->rotate_by(rotation_policy::HOURLY);
+        if (!hourly && !this->rotate_by(rotation_policy::DAILY))
         {
-            this->out.open(new_path, ios::app);
+            return INT64_MAX;
+        }
+        tm lt = get_localtime_tm(timestamp_milli / 1000);
+        lt.tm_sec = 0;
+        lt.tm_min = 0;
+        if (hourly)
+        {
+            lt.tm_hour++;
         }
         else
         {
-            while (file_set.size() > this->file_num)
+            lt.tm_hour = 0;
+            lt.tm_mday++;
+        }
+        lt.tm_isdst = -1;
+        return static_cast<int64_t>(mktime(&lt)) * sec_to_nano;
+    }
+    /**
+     * @brief Generate name of log file newer than all existing ones, called
+     * with index_mutex held.
+     *
+     * @details Names must be strictly increasing, so when rotating more than
+     * once in a millisecond the name tells a millisecond after the newest
+     * one instead of waiting for the clock.
+     *
+     * @param timestamp_milli Time the name should tell.
+     * @param newest Newest existing name, empty if none.
+     * @return string Name of log file.
+     */
+    string generate_log_file_name(int64_t timestamp_milli,
+                                  const string &newest)
+    {
+        if (newest.size())
+        {
+            timestamp_milli = max(timestamp_milli,
+                                  this->get_file_timestamp(newest) + 1);
+        }
+        return this->file_name + log_extension +
+               this->generate_log_file_suffix(timestamp_milli);
+    }
+    /**
+     * @brief Create next segment, called with index_mutex held.
+     *
+     * @return true If next segment is ready.
+     * @return false If create failed.
+     */
+    bool prepare_segment()
+    {
+        string newest =
+            this->file_map.empty() ? "" : this->file_map.rbegin()->first;
+        string name = this->generate_log_file_name(
+            get_timestamp<milliseconds>(), newest);
+        string path = this->file_dir + name;
+        int next_fd = ::open(path.c_str(), this->open_flags() | O_EXCL, 0644);
+        if (next_fd < 0)
+        {
+            return false;
+        }
+        if (this->mode == file_mode::MMAP)
+        {
+            // allocate blocks here instead of on the write path.
+            ::fallocate(next_fd, FALLOC_FL_KEEP_SIZE, 0, this->file_size);
+        }
+        this->next_fd = next_fd;
+        this->next_name = name;
+        return true;
+    }
+    /**
+     * @brief Rename current segment to the time it was switched to, called
+     * by rotation thread with index_mutex held.
+     *
+     * @details Next segment is created ahead of time, so its name would tell
+     * when it was created rather than when it was opened. Age of a closed
+     * file is read from the name of the file after it, hence the rename. It
+     * is done here, so switching on the write path only swaps descriptors;
+     * the descriptor stays valid across rename. The name is kept if no name
+     * fits between its neighbours.
+     */
+    void name_current_segment()
+    {
+        this->rename_pending = false;
+        auto it = this->file_map.find(this->current_name);
+        if (it == this->file_map.end())
+        {
+            return;
+        }
+        string older = it == this->file_map.begin() ? "" : prev(it)->first;
+        string name = this->generate_log_file_name(this->current_opened,
+                                                   older);
+        if (name == this->current_name || this->file_map.count(name) ||
+            (this->next_fd >= 0 && name >= this->next_name))
+        {
+            return;
+        }
+        string old_path = this->file_dir + this->current_name;
+        string new_path = this->file_dir + name;
+        if (rename(old_path.c_str(), new_path.c_str()) == 0)
+        {
+            size_t size = it->second;
+            this->file_map.erase(it);
+            this->file_map[name] = size;
+            this->current_name = name;
+        }
+    }
+    /**
+     * @brief Check if closed log files exceed count or total size.
+     *
+     * @return true Yes.
+     * @return false No.
+     */
+    bool exceeds_retention() const
+    {
+        size_t size = this->file_map.size();
+        return size > 1 &&
+               ((this->file_num && size > this->file_num) ||
+                (this->retention_bytes &&
+                 this->closed_bytes > this->retention_bytes));
+    }
+    /**
+     * @brief Take expired log files out of file_map, called with index_mutex
+     * held.
+     *
+     * @details Current log file is the newest one and never expires. A closed
+     * file is as old as the file after it, which is created when it closes.
+     *
+     * @param timestamp_milli Current time in milliseconds.
+     * @return vector<string> Paths of expired log files.
+     */
+    vector<string> collect_expired(const int64_t timestamp_milli)
+    {
+        vector<string> expired;
+        while (this->file_map.size() > 1)
+        {
+            auto oldest = this->file_map.begin();
+            int64_t closed = this->get_file_timestamp(next(oldest)->first);
+            int64_t age = timestamp_milli - closed;
+            bool too_old =
+                this->retention_sec && age > this->retention_sec * 1000;
+            if (!too_old && !this->exceeds_retention())
+            {
+                break;
+            }
+            this->closed_bytes -= oldest->second;
+            expired.push_back(this->file_dir + oldest->first);
+            this->file_map.erase(oldest);
+        }
+        return expired;
+    }
+    /**
+     * @brief Loop of rotation thread, removes expired segments and keeps
+     * next segment created, so write path only swaps file descriptor.
+     */
+    void rotate_in_background()
+    {
+        unique_lock<mutex> index_lock{this->index_mutex};
+        while (!this->stopping)
+        {
+            if (this->rename_pending)
+            {
+                this->name_current_segment();
+            }
+            int64_t now = get_timestamp<milliseconds>();
+            vector<string> expired = this->collect_expired(now);
+            if (expired.size())
+            {
+                index_lock.unlock();
+                for (auto &file_path : expired)
+                {
+                    remove(file_path.c_str());
+                }
+                index_lock.lock();
+                continue;
+            }
+            if (this->next_fd < 0 && !this->prepare_segment())
+            {
+                // retry later, write path creates it if still missing.
+                this->rotation_cv.wait_for(index_lock, milliseconds(100));
+                continue;
+            }
+            auto ready = [&]() {
+                return this->stopping || this->next_fd < 0 ||
+                       this->rename_pending || this->exceeds_retention();
+            };
+            if (this->retention_sec && this->file_map.size() > 1)
+            {
+                // wake up when the oldest closed file gets too old.
+                auto second = next(this->file_map.begin());
+                int64_t expire_at = this->get_file_timestamp(second->first) +
+                                    this->retention_sec * 1000;
+                int64_t wait_milli = max<int64_t>(expire_at - now, 1);
+                this->rotation_cv.wait_for(index_lock,
+                                           milliseconds(wait_milli), ready);
+            }
+            else
+            {
+                this->rotation_cv.wait(index_lock, ready);
+            }
+        }
+    }
+    /**
+     * @brief Open log file.
+     *
+     * @details Reopen the newest log file if it has room and is in current
+     * period when no file is opened yet. Otherwise switch to the segment
+     * created by rotation thread, or create it here if it is not ready.
+     * Expired files are removed by rotation thread, so nothing is scanned nor
+     * removed on the write path.
+     *
+     * @param timestamp_nano Timestamp of log to write, period of new file is
+     * the later one of it and creation time.
+     * @return true If open log file succeeded.
+     * @return false If open log file failed.
+     */
+    bool open_log_file(const int64_t timestamp_nano = 0)
+    {
+        string old_name;
+        {
+            lock_guard<mutex> index_lock{this->index_mutex};
+            if (this->fd < 0 && this->file_map.size())
+            {
+                old_name = this->file_map.rbegin()->first;
+            }
+        }
+        string old_path = this->file_dir + old_name;
+        int64_t old_deadline =
+            this->get_rotation_deadline(this->get_file_timestamp(old_name));
+        // compressed files end with index, so they are never appended to.
+        if (old_name.size() && this->format != file_format::COMPRESSED &&
+            old_deadline > get_nano_timestamp() &&
+            this->is_same_format(old_path))
+        {
+            // file not opened but old log files already exist.
+            this->open_fd(old_path);
+            bool size_limited = this->rotate_by(rotation_policy::SIZE) ||
+                                this->mode == file_mode::MMAP;
+            if (!size_limited || this->file_written < this->file_size)
             {
-                string file_path = this->file_dir + *file_set.begin();
-                remove(file_path.c_str());
-                file_set.erase(file_set.begin());
+                lock_guard<mutex> index_lock{this->index_mutex};
+                this->closed_bytes -= this->file_map[old_name];
+                this->file_map[old_name] = 0;
+                this->current_name = old_name;
+                this->current_opened = this->get_file_timestamp(old_name);
+                this->rotation_deadline = old_deadline;
+                return this->init_log_file();
             }
-            string old_path = this->file_dir + *file_set.begin();
-            rename(old_path.c_str(), new_path.c_str());
-            this->out.open(new_path, ios::trunc);
+            this->close_log_file();
+        }
+        // file opened, close file and switch to next segment.
+        this->flush_buffer();
+        bool opened = this->fd >= 0;
+        this->close_log_file();
+        unique_lock<mutex> index_lock{this->index_mutex};
+        if (opened)
+        {
+            this->file_map[this->current_name] = this->file_written;
+            this->closed_bytes += this->file_written;
+        }
+        // a segment created right here already has the name of this time.
+        bool created_here = this->next_fd < 0;
+        if (created_here && !this->prepare_segment())
+        {
+            return false;
         }
-        return out.is_open();
+        this->fd = this->next_fd;
+        this->next_fd = -1;
+        this->file_written = 0;
+        this->current_name = this->next_name;
+        this->current_opened = created_here
+                                   ? this->get_file_timestamp(this->next_name)
+                                   : get_timestamp<milliseconds>();
+        this->rename_pending = !created_here;
+        this->file_map[this->current_name] = 0;
+        int64_t timestamp_milli =
+            max(timestamp_nano / 1000000, this->current_opened);
+        this->rotation_deadline = this->get_rotation_deadline(timestamp_milli);
+        index_lock.unlock();
+        this->rotation_cv.notify_one();
+        return this->init_log_file();
     }
 };
 
+/**
+ * @brief Helper and number of writers using it.
+ */
+struct helper_entry
+{
+    unique_ptr<file_helper> helper;
+    size_t writers = 0;
+};
+
+/**
+ * @brief Guard of helper_map, only taken when writers are created or
+ * destroyed.
+ */
 static mutex life_cycle_mutex;
 /**
  * @brief Map of file helper for different log files.
  * 
  * @details Make sure only one helper for one {file_dir + file_name}.
  */
-static map<string, unique_ptr<file_helper>> helper_map;
+static map<string, helper_entry> helper_map;
 
 /**
  * @brief Construct a new file writer object.
@@ -245,19 +1422,46 @@ static map<string, unique_ptr<file_helper>> helper_map;
  * @param file_dir Directory for log files.
  * @param file_size The max log file size.
  * @param file_num The number of log file rotation.
+ * @param format Format of log file.
+ * @param mode How log file is written.
+ * @param rotation When log file is rotated.
+ * @param retention_bytes Max total size of closed log files, 0 for no limit.
+ * @param retention_sec Max age of closed log files, 0 for no limit.
  */
 file_writer::file_writer(const string &file_name, const string &file_dir,
-                         const size_t file_size, const size_t file_num)
+                         const size_t file_size, const size_t file_num,
+                         const file_format format, const file_mode mode,
+                         const rotation_policy rotation,
+                         const size_t retention_bytes,
+                         const int64_t retention_sec)
 {
     this->helper_map_key = file_dir + file_name;
     lock_guard<mutex> life_cycle_lock{life_cycle_mutex};
-    if (helper_map.count(this->helper_map_key))
+    auto &entry = helper_map[this->helper_map_key];
+    if (!entry.helper)
     {
-        return;
+        entry.helper.reset(new file_helper{
+            file_dir, file_name, file_size, file_num, format, mode, rotation,
+            retention_bytes, retention_sec});
+    }
+    entry.writers++;
+    this->helper = entry.helper.get();
+}
+
+/**
+ * @brief Destroy the file writer object, destroy helper if no writer left.
+ *
+ * @details Helper is destroyed under life_cycle_mutex, so a new helper of the
+ * same file is never opened before the old one is closed.
+ */
+file_writer::~file_writer()
+{
+    lock_guard<mutex> life_cycle_lock{life_cycle_mutex};
+    auto it = helper_map.find(this->helper_map_key);
+    if (it != helper_map.end() && --it->second.writers == 0)
+    {
+        helper_map.erase(it);
     }
-    auto file_helper_ptr =
-        new file_helper{file_dir, file_name, file_size, file_num};
-    helper_map[this->helper_map_key].reset(file_helper_ptr);
 }
 
 /**
@@ -278,7 +1482,13 @@ void file_writer::write(const log_level level, const string &module,
     {
         timestamp = get_nano_timestamp();
     }
-    lock_guard<mutex> life_cycle_lock{life_cycle_mutex};
-    auto &helper = helper_map[this->helper_map_key];
-    helper->write(level, module, comment, data, timestamp);
+    this->helper->write(level, module, comment, data, timestamp);
+}
+
+/**
+ * @brief Hand buffered logs to kernel.
+ */
+void file_writer::flush()
+{
+    this->helper->flush();
 }
\ No newline at end of file
@@ -13,11 +13,66 @@
 
 #include "../base/writer.hpp"
 
+class file_helper;
+
 namespace log2what
 {
     static constexpr size_t KB = 1024;
     static constexpr size_t MB = 1024 * KB;
 
+    /**
+     * @brief Format of log file.
+     *
+     * @details COMPRESSED writes text logs in compressed blocks with an index
+     * of block timestamps, read by log2what-seek. Codec is chosen at build
+     * time, see block_log.hpp; without codec it falls back to TEXT.
+     */
+    enum class file_format : int
+    {
+        TEXT = 1,
+        BINARY = 2,
+        COMPRESSED = 4
+    };
+
+    /**
+     * @brief When log file is rotated, bits can be combined.
+     *
+     * @details SIZE rotates when file_size is reached, HOURLY and DAILY
+     * rotate at hour and day boundaries of local time. SIZE_OR_HOURLY and
+     * SIZE_OR_DAILY rotate at whichever comes first. MMAP mode is always
+     * limited by file_size, since files are mapped with that size.
+     */
+    enum class rotation_policy : int
+    {
+        SIZE = 1,
+        HOURLY = 2,
+        DAILY = 4,
+        SIZE_OR_HOURLY = 3,
+        SIZE_OR_DAILY = 5
+    };
+
+    /**
+     * @brief How log file is written.
+     *
+     * @details STREAM renders logs into a buffer under a mutex and writes it
+     * with writev. MMAP preallocates every file to file_size and maps it, so
+     * writers reserve ranges with an atomic add and copy in parallel; it
+     * applies to TEXT format only, BINARY falls back to STREAM. Mapped pages
+     * must be backed by the file, so while a file is written its size runs
+     * up to 64KB ahead of logs copied, and readers such as tail -f see zero
+     * bytes there; the file is cut to its used size on rotation and
+     * destruction, readers that follow a live file should stop at the first
+     * zero byte or use STREAM. URING renders
+     * like STREAM but submits full buffers through io_uring, so writers never
+     * block in write(2); falls back to STREAM where io_uring is unavailable.
+     */
+    enum class file_mode : int
+    {
+        STREAM = 1,
+        MMAP = 2,
+        URING = 4
+    };
+
     /**
      * @brief Writer that writes to file.
      */
@@ -32,11 +87,23 @@ namespace log2what
          * @param file_dir Directory that stores log file.
          * @param file_size The max size of log file in bytes.
          * @param file_num The max file nums of log file rotation.
-         * @param keep_alive Shall file be closed when no writer writes.
+         * @param format Write text or binary log file, binary files can be
+         * converted back to text by log2what-decode.
+         * @param mode Write log file by stream or by memory map.
+         * @param rotation Rotate log file by size, by time or both.
+         * @param retention_bytes Remove oldest log files when total size of
+         * closed ones exceeds it, 0 for no limit.
+         * @param retention_sec Remove log files closed longer than it ago, 0
+         * for no limit. file_num of 0 also means no limit.
          */
         file_writer(const string &file_name = "root",
                     const string &file_dir = "./log/",
-                    const size_t file_size = MB, const size_t file_num = 50);
+                    const size_t file_size = MB, const size_t file_num = 50,
+                    const file_format format = file_format::TEXT,
+                    const file_mode mode = file_mode::STREAM,
+                    const rotation_policy rotation = rotation_policy::SIZE,
+                    const size_t retention_bytes = 0,
+                    const int64_t retention_sec = 0);
         /**
          * @brief Copy constructor deleted.
          *
@@ -64,10 +131,10 @@ namespace log2what
          */
         file_writer &operator=(file_writer &&other) = delete;
         /**
-         * @brief Destroy the file writer object
-         *
+         * @brief Destroy the file writer object, helper is destroyed with the
+         * last writer of the same file.
          */
-        ~file_writer() override = default;
+        ~file_writer() override;
         /**
          * @brief Write logs to file.
          *
@@ -80,9 +147,18 @@ namespace log2what
         void write(const log_level level, const string &module,
                    const string &comment, const string &data,
                    const int64_t timestamp_nano = 0) override;
+        /**
+         * @brief Hand buffered logs to kernel.
+         */
+        void flush() override;
 
     private:
         string helper_map_key;
+        /**
+         * @brief Helper of the log file, shared by writers of the same file
+         * and resolved once at construction.
+         */
+        ::file_helper *helper;
     };
 } // namespace log2what
 
@@ -0,0 +1,476 @@
+/**
+ * @file uring_queue.hpp
+ * @author TNumFive
+ * @brief Bounded queue of file writes submitted through io_uring.
+ * @version 0.1
+ * @date 2023-02-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef LOG2WHAT_URING_QUEUE_HPP
+#define LOG2WHAT_URING_QUEUE_HPP
+
+#include "../base/binary_log.hpp"
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+#if defined __linux__ && __has_include(<linux/io_uring.h>)
+#define LOG2WHAT_HAS_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#else
+#define LOG2WHAT_HAS_IO_URING 0
+#endif
+
+namespace log2what
+{
+    /**
+     * @brief Writes of whole buffers submitted through io_uring.
+     *
+     * @details Talks to kernel by raw system calls, so no liburing is needed.
+     * Buffers are swapped in and out, never copied. Buffers owned by the queue
+     * are registered to kernel and written with WRITE_FIXED, buffers grown
+     * beyond the registered range are written with plain WRITE. At most depth
+     * writes are in flight, submit() waits for a completion when all slots
+     * are busy. Not thread safe, caller holds its own lock. ready() turns
+     * false when io_uring is unavailable or fails, caller then writes by
+     * itself.
+     */
+    class uring_queue
+    {
+    public:
+        using string = std::string;
+        /**
+         * @brief Construct a new uring queue object.
+         *
+         * @param depth Max writes in flight.
+         * @param buffer_size Expected size of a buffer.
+         */
+        uring_queue(const unsigned depth, const size_t buffer_size)
+        {
+#if LOG2WHAT_HAS_IO_URING
+            if (!this->setup(depth))
+            {
+                this->teardown();
+                return;
+            }
+            this->slot_vector.resize(depth);
+            this->spare_buffer.reserve(2 * buffer_size);
+            std::vector<iovec> iovec_vector;
+            for (unsigned i = 0; i < depth; i++)
+            {
+                slot &s = this->slot_vector[i];
+                s.buffer.reserve(2 * buffer_size);
+                iovec_vector.push_back({&s.buffer[0], s.buffer.capacity()});
+                this->free_vector.push_back(i);
+            }
+            iovec_vector.push_back(
+                {&this->spare_buffer[0], this->spare_buffer.capacity()});
+            // pinned memory is limited by RLIMIT_MEMLOCK, best effort.
+            if (::syscall(__NR_io_uring_register, this->ring_fd,
+                          IORING_REGISTER_BUFFERS, iovec_vector.data(),
+                          iovec_vector.size()) == 0)
+            {
+                this->registered_vector = std::move(iovec_vector);
+            }
+            this->usable = true;
+#endif
+        }
+        /**
+         * @brief Copy constructor deleted.
+         *
+         * @param other Other queue.
+         */
+        uring_queue(const uring_queue &other) = delete;
+        /**
+         * @brief Copy assign constructor deleted.
+         *
+         * @param other Other queue.
+         * @return uring_queue& Self.
+         */
+        uring_queue &operator=(const uring_queue &other) = delete;
+        /**
+         * @brief Move constructor deleted.
+         *
+         * @param other Other queue.
+         */
+        uring_queue(uring_queue &&other) = delete;
+        /**
+         * @brief Move assign constructor deleted.
+         *
+         * @param other Other queue.
+         * @return uring_queue& Self.
+         */
+        uring_queue &operator=(uring_queue &&other) = delete;
+        /**
+         * @brief Wait for writes in flight and release ring.
+         */
+        ~uring_queue()
+        {
+            this->wait_all();
+#if LOG2WHAT_HAS_IO_URING
+            this->teardown();
+#endif
+        }
+        /**
+         * @brief Check if writes can be submitted.
+         *
+         * @return true Yes.
+         * @return false No, io_uring is unavailable.
+         */
+        bool ready() const { return this->usable; }
+        /**
+         * @brief Swap given buffer with a registered one owned by queue.
+         *
+         * @param buffer Buffer of caller, should be empty.
+         */
+        void lend(string &buffer) { buffer.swap(this->spare_buffer); }
+        /**
+         * @brief Submit write of buffer at offset, buffer is swapped with an
+         * empty one.
+         *
+         * @param fd File descriptor.
+         * @param buffer Bytes to write, empty after return.
+         * @param offset Offset in file.
+         */
+        void submit(const int fd, string &buffer, const off_t offset)
+        {
+#if LOG2WHAT_HAS_IO_URING
+            while (this->usable && this->free_vector.empty())
+            {
+                this->reap(true);
+            }
+            if (!this->usable)
+            {
+                this->write_directly(fd, buffer.data(), buffer.size(), offset);
+                buffer.clear();
+                return;
+            }
+            unsigned index = this->free_vector.back();
+            this->free_vector.pop_back();
+            slot &s = this->slot_vector[index];
+            s.buffer.swap(buffer);
+            s.fd = fd;
+            s.offset = offset;
+            unsigned tail = *this->sq_tail;
+            unsigned sq_index = tail & *this->sq_mask;
+            io_uring_sqe &sqe = this->sqes[sq_index];
+            std::memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = IORING_OP_WRITE;
+            sqe.fd = fd;
+            sqe.off = offset;
+            sqe.addr = reinterpret_cast<uint64_t>(s.buffer.data());
+            sqe.len = s.buffer.size();
+            sqe.user_data = index;
+            for (size_t i = 0; i < this->registered_vector.size(); i++)
+            {
+                const iovec &range = this->registered_vector[i];
+                if (range.iov_base == s.buffer.data() &&
+                    s.buffer.size() <= range.iov_len)
+                {
+                    sqe.opcode = IORING_OP_WRITE_FIXED;
+                    sqe.buf_index = i;
+                    break;
+                }
+            }
+            this->sq_array[sq_index] = sq_index;
+            __atomic_store_n(this->sq_tail, tail + 1, __ATOMIC_RELEASE);
+            s.busy = true;
+            this->in_flight++;
+            if (!this->enter(1, 0))
+            {
+                if (__atomic_load_n(this->sq_head, __ATOMIC_ACQUIRE) == tail)
+                {
+                    // kernel never saw the entry, take it back.
+                    __atomic_store_n(this->sq_tail, tail, __ATOMIC_RELEASE);
+                }
+                this->fail();
+                return;
+            }
+            this->reap(false);
+#else
+            this->write_directly(fd, buffer.data(), buffer.size(), offset);
+            buffer.clear();
+#endif
+        }
+        /**
+         * @brief Wait until all submitted writes complete.
+         */
+        void wait_all()
+        {
+#if LOG2WHAT_HAS_IO_URING
+            while (this->in_flight > 0)
+            {
+                this->reap(true);
+            }
+#endif
+        }
+
+    private:
+        /**
+         * @brief Buffer in flight and where it goes.
+         */
+        struct slot
+        {
+            string buffer;
+            int fd = -1;
+            off_t offset = 0;
+            bool busy = false;
+        };
+        bool usable = false;
+        unsigned in_flight = 0;
+        std::vector<slot> slot_vector;
+        std::vector<unsigned> free_vector;
+        std::vector<iovec> registered_vector;
+        string spare_buffer;
+        /**
+         * @brief Write synchronously, used when io_uring fails.
+         *
+         * @param fd File descriptor.
+         * @param data Bytes to write.
+         * @param size Number of bytes.
+         * @param offset Offset in file.
+         */
+        void write_directly(const int fd, const char *data, const size_t size,
+                            const off_t offset)
+        {
+            if (!pwrite_all(fd, data, size, offset))
+            {
+                std::cerr << "log2what::file_writer write failed";
+                std::cerr << std::endl;
+            }
+        }
+#if LOG2WHAT_HAS_IO_URING
+        int ring_fd = -1;
+        void *sq_ring = MAP_FAILED;
+        size_t sq_ring_size = 0;
+        void *cq_ring = MAP_FAILED;
+        size_t cq_ring_size = 0;
+        io_uring_sqe *sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+        size_t sqes_size = 0;
+        unsigned *sq_head = nullptr;
+        unsigned *sq_tail = nullptr;
+        unsigned *sq_mask = nullptr;
+        unsigned *sq_array = nullptr;
+        unsigned *cq_head = nullptr;
+        unsigned *cq_tail = nullptr;
+        unsigned *cq_mask = nullptr;
+        io_uring_cqe *cqes = nullptr;
+        /**
+         * @brief Create ring and map its queues.
+         *
+         * @param depth Number of entries.
+         * @return true If ring is ready.
+         * @return false If io_uring is unavailable.
+         */
+        bool setup(const unsigned depth)
+        {
+            io_uring_params params;
+            std::memset(&params, 0, sizeof(params));
+            this->ring_fd = ::syscall(__NR_io_uring_setup, depth, &params);
+            if (this->ring_fd < 0)
+            {
+                return false;
+            }
+            if (!this->supports_write())
+            {
+                return false;
+            }
+            this->sq_ring_size =
+                params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            this->cq_ring_size =
+                params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            this->sq_ring = ::mmap(nullptr, this->sq_ring_size,
+                                   PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_POPULATE, this->ring_fd,
+                                   IORING_OFF_SQ_RING);
+            this->cq_ring = ::mmap(nullptr, this->cq_ring_size,
+                                   PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_POPULATE, this->ring_fd,
+                                   IORING_OFF_CQ_RING);
+            this->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+            void *sqes = ::mmap(nullptr, this->sqes_size,
+                                PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE, this->ring_fd,
+                                IORING_OFF_SQES);
+            this->sqes = static_cast<io_uring_sqe *>(sqes);
+            if (this->sq_ring == MAP_FAILED || this->cq_ring == MAP_FAILED ||
+                sqes == MAP_FAILED)
+            {
+                return false;
+            }
+            char *sq = static_cast<char *>(this->sq_ring);
+            char *cq = static_cast<char *>(this->cq_ring);
+            this->sq_head = reinterpret_cast<unsigned *>(sq +
+                                                         params.sq_off.head);
+            this->sq_tail = reinterpret_cast<unsigned *>(sq +
+                                                         params.sq_off.tail);
+            this->sq_mask =
+                reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+            this->sq_array =
+                reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+            this->cq_head = reinterpret_cast<unsigned *>(cq +
+                                                         params.cq_off.head);
+            this->cq_tail = reinterpret_cast<unsigned *>(cq +
+                                                         params.cq_off.tail);
+            this->cq_mask =
+                reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+            this->cqes = reinterpret_cast<io_uring_cqe *>(cq +
+                                                          params.cq_off.cqes);
+            return true;
+        }
+        /**
+         * @brief Check if kernel supports IORING_OP_WRITE.
+         *
+         * @details Probing and IORING_OP_WRITE both came with kernel 5.6,
+         * older kernels reject the probe.
+         *
+         * @return true If supported.
+         * @return false If not, or probe failed.
+         */
+        bool supports_write()
+        {
+            constexpr unsigned op_num = IORING_OP_WRITE + 1;
+            std::vector<char> memory(sizeof(io_uring_probe) +
+                                         op_num * sizeof(io_uring_probe_op),
+                                     0);
+            auto probe = reinterpret_cast<io_uring_probe *>(memory.data());
+            if (::syscall(__NR_io_uring_register, this->ring_fd,
+                          IORING_REGISTER_PROBE, probe, op_num) < 0)
+            {
+                return false;
+            }
+            return probe->last_op >= IORING_OP_WRITE &&
+                   (probe->ops[IORING_OP_WRITE].flags &
+                    IO_URING_OP_SUPPORTED);
+        }
+        /**
+         * @brief Unmap queues and close ring.
+         */
+        void teardown()
+        {
+            if (this->sqes != MAP_FAILED)
+            {
+                ::munmap(this->sqes, this->sqes_size);
+            }
+            if (this->cq_ring != MAP_FAILED)
+            {
+                ::munmap(this->cq_ring, this->cq_ring_size);
+            }
+            if (this->sq_ring != MAP_FAILED)
+            {
+                ::munmap(this->sq_ring, this->sq_ring_size);
+            }
+            if (this->ring_fd >= 0)
+            {
+                ::close(this->ring_fd);
+            }
+            this->sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+            this->cq_ring = MAP_FAILED;
+            this->sq_ring = MAP_FAILED;
+            this->ring_fd = -1;
+            this->usable = false;
+        }
+        /**
+         * @brief Submit entries and wait for completions.
+         *
+         * @param to_submit Number of entries to submit.
+         * @param min_complete Number of completions to wait for.
+         * @return true If entered.
+         * @return false If kernel failed with an error retrying can not fix.
+         */
+        bool enter(const unsigned to_submit, const unsigned min_complete)
+        {
+            unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+            while (::syscall(__NR_io_uring_enter, this->ring_fd, to_submit,
+                             min_complete, flags, nullptr, 0) < 0)
+            {
+                if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+        /**
+         * @brief Give up io_uring after a hard error.
+         *
+         * @details Completions of writes in flight can not be waited for, so
+         * every busy slot is written again synchronously. Writes are
+         * positional with the same bytes, so a write the kernel did finish
+         * is only repeated.
+         */
+        void fail()
+        {
+            std::cerr << "log2what::file_writer io_uring failed, "
+                         "falling back to write"
+                      << std::endl;
+            this->usable = false;
+            for (unsigned i = 0; i < this->slot_vector.size(); i++)
+            {
+                slot &s = this->slot_vector[i];
+                if (!s.busy)
+                {
+                    continue;
+                }
+                this->write_directly(s.fd, s.buffer.data(), s.buffer.size(),
+                                     s.offset);
+                s.buffer.clear();
+                s.busy = false;
+                this->free_vector.push_back(i);
+            }
+            this->in_flight = 0;
+        }
+        /**
+         * @brief Handle completed writes.
+         *
+         * @details Short writes are finished synchronously. If kernel rejects
+         * the operation, queue stops being ready and the write is done
+         * synchronously, so no log is lost.
+         *
+         * @param wait Wait for at least one completion.
+         */
+        void reap(const bool wait)
+        {
+            unsigned head = *this->cq_head;
+            if (wait &&
+                head == __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE) &&
+                !this->enter(0, 1))
+            {
+                this->fail();
+                return;
+            }
+            while (head != __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE))
+            {
+                io_uring_cqe &cqe = this->cqes[head & *this->cq_mask];
+                slot &s = this->slot_vector[cqe.user_data];
+                size_t done = cqe.res > 0 ? cqe.res : 0;
+                if (cqe.res == -EINVAL || cqe.res == -EOPNOTSUPP)
+                {
+                    this->usable = false;
+                }
+                if (done < s.buffer.size())
+                {
+                    this->write_directly(s.fd, s.buffer.data() + done,
+                                         s.buffer.size() - done,
+                                         s.offset + done);
+                }
+                s.buffer.clear();
+                s.busy = false;
+                this->free_vector.push_back(cqe.user_data);
+                this->in_flight--;
+                head++;
+                __atomic_store_n(this->cq_head, head, __ATOMIC_RELEASE);
+            }
+        }
+#endif
+    };
+} // namespace log2what
+#endif
\ No newline at end of file
@@ -0,0 +1,180 @@
+/**
+ * @file async_shell_test.cpp
+ * @author TNumFive
+ * @brief Tests of async shell.
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include "../async_shell/async_shell.hpp"
+#include "./check.hpp"
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <map>
+#include <vector>
+
+using namespace std;
+using namespace log2what;
+
+/**
+ * @brief What writer saw, outlives writer owned by shell.
+ */
+struct record
+{
+    atomic<size_t> written{0};
+    atomic<size_t> flushed{0};
+    atomic<size_t> flushes{0};
+    atomic<size_t> out_of_order{0};
+    map<string, long> last_sequence;
+};
+
+/**
+ * @brief Writer that checks order of logs, comment is sequence number per
+ * module, each write takes a while so callers fill the queue.
+ */
+class recording_writer : public writer
+{
+public:
+    recording_writer(record &seen, const int delay_micro = 0)
+        : seen{seen}, delay_micro{delay_micro}
+    {
+    }
+    void write(const log_level, const string &module, const string &comment,
+               const string &, const int64_t) override
+    {
+        long sequence = stol(comment);
+        auto found = this->seen.last_sequence.find(module);
+        if (found != this->seen.last_sequence.end() &&
+            found->second + 1 != sequence)
+        {
+            this->seen.out_of_order++;
+        }
+        this->seen.last_sequence[module] = sequence;
+        if (this->delay_micro)
+        {
+            auto until = chrono::steady_clock::now() +
+                         chrono::microseconds(this->delay_micro);
+            while (chrono::steady_clock::now() < until)
+            {
+            }
+        }
+        this->seen.written++;
+    }
+    void flush() override
+    {
+        this->seen.flushed.store(this->seen.written.load());
+        this->seen.flushes++;
+    }
+
+private:
+    record &seen;
+    int delay_micro;
+};
+
+/**
+ * @brief Logs of each caller are written in the order queued.
+ */
+static void test_order()
+{
+    constexpr int thread_num = 4;
+    constexpr long log_num = 50000;
+    record seen;
+    {
+        async_shell shell{unique_ptr<writer>{new recording_writer{seen}}, 64};
+        vector<thread> callers;
+        for (int t = 0; t < thread_num; t++)
+        {
+            callers.emplace_back([&shell, t]() {
+                string module = "caller" + to_string(t);
+                for (long i = 0; i < log_num; i++)
+                {
+                    shell.write(log_level::INFO, module, to_string(i), "");
+                }
+            });
+        }
+        for (auto &&caller : callers)
+        {
+            caller.join();
+        }
+        shell.flush();
+        CHECK(seen.written.load() == thread_num * log_num);
+        CHECK(seen.out_of_order.load() == 0);
+        CHECK(seen.last_sequence.size() == thread_num);
+    }
+}
+
+/**
+ * @brief flush() returns while callers keep the queue full, and writer is
+ * only flushed on request.
+ */
+static void test_flush_under_load()
+{
+    record seen;
+    {
+        async_shell shell{
+            unique_ptr<writer>{new recording_writer{seen, 2}}, 64};
+        atomic<bool> stop{false};
+        vector<thread> callers;
+        for (int t = 0; t < 4; t++)
+        {
+            callers.emplace_back([&shell, &stop, t]() {
+                string module = "load" + to_string(t);
+                for (long i = 0; !stop.load(); i++)
+                {
+                    shell.write(log_level::INFO, module, to_string(i), "");
+                }
+            });
+        }
+        // let the queue fill up first.
+        while (seen.written.load() < 1000)
+        {
+            this_thread::yield();
+        }
+        auto flushed = async(launch::async, [&]() { shell.flush(); });
+        bool returned = flushed.wait_for(chrono::seconds(10)) ==
+                        future_status::ready;
+        CHECK(returned);
+        CHECK(seen.flushes.load() == 1);
+        CHECK(seen.flushed.load() >= 1000);
+        stop.store(true);
+        for (auto &&caller : callers)
+        {
+            caller.join();
+        }
+        flushed.wait();
+        CHECK(seen.out_of_order.load() == 0);
+    }
+}
+
+/**
+ * @brief Logs queued before destruction are written and flushed once.
+ */
+static void test_drain_on_destruction()
+{
+    constexpr long log_num = 5000;
+    record seen;
+    {
+        async_shell shell{
+            unique_ptr<writer>{new recording_writer{seen, 20}}, 1024};
+        for (long i = 0; i < log_num; i++)
+        {
+            shell.write(log_level::INFO, "drain", to_string(i), "");
+        }
+        CHECK(seen.written.load() < log_num);
+    }
+    CHECK(seen.written.load() == log_num);
+    CHECK(seen.flushed.load() == log_num);
+    CHECK(seen.flushes.load() == 1);
+    CHECK(seen.out_of_order.load() == 0);
+}
+
+int main()
+{
+    test_order();
+    test_flush_under_load();
+    test_drain_on_destruction();
+    return check_result("async_shell_test");
+}
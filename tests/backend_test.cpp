@@ -0,0 +1,109 @@
+/**
+ * @file backend_test.cpp
+ * @author TNumFive
+ * @brief Tests of backend thread mode.
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include "../base/log2what.hpp"
+#include "./check.hpp"
+#include <mutex>
+#include <thread>
+
+using namespace std;
+using namespace log2what;
+
+/**
+ * @brief Writer that keeps timestamps and comments of logs.
+ */
+class recording_writer : public writer
+{
+public:
+    mutex record_mutex;
+    vector<pair<string, string>> records;
+    void write(const log_level, const string &module, const string &comment,
+               const string &, const int64_t) override
+    {
+        lock_guard<mutex> record_lock{this->record_mutex};
+        this->records.emplace_back(module, comment);
+    }
+};
+
+/**
+ * @brief Logs stamped ahead of clock are written without waiting for clock
+ * to catch up.
+ */
+static void test_future_timestamps()
+{
+    constexpr int64_t hour_nano = 3600LL * 1000000000;
+    constexpr int log_num = 1000;
+    recording_writer output;
+    {
+        backend merger{16};
+        merger.attach(&output);
+        int64_t future = get_nano_timestamp() + hour_nano;
+        for (int i = 0; i < log_num; i++)
+        {
+            merger.write(log_level::INFO, "test", to_string(i), "",
+                         future + i);
+        }
+        merger.flush();
+        CHECK(output.records.size() == log_num);
+    }
+    for (int i = 0; i < static_cast<int>(output.records.size()); i++)
+    {
+        CHECK(output.records[i].second == to_string(i));
+    }
+}
+
+/**
+ * @brief Logs of every thread keep their order, and logs of exited
+ * threads are all written.
+ */
+static void test_threads_in_order()
+{
+    constexpr int thread_num = 8;
+    constexpr int log_num = 20000;
+    recording_writer output;
+    {
+        backend merger{64};
+        merger.attach(&output);
+        vector<thread> threads;
+        for (int t = 0; t < thread_num; t++)
+        {
+            threads.emplace_back([&merger, t]() {
+                for (int i = 0; i < log_num; i++)
+                {
+                    merger.write(log_level::INFO, to_string(t), to_string(i),
+                                 "");
+                }
+            });
+        }
+        for (auto &t : threads)
+        {
+            t.join();
+        }
+    }
+    CHECK(output.records.size() == thread_num * log_num);
+    vector<int> next(thread_num, 0);
+    size_t disorder = 0;
+    for (auto &record : output.records)
+    {
+        int &expected = next[stoi(record.first)];
+        disorder += stoi(record.second) != expected;
+        expected++;
+    }
+    CHECK(disorder == 0);
+}
+
+int main()
+{
+    // a stalled queue would hang flush().
+    alarm(30);
+    test_future_timestamps();
+    test_threads_in_order();
+    return check_result("backend_test");
+}
@@ -0,0 +1,217 @@
+/**
+ * @file buffered_shell_test.cpp
+ * @author TNumFive
+ * @brief Tests of buffered_shell and log_ring.
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include "../buffered_shell/buffered_shell.hpp"
+#include "./check.hpp"
+#include <sys/wait.h>
+#include <thread>
+
+using namespace std;
+using namespace log2what;
+
+/**
+ * @brief Writer that keeps comments of logs.
+ */
+class comment_writer : public writer
+{
+public:
+    vector<string> *comments;
+    comment_writer(vector<string> *comments) : comments{comments} {}
+    void write(const log_level, const string &, const string &comment,
+               const string &, const int64_t) override
+    {
+        this->comments->push_back(comment);
+    }
+};
+
+/**
+ * @brief Run body in a thread that exits right after.
+ *
+ * @tparam Body Type of body.
+ * @param body Work of thread.
+ */
+template <typename Body> static void run_once(Body &&body)
+{
+    thread worker{body};
+    worker.join();
+}
+
+/**
+ * @brief Rings of exited threads are reused, so thread churn keeps rings
+ * and their files bounded.
+ */
+static void test_rings_of_exited_threads()
+{
+    string dir = make_test_dir("recorder");
+    vector<string> comments;
+    buffered_shell shell{log_level::ERROR,
+                         unique_ptr<writer>{new comment_writer{&comments}},
+                         16,
+                         0,
+                         1024,
+                         true,
+                         dir + "ring"};
+    // rings emptied by trigger are reused.
+    for (int i = 0; i < 100; i++)
+    {
+        run_once([&]() {
+            shell.write(log_level::INFO, "test", to_string(i), "", 0);
+        });
+        shell.write(log_level::ERROR, "test", "trigger", "", 0);
+    }
+    CHECK(list_files(dir, "ring.").size() == 1);
+    CHECK(comments.size() == 300);
+    // rings holding logs are kept up to a bound, oldest reused first.
+    comments.clear();
+    for (int i = 0; i < 200; i++)
+    {
+        run_once([&]() {
+            shell.write(log_level::INFO, "test", to_string(i), "", 0);
+        });
+    }
+    CHECK(list_files(dir, "ring.").size() <= 65);
+    shell.write(log_level::ERROR, "test", "trigger", "", 0);
+    CHECK(comments.size() >= 64 + 2);
+    CHECK(comments.size() > 2 && comments[comments.size() - 2] == "199");
+}
+
+/**
+ * @brief Fatal handler installed twice still ends the process with the
+ * signal, after marking the mapped ring.
+ */
+static void test_fatal_handler_twice()
+{
+    string path = make_test_dir("fatal") + "ring";
+    pid_t child = fork();
+    if (child == 0)
+    {
+        log_ring ring{4, 1024, path};
+        ring.push(1, log_level::INFO, "test", "last words", "");
+        log_ring::install_fatal_handler();
+        log_ring::install_fatal_handler();
+        ::raise(SIGABRT);
+        _exit(0);
+    }
+    int status = 0;
+    for (int i = 0; i < 500 && waitpid(child, &status, WNOHANG) == 0; i++)
+    {
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    if (waitpid(child, &status, WNOHANG) == 0)
+    {
+        kill(child, SIGKILL);
+        waitpid(child, &status, 0);
+        CHECK(!"handler loops");
+        return;
+    }
+    CHECK(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT);
+    log_ring_header header;
+    FILE *file = fopen(path.c_str(), "rb");
+    CHECK(file != nullptr && fread(&header, sizeof(header), 1, file) == 1);
+    CHECK(header.fatal_signal == SIGABRT && header.count == 1);
+    if (file != nullptr)
+    {
+        fclose(file);
+    }
+}
+
+/**
+ * @brief Ring file is removed on destruction once its logs are written,
+ * and kept while it holds logs.
+ */
+static void test_ring_file_removed_when_written()
+{
+    string dir = make_test_dir("ring_file");
+    {
+        log_ring empty_ring{4, 1024, dir + "empty"};
+        log_ring full_ring{4, 1024, dir + "full"};
+        empty_ring.push(1, log_level::INFO, "test", "written", "");
+        empty_ring.clear();
+        full_ring.push(1, log_level::INFO, "test", "kept", "");
+    }
+    CHECK(list_files(dir, "empty").empty());
+    CHECK(list_files(dir, "full").size() == 1);
+}
+
+/**
+ * @brief Logs older than before window are dropped, logs within after
+ * window are written after trigger.
+ */
+static void test_time_window()
+{
+    constexpr int64_t milli = 1000000;
+    vector<string> comments;
+    buffered_shell shell{log_level::ERROR,
+                         unique_ptr<writer>{new comment_writer{&comments}},
+                         100, 0};
+    shell.set_time_window(10, 5);
+    shell.write(log_level::INFO, "test", "expired", "", 1 * milli);
+    shell.write(log_level::INFO, "test", "kept", "", 15 * milli);
+    shell.write(log_level::ERROR, "test", "trigger", "", 20 * milli);
+    shell.write(log_level::INFO, "test", "within", "", 25 * milli);
+    shell.write(log_level::INFO, "test", "late", "", 26 * milli);
+    shell.write(log_level::ERROR, "test", "again", "", 30 * milli);
+    vector<string> expected{"begin", "kept",  "trigger", "within",
+                            "ended", "begin", "late",    "again"};
+    CHECK(comments == expected);
+}
+
+/**
+ * @brief Trigger writes logs of its own partition only, partitions beyond
+ * the limit reuse the least recently used one and its file.
+ */
+static void test_module_partition()
+{
+    string dir = make_test_dir("partition");
+    vector<string> comments;
+    buffered_shell shell{log_level::ERROR,
+                         unique_ptr<writer>{new comment_writer{&comments}},
+                         200,
+                         0,
+                         1 << 16,
+                         false,
+                         dir + "ring"};
+    shell.set_module_partition('.', 4);
+    shell.write(log_level::INFO, "net.tcp", "net log", "", 0);
+    shell.write(log_level::INFO, "disk", "disk log", "", 0);
+    shell.write(log_level::ERROR, "net.udp", "net trigger", "", 0);
+    vector<string> expected{"begin", "net log", "net trigger"};
+    CHECK(comments == expected);
+    // "disk" is used last, so it survives modules beyond the limit.
+    comments.clear();
+    for (int i = 0; i < 100; i++)
+    {
+        shell.write(log_level::INFO, "noisy" + to_string(i), "noise", "", 0);
+        shell.write(log_level::INFO, "disk", to_string(i), "", 0);
+    }
+    CHECK(list_files(dir, "ring.").size() <= 4);
+    shell.write(log_level::ERROR, "disk", "disk trigger", "", 0);
+    CHECK(comments.size() == 103);
+    CHECK(comments.size() > 2 && comments[1] == "disk log");
+    CHECK(comments.size() > 2 && comments[101] == "99");
+    comments.clear();
+    shell.write(log_level::ERROR, "noisy99", "noisy trigger", "", 0);
+    expected = {"begin", "noise", "noisy trigger"};
+    CHECK(comments == expected);
+    comments.clear();
+    shell.write(log_level::ERROR, "noisy0", "evicted trigger", "", 0);
+    expected = {"begin", "evicted trigger"};
+    CHECK(comments == expected);
+}
+
+int main()
+{
+    test_rings_of_exited_threads();
+    test_fatal_handler_twice();
+    test_ring_file_removed_when_written();
+    test_time_window();
+    test_module_partition();
+    return check_result("buffered_shell_test");
+}
@@ -0,0 +1,105 @@
+/**
+ * @file check.hpp
+ * @author TNumFive
+ * @brief Minimal checks shared by tests, a failed check is reported and
+ * makes the test exit with 1.
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#ifndef LOG2WHAT_TESTS_CHECK_HPP
+#define LOG2WHAT_TESTS_CHECK_HPP
+
+#include <cstdlib>
+#include <dirent.h>
+#include <iostream>
+#include <set>
+#include <string>
+#include <unistd.h>
+
+/**
+ * @brief Number of failed checks.
+ */
+inline int &check_failures()
+{
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(condition)                                                       \
+    do                                                                         \
+    {                                                                          \
+        if (!(condition))                                                      \
+        {                                                                      \
+            std::cerr << __FILE__ << ":" << __LINE__ << " check failed: "      \
+                      << #condition << std::endl;                              \
+            check_failures()++;                                                \
+        }                                                                      \
+    } while (0)
+
+/**
+ * @brief Create an empty directory for a test.
+ *
+ * @param name Name of test.
+ * @return std::string Path of directory, ends with '/'.
+ */
+inline std::string make_test_dir(const std::string &name)
+{
+    std::string dir = "/tmp/log2what_" + name + "_" + std::to_string(getpid());
+    std::string command = "rm -rf " + dir + " && mkdir -p " + dir;
+    if (std::system(command.c_str()) != 0)
+    {
+        std::cerr << "cannot create " << dir << std::endl;
+        std::exit(1);
+    }
+    return dir + "/";
+}
+
+/**
+ * @brief Names of files in directory that start with prefix.
+ *
+ * @param dir Directory.
+ * @param prefix Prefix of names.
+ * @return std::set<std::string> Names in order.
+ */
+inline std::set<std::string> list_files(const std::string &dir,
+                                        const std::string &prefix)
+{
+    std::set<std::string> names;
+    DIR *handle = opendir(dir.c_str());
+    if (handle == nullptr)
+    {
+        return names;
+    }
+    while (dirent *entry = readdir(handle))
+    {
+        std::string name = entry->d_name;
+        if (name.compare(0, prefix.size(), prefix) == 0)
+        {
+            names.insert(name);
+        }
+    }
+    closedir(handle);
+    return names;
+}
+
+/**
+ * @brief Report result of test.
+ *
+ * @param name Name of test.
+ * @return int Exit code.
+ */
+inline int check_result(const char *name)
+{
+    if (check_failures())
+    {
+        std::cerr << name << ": " << check_failures() << " failed" << std::endl;
+        return 1;
+    }
+    std::cout << name << ": ok" << std::endl;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,382 @@
+/**
+ * @file db_writer_test.cpp
+ * @author TNumFive
+ * @brief Tests of db_writer and db_cursor.
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include "../db_writer/db_cursor.hpp"
+#include "../db_writer/db_writer.hpp"
+#include "./check.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <sqlite3.h>
+
+using namespace std;
+using namespace log2what;
+
+/**
+ * @brief Set while allocations of this thread are counted.
+ */
+static thread_local bool counting_allocations = false;
+static thread_local size_t allocations = 0;
+
+void *operator new(size_t size)
+{
+    allocations += counting_allocations;
+    void *ptr = malloc(size ? size : 1);
+    if (ptr == nullptr)
+    {
+        throw bad_alloc{};
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept { free(ptr); }
+
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+
+/**
+ * @brief Writer that counts logs by level, used as logger of db_writer.
+ */
+class level_counter : public writer
+{
+public:
+    atomic<size_t> *counts;
+    level_counter(atomic<size_t> *counts) : counts{counts} {}
+    void write(const log_level level, const string &, const string &,
+               const string &, const int64_t) override
+    {
+        this->counts[level == log_level::ERROR ? 1 : 0]++;
+    }
+};
+
+/**
+ * @brief Count logs in database.
+ *
+ * @param path Path of database.
+ * @return int Number of logs, -1 if query failed.
+ */
+static int count_logs(const string &path)
+{
+    sqlite3 *db = nullptr;
+    sqlite3_stmt *stmt = nullptr;
+    int count = -1;
+    if (SQLITE_OK == sqlite3_open(path.c_str(), &db) &&
+        SQLITE_OK == sqlite3_prepare_v2(db, "select count(*) from log;", -1,
+                                        &stmt, nullptr) &&
+        SQLITE_ROW == sqlite3_step(stmt))
+    {
+        count = sqlite3_column_int(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    return count;
+}
+
+/**
+ * @brief Logs of a transaction that cannot commit reach logger of
+ * db_writer instead of vanishing.
+ */
+static void test_failed_commit_reported()
+{
+    string path = make_test_dir("db_commit") + "log.db";
+    atomic<size_t> counts[2] = {};
+    db_writer db{path, 100,
+                     unique_ptr<writer>{new level_counter{counts}}, 1000,
+                     false};
+    db.write(log_level::INFO, "test", "before", "", 0);
+    db.flush();
+    CHECK(counts[0].load() == 0);
+    // an unfinished read keeps a shared lock, so commit stays busy.
+    sqlite3 *reader = nullptr;
+    sqlite3_stmt *stmt = nullptr;
+    sqlite3_open(path.c_str(), &reader);
+    sqlite3_prepare_v2(reader, "select * from log;", -1, &stmt, nullptr);
+    CHECK(SQLITE_ROW == sqlite3_step(stmt));
+    for (int i = 0; i < 5; i++)
+    {
+        db.write(log_level::INFO, "test", to_string(i), "", 0);
+    }
+    db.flush();
+    CHECK(counts[0].load() == 5);
+    CHECK(counts[1].load() > 0);
+    sqlite3_finalize(stmt);
+    sqlite3_close(reader);
+    db.write(log_level::INFO, "test", "after", "", 0);
+    db.flush();
+    CHECK(counts[0].load() == 5);
+    CHECK(count_logs(path) == 2);
+}
+
+/**
+ * @brief Row rejected by a constraint added to log table goes to logger of
+ * db_writer alone, other rows of its statement are committed.
+ */
+static void test_constraint_failure_isolated()
+{
+    string path = make_test_dir("db_constraint") + "log.db";
+    atomic<size_t> counts[2] = {};
+    db_writer db{path, 100,
+                     unique_ptr<writer>{new level_counter{counts}}, 1000,
+                     false};
+    db.write(log_level::INFO, "test", "before", "", 0);
+    db.flush();
+    sqlite3 *other = nullptr;
+    sqlite3_open(path.c_str(), &other);
+    CHECK(SQLITE_OK ==
+          sqlite3_exec(other,
+                       "create trigger reject_bad before insert on log "
+                       "when new.comment = 'bad' begin "
+                       "select raise(abort, 'bad log'); end;",
+                       nullptr, nullptr, nullptr));
+    sqlite3_close(other);
+    for (int i = 0; i < 8; i++)
+    {
+        db.write(log_level::INFO, "test", i == 5 ? "bad" : to_string(i), "",
+                 0);
+    }
+    db.flush();
+    CHECK(counts[0].load() == 1);
+    CHECK(count_logs(path) == 8);
+}
+
+/**
+ * @brief Check if index exists in database.
+ *
+ * @param path Path of database.
+ * @param name Name of index.
+ * @return true Yes.
+ * @return false No.
+ */
+static bool has_index(const string &path, const char *name)
+{
+    sqlite3 *db = nullptr;
+    sqlite3_stmt *stmt = nullptr;
+    bool found = false;
+    if (SQLITE_OK == sqlite3_open(path.c_str(), &db) &&
+        SQLITE_OK == sqlite3_prepare_v2(
+                         db,
+                         "select 1 from sqlite_master where type='index' "
+                         "and name=?;",
+                         -1, &stmt, nullptr))
+    {
+        sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+        found = SQLITE_ROW == sqlite3_step(stmt);
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    return found;
+}
+
+/**
+ * @brief Cursor merges partitions in timestamp order while db_writer is
+ * still writing, and can be dropped in the middle of a query.
+ */
+static void test_cursor_over_partitions()
+{
+    string path = make_test_dir("db_cursor") + "log.db";
+    constexpr int64_t sec_to_nano = 1000000000;
+    constexpr int log_num = 3000;
+    int64_t start = get_nano_timestamp() / sec_to_nano * sec_to_nano;
+    db_writer db{path, 100, unique_ptr<writer>{new writer}, 1000, true, 1};
+    for (int i = 0; i < log_num; i++)
+    {
+        // three windows of one second, written out of window order.
+        int64_t timestamp = start + (i % 3) * sec_to_nano + i;
+        db.write(i % 2 ? log_level::INFO : log_level::WARN,
+                 i % 5 ? "net" : "disk", to_string(i), "", timestamp);
+        if (i % 500 == 499)
+        {
+            db.flush();
+        }
+    }
+    db.flush();
+    {
+        db_cursor cursor{path};
+        log item{0, log_level::TRACE, "", "", ""};
+        int count = 0;
+        int64_t last = INT64_MIN;
+        while (cursor.next(item))
+        {
+            CHECK(item.timestamp_nano >= last);
+            last = item.timestamp_nano;
+            count++;
+        }
+        CHECK(cursor.good());
+        CHECK(count == log_num);
+    }
+    {
+        db_cursor cursor{path, start, INT64_MAX,
+                         get_level_mask(log_level::WARN), "disk"};
+        log item{0, log_level::TRACE, "", "", ""};
+        int count = 0;
+        while (cursor.next(item))
+        {
+            CHECK(item.level == log_level::WARN && item.module == "disk");
+            count++;
+        }
+        CHECK(cursor.good());
+        CHECK(count == log_num / 10);
+    }
+    {
+        db_cursor cursor{path};
+        log item{0, log_level::TRACE, "", "", ""};
+        CHECK(cursor.next(item));
+    }
+    string dir = path.substr(0, path.size() - 6);
+    int partitions = 0;
+    for (auto &name : list_files(dir, "log.db.2"))
+    {
+        if (name.find('-') == string::npos)
+        {
+            CHECK(has_index(dir + name, "log_level_timestamp"));
+            CHECK(has_index(dir + name, "log_module_timestamp"));
+            partitions++;
+        }
+    }
+    CHECK(partitions == 3);
+}
+
+/**
+ * @brief Size limit counts rows still in the WAL file, which the main file
+ * only receives at checkpoint.
+ */
+static void test_partition_size_with_wal()
+{
+    string path = make_test_dir("db_wal_size") + "log.db";
+    constexpr int log_num = 2000;
+    const string data(512, 'x');
+    {
+        db_writer db{path, 100, unique_ptr<writer>{new writer}, 1000, true, 0,
+                     65536};
+        for (int i = 0; i < log_num; i++)
+        {
+            db.write(log_level::INFO, "test", to_string(i), data,
+                     get_nano_timestamp());
+            if (i % 100 == 99)
+            {
+                db.flush();
+            }
+        }
+    }
+    string dir = path.substr(0, path.size() - 6);
+    int partitions = 0;
+    for (auto &name : list_files(dir, "log.db.2"))
+    {
+        partitions += name.find('-') == string::npos;
+    }
+    CHECK(partitions > 1);
+}
+
+/**
+ * @brief Writing logs allocates nothing once queue cells have grown.
+ */
+static void test_write_allocation_free()
+{
+    string path = make_test_dir("db_alloc") + "log.db";
+    constexpr int warm_num = 10000;
+    constexpr int log_num = 1000;
+    const string module = "module_name_longer_than_sso";
+    const string comment(100, 'c');
+    const string data(50, 'd');
+    db_writer db{path};
+    // every cell of the queue gets filled once.
+    for (int i = 0; i < warm_num; i++)
+    {
+        db.write(log_level::INFO, module, comment, data, get_nano_timestamp());
+    }
+    db.flush();
+    counting_allocations = true;
+    for (int i = 0; i < log_num; i++)
+    {
+        db.write(log_level::INFO, module, comment, data, get_nano_timestamp());
+    }
+    counting_allocations = false;
+    CHECK(allocations == 0);
+    db.flush();
+}
+
+/**
+ * @brief Cursor queries come out of index in timestamp order, so nothing is
+ * sorted before the first row.
+ */
+static void test_cursor_plan_streams()
+{
+    string path = make_test_dir("db_plan") + "log.db";
+    {
+        db_writer db{path};
+        for (int i = 0; i < 100; i++)
+        {
+            db.write(i % 2 ? log_level::INFO : log_level::WARN, "net",
+                     to_string(i), "", get_nano_timestamp());
+        }
+    }
+    for (string module : {"", "net"})
+    {
+        db_cursor cursor{path, INT64_MIN, INT64_MAX,
+                         get_level_mask(log_level::TRACE), module};
+        string plan = cursor.query_plan();
+        CHECK(plan.size());
+        CHECK(plan.find("TEMP B-TREE") == string::npos);
+        log item{0, log_level::TRACE, "", "", ""};
+        int count = 0;
+        int64_t last = INT64_MIN;
+        while (cursor.next(item))
+        {
+            CHECK(item.timestamp_nano >= last);
+            last = item.timestamp_nano;
+            count++;
+        }
+        CHECK(count == 100);
+    }
+}
+
+/**
+ * @brief Logs of a database of schema version 1 stay readable by cursor
+ * after db_writer upgrades it.
+ */
+static void test_upgrade_from_v1()
+{
+    string path = make_test_dir("db_v1") + "log.db";
+    sqlite3 *db = nullptr;
+    CHECK(SQLITE_OK == sqlite3_open(path.c_str(), &db));
+    CHECK(SQLITE_OK ==
+          sqlite3_exec(db,
+                       "create table log(timestamp int primary key not null,"
+                       "level int, module text, comment text, data text);"
+                       "insert into log values(1, 4, 'old', 'first', '');"
+                       "insert into log values(3, 8, 'net', 'third', 'x');",
+                       nullptr, nullptr, nullptr));
+    sqlite3_close(db);
+    {
+        db_writer writer_v3{path};
+        writer_v3.write(log_level::INFO, "net", "second", "", 2);
+    }
+    db_cursor cursor{path};
+    log item{0, log_level::TRACE, "", "", ""};
+    vector<string> comments;
+    while (cursor.next(item))
+    {
+        comments.push_back(item.module + ":" + item.comment);
+    }
+    CHECK(cursor.good());
+    CHECK((comments ==
+           vector<string>{"old:first", "net:second", "net:third"}));
+}
+
+int main()
+{
+    test_failed_commit_reported();
+    test_constraint_failure_isolated();
+    test_cursor_over_partitions();
+    test_partition_size_with_wal();
+    test_write_allocation_free();
+    test_cursor_plan_streams();
+    test_upgrade_from_v1();
+    return check_result("db_writer_test");
+}
@@ -0,0 +1,153 @@
+/**
+ * @file fan_out_test.cpp
+ * @author TNumFive
+ * @brief Tests of fan out of log2lots.
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include "../base/log2what.hpp"
+#include "./check.hpp"
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace log2what;
+
+/**
+ * @brief Writer that counts logs and flushes, logs written since last flush
+ * are pending.
+ */
+class counting_writer : public writer
+{
+public:
+    atomic<size_t> written{0};
+    atomic<size_t> flushed{0};
+    atomic<size_t> flushes{0};
+    void write(const log_level, const string &, const string &,
+               const string &, const int64_t) override
+    {
+        this->written++;
+    }
+    void flush() override
+    {
+        this->flushed.store(this->written.load());
+        this->flushes++;
+    }
+};
+
+/**
+ * @brief Writer that takes a while per log, so callers keep its queue full.
+ */
+class slow_writer : public counting_writer
+{
+public:
+    void write(const log_level level, const string &module,
+               const string &comment, const string &data,
+               const int64_t timestamp_nano) override
+    {
+        auto until = chrono::steady_clock::now() + chrono::microseconds(2);
+        while (chrono::steady_clock::now() < until)
+        {
+        }
+        counting_writer::write(level, module, comment, data, timestamp_nano);
+    }
+};
+
+/**
+ * @brief Writers are flushed when fan out is flushed, not per batch.
+ */
+static void test_flush_on_request()
+{
+    constexpr size_t log_num = 100000;
+    auto first = new counting_writer;
+    auto second = new counting_writer;
+    {
+        log2lots logger{};
+        logger.append_writer(unique_ptr<writer>{first});
+        logger.append_writer(unique_ptr<writer>{second});
+        logger.enable_fan_out(64);
+        for (size_t i = 0; i < log_num; i++)
+        {
+            logger.info("log");
+        }
+        logger.flush();
+        CHECK(first->written.load() == log_num);
+        CHECK(first->flushed.load() == log_num);
+        CHECK(second->flushed.load() == log_num);
+        CHECK(first->flushes.load() == 1);
+        logger.info("last");
+        logger.flush();
+        CHECK(first->flushes.load() == 2);
+        CHECK(second->flushed.load() == log_num + 1);
+        logger.info("unflushed");
+    }
+}
+
+/**
+ * @brief Writers are flushed once more when fan out stops.
+ */
+static void test_flush_on_stop()
+{
+    auto only = new counting_writer;
+    log2lots *logger = new log2lots{};
+    logger->append_writer(unique_ptr<writer>{only});
+    logger->enable_fan_out();
+    logger->info("log");
+    // writer stays alive, fan out is stopped first.
+    logger->enable_backend();
+    CHECK(only->flushed.load() == 1);
+    delete logger;
+}
+
+/**
+ * @brief flush() returns while callers keep the queue of writer full.
+ */
+static void test_flush_under_load()
+{
+    auto slow = new slow_writer;
+    {
+        log2lots logger{};
+        logger.append_writer(unique_ptr<writer>{slow});
+        logger.enable_fan_out(64);
+        atomic<bool> stop{false};
+        vector<thread> callers;
+        for (int t = 0; t < 4; t++)
+        {
+            callers.emplace_back([&logger, &stop]() {
+                while (!stop.load())
+                {
+                    logger.info("load");
+                }
+            });
+        }
+        while (slow->written.load() < 1000)
+        {
+            this_thread::yield();
+        }
+        auto flushed = async(launch::async, [&]() { logger.flush(); });
+        bool returned = flushed.wait_for(chrono::seconds(10)) ==
+                        future_status::ready;
+        CHECK(returned);
+        CHECK(slow->flushes.load() == 1);
+        stop.store(true);
+        for (auto &&caller : callers)
+        {
+            caller.join();
+        }
+        flushed.wait();
+    }
+}
+
+int main()
+{
+    test_flush_on_request();
+    test_flush_on_stop();
+    test_flush_under_load();
+    return check_result("fan_out_test");
+}
@@ -0,0 +1,207 @@
+/**
+ * @file file_format_test.cpp
+ * @author TNumFive
+ * @brief Tests of compressed and binary files of file_writer read back by
+ * log2what-seek and log2what-decode.
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include "../file_writer/file_writer.hpp"
+#include "./check.hpp"
+#include <cstdio>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <vector>
+
+using namespace std;
+using namespace log2what;
+
+/**
+ * @brief Timestamp of first log written, 2023-11-14 22:13:20 UTC.
+ */
+static constexpr int64_t first_nano = 1700000000LL * 1000000000LL;
+static constexpr int64_t milli_to_nano = 1000000;
+
+/**
+ * @brief Run command and take what it prints.
+ *
+ * @param command Shell command.
+ * @param status Set to exit status of command.
+ * @return string Standard output of command.
+ */
+static string run(const string &command, int &status)
+{
+    string out;
+    FILE *pipe = popen(command.c_str(), "r");
+    if (pipe == nullptr)
+    {
+        status = -1;
+        return out;
+    }
+    char buffer[4096];
+    size_t got;
+    while ((got = fread(buffer, 1, sizeof(buffer), pipe)) > 0)
+    {
+        out.append(buffer, got);
+    }
+    status = pclose(pipe);
+    return out;
+}
+
+/**
+ * @brief Paths of log files with prefix, in order written.
+ *
+ * @param dir Directory of log files.
+ * @param prefix Prefix of log files.
+ * @return string Paths separated by space.
+ */
+static string file_args(const string &dir, const string &prefix)
+{
+    string args;
+    for (auto &name : list_files(dir, prefix))
+    {
+        args += " " + dir + name;
+    }
+    return args;
+}
+
+/**
+ * @brief Comments "log N" found in text logs, in order.
+ *
+ * @param text Logs in text layout.
+ * @return vector<int> Numbers of logs.
+ */
+static vector<int> log_numbers(const string &text)
+{
+    vector<int> numbers;
+    size_t pos = 0;
+    while ((pos = text.find("|%| log ", pos)) != string::npos)
+    {
+        pos += sizeof("|%| log ") - 1;
+        numbers.push_back(atoi(text.c_str() + pos));
+    }
+    return numbers;
+}
+
+/**
+ * @brief Compressed files are filled up to file_size, and every log is
+ * read back by log2what-seek, only blocks around a range when given one.
+ */
+static void test_compressed_seek()
+{
+    string dir = make_test_dir("compressed");
+    constexpr size_t file_size = 64 * KB;
+    constexpr int log_num = 20000;
+    {
+        file_writer writer{"c", dir, file_size, 0, file_format::COMPRESSED};
+        for (int i = 0; i < log_num; i++)
+        {
+            writer.write(log_level::INFO, "test", "log " + to_string(i),
+                         "data", first_nano + i * milli_to_nano);
+        }
+    }
+    auto names = list_files(dir, "c.log.");
+    CHECK(names.size() >= 2);
+    size_t filled = 0;
+    for (auto &name : names)
+    {
+        struct stat file_stat;
+        CHECK(stat((dir + name).c_str(), &file_stat) == 0);
+        CHECK(static_cast<size_t>(file_stat.st_size) <= file_size);
+        filled += file_stat.st_size > static_cast<off_t>(file_size / 2);
+    }
+    // every file but the last is more than half full.
+    CHECK(filled + 1 >= names.size());
+    int status = 0;
+    vector<int> numbers =
+        log_numbers(run("./log2what_seek" + file_args(dir, "c.log."), status));
+    CHECK(status == 0);
+    CHECK(numbers.size() == log_num);
+    bool in_order = true;
+    for (size_t i = 0; i < numbers.size(); i++)
+    {
+        in_order = in_order && numbers[i] == static_cast<int>(i);
+    }
+    CHECK(in_order);
+    // logs 10000 to 11000 are stamped in seconds 1700000010 to 1700000011.
+    numbers = log_numbers(run("./log2what_seek -f 1700000010 -t 1700000011" +
+                                  file_args(dir, "c.log."),
+                              status));
+    CHECK(status == 0);
+    CHECK(numbers.size() >= 1001 && numbers.size() < log_num / 2);
+    CHECK(numbers.size() && numbers.front() <= 10000 &&
+          numbers.back() >= 11000);
+}
+
+/**
+ * @brief Binary files are decoded back to the text layout by
+ * log2what-decode, modules included.
+ */
+static void test_binary_decode()
+{
+    string dir = make_test_dir("binary");
+    constexpr int log_num = 5000;
+    {
+        file_writer writer{"b", dir, 64 * KB, 0, file_format::BINARY};
+        for (int i = 0; i < log_num; i++)
+        {
+            writer.write(log_level::WARN, "module" + to_string(i % 3),
+                         "log " + to_string(i), "data",
+                         first_nano + i * milli_to_nano);
+        }
+    }
+    CHECK(list_files(dir, "b.log.").size() >= 2);
+    int status = 0;
+    string text =
+        run("./log2what_decode" + file_args(dir, "b.log."), status);
+    CHECK(status == 0);
+    vector<int> numbers = log_numbers(text);
+    CHECK(numbers.size() == log_num);
+    bool in_order = true;
+    for (size_t i = 0; i < numbers.size(); i++)
+    {
+        in_order = in_order && numbers[i] == static_cast<int>(i);
+    }
+    CHECK(in_order);
+    CHECK(text.find(" W module2 |%| log 4997 |%| data\n") !=
+          string::npos);
+}
+
+/**
+ * @brief Broken length of last record ends decoding with an error, logs
+ * before it are still decoded.
+ */
+static void test_decode_broken_length()
+{
+    string dir = make_test_dir("broken");
+    {
+        file_writer writer{"b", dir, MB, 0, file_format::BINARY};
+        writer.write(log_level::INFO, "test", "log 0", "", first_nano);
+    }
+    string path = dir + *list_files(dir, "b.log.").begin();
+    FILE *file = fopen(path.c_str(), "ab");
+    CHECK(file != nullptr);
+    if (file != nullptr)
+    {
+        // claims 4GB with a few bytes left.
+        uint32_t length = UINT32_MAX;
+        fwrite(&length, sizeof(length), 1, file);
+        fwrite("rest", 4, 1, file);
+        fclose(file);
+    }
+    int status = 0;
+    string text = run("./log2what_decode " + path + " 2>/dev/null", status);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 1);
+    CHECK(log_numbers(text) == vector<int>{0});
+}
+
+int main()
+{
+    test_compressed_seek();
+    test_binary_decode();
+    test_decode_broken_length();
+    return check_result("file_format_test");
+}
@@ -0,0 +1,264 @@
+/**
+ * @file file_writer_test.cpp
+ * @author TNumFive
+ * @brief Tests of file_writer rotation and retention.
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include "../file_writer/file_writer.hpp"
+#include "./check.hpp"
+#include <csignal>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace log2what;
+using std::chrono::milliseconds;
+
+/**
+ * @brief Write logs until current file is rotated by size.
+ *
+ * @param writer Writer to use.
+ * @param file_size File size of writer.
+ */
+static void fill_file(file_writer &writer, const size_t file_size)
+{
+    string comment(100, 'c');
+    for (size_t written = 0; written <= file_size; written += comment.size())
+    {
+        writer.write(log_level::INFO, "test", comment, "");
+    }
+    writer.flush();
+}
+
+/**
+ * @brief A closed file is kept retention_sec after it is closed, not after
+ * the segment following it was pre-created.
+ */
+static void test_retention_from_close()
+{
+    string dir = make_test_dir("retention");
+    constexpr size_t file_size = 2000;
+    file_writer writer{"r", dir, file_size, 0, file_format::TEXT,
+                       file_mode::STREAM, rotation_policy::SIZE, 0, 2};
+    writer.write(log_level::INFO, "test", "first", "");
+    writer.flush();
+    string first = *list_files(dir, "r.log.").begin();
+    this_thread::sleep_for(milliseconds(1500));
+    // first file closes here, next segment was created 1.5s ago.
+    fill_file(writer, file_size);
+    auto names = list_files(dir, "r.log.");
+    CHECK(names.size() >= 2);
+    CHECK(*next(names.begin()) > first);
+    this_thread::sleep_for(milliseconds(1000));
+    CHECK(list_files(dir, "r.log.").count(first) == 1);
+    this_thread::sleep_for(milliseconds(1700));
+    CHECK(list_files(dir, "r.log.").count(first) == 0);
+}
+
+/**
+ * @brief Count lines of log files, and zero bytes in them.
+ *
+ * @param dir Directory of log files.
+ * @param prefix Prefix of log files.
+ * @param zeros Set to number of zero bytes.
+ * @return int Number of lines.
+ */
+static int count_lines(const string &dir, const string &prefix, int &zeros)
+{
+    int lines = 0;
+    zeros = 0;
+    for (auto &name : list_files(dir, prefix))
+    {
+        FILE *file = fopen((dir + name).c_str(), "rb");
+        int c;
+        while (file != nullptr && (c = fgetc(file)) != EOF)
+        {
+            zeros += c == 0;
+            lines += c == '\n';
+        }
+        if (file != nullptr)
+        {
+            fclose(file);
+        }
+    }
+    return lines;
+}
+
+/**
+ * @brief Logs of many threads are all found in mapped files rotated many
+ * times, with no zero padding left.
+ */
+static void test_mapped_rotation()
+{
+    string dir = make_test_dir("mapped");
+    constexpr int thread_num = 4;
+    constexpr int log_num = 20000;
+    {
+        file_writer writer{"m", dir, 64 * KB, 0, file_format::TEXT,
+                           file_mode::MMAP};
+        vector<thread> threads;
+        for (int t = 0; t < thread_num; t++)
+        {
+            threads.emplace_back([&writer]() {
+                for (int i = 0; i < log_num; i++)
+                {
+                    writer.write(log_level::INFO, "test", to_string(i), "");
+                }
+            });
+        }
+        for (auto &t : threads)
+        {
+            t.join();
+        }
+    }
+    int zeros = 0;
+    CHECK(count_lines(dir, "m.log.", zeros) == thread_num * log_num);
+    CHECK(zeros == 0);
+    CHECK(list_files(dir, "m.log.").size() > 10);
+}
+
+/**
+ * @brief Mapped file that cannot grow is written by system calls instead
+ * of raising SIGBUS.
+ */
+static void test_mapped_grow_failure()
+{
+    string dir = make_test_dir("mapped_limit");
+    pid_t child = fork();
+    if (child == 0)
+    {
+        // files cannot grow past 100KB, ftruncate fails with EFBIG.
+        signal(SIGXFSZ, SIG_IGN);
+        if (freopen("/dev/null", "w", stderr) == nullptr)
+        {
+            _exit(1);
+        }
+        rlimit limit{100 * KB, 100 * KB};
+        setrlimit(RLIMIT_FSIZE, &limit);
+        file_writer writer{"g", dir, MB, 0, file_format::TEXT,
+                           file_mode::MMAP};
+        string comment(60, 'c');
+        for (int i = 0; i < 5000; i++)
+        {
+            writer.write(log_level::INFO, "test", comment, "");
+        }
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    int zeros = 0;
+    int lines = count_lines(dir, "g.log.", zeros);
+    CHECK(lines > static_cast<int>(64 * KB / 100));
+    CHECK(zeros == 0);
+}
+
+/**
+ * @brief Rotating many times in a millisecond keeps every log and gives
+ * files strictly increasing names.
+ */
+static void test_fast_rotation()
+{
+    string dir = make_test_dir("fast_rotation");
+    constexpr int log_num = 3000;
+    {
+        file_writer writer{"f", dir, 300, 0};
+        string comment(60, 'c');
+        for (int i = 0; i < log_num; i++)
+        {
+            writer.write(log_level::INFO, "test", comment, "");
+        }
+    }
+    int zeros = 0;
+    CHECK(count_lines(dir, "f.log.", zeros) == log_num);
+    CHECK(list_files(dir, "f.log.").size() >= log_num / 3);
+}
+
+/**
+ * @brief Replace ring of io_uring with a file that is not a ring.
+ *
+ * @return true If a ring was found.
+ * @return false No ring, io_uring is unavailable.
+ */
+static bool break_uring()
+{
+    bool found = false;
+    DIR *dir = opendir("/proc/self/fd");
+    for (auto entry = dir ? readdir(dir) : nullptr; entry != nullptr;
+         entry = readdir(dir))
+    {
+        char target[64] = {};
+        string link = string("/proc/self/fd/") + entry->d_name;
+        if (readlink(link.c_str(), target, sizeof(target) - 1) > 0 &&
+            string(target).find("io_uring") != string::npos)
+        {
+            int null_fd = open("/dev/null", O_WRONLY);
+            dup2(null_fd, atoi(entry->d_name));
+            close(null_fd);
+            found = true;
+        }
+    }
+    if (dir != nullptr)
+    {
+        closedir(dir);
+    }
+    return found;
+}
+
+/**
+ * @brief A hard error of io_uring_enter falls back to plain writes instead
+ * of hanging flush and close, and loses no log.
+ */
+static void test_uring_enter_failure()
+{
+    string dir = make_test_dir("uring_fail");
+    constexpr int log_num = 5000;
+    pid_t child = fork();
+    if (child == 0)
+    {
+        // a hang is killed instead of blocking the test.
+        alarm(20);
+        if (freopen("/dev/null", "w", stderr) == nullptr)
+        {
+            _exit(1);
+        }
+        {
+            file_writer writer{"u", dir, MB, 0, file_format::TEXT,
+                               file_mode::URING};
+            writer.write(log_level::INFO, "test", "first", "");
+            writer.flush();
+            break_uring();
+            string comment(60, 'c');
+            for (int i = 1; i < log_num; i++)
+            {
+                writer.write(log_level::INFO, "test", comment, "");
+            }
+            writer.flush();
+        }
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    int zeros = 0;
+    CHECK(count_lines(dir, "u.log.", zeros) == log_num);
+    CHECK(zeros == 0);
+}
+
+int main()
+{
+    test_retention_from_close();
+    test_fast_rotation();
+    test_mapped_rotation();
+    test_mapped_grow_failure();
+    test_uring_enter_failure();
+    return check_result("file_writer_test");
+}
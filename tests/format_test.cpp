@@ -0,0 +1,79 @@
+/**
+ * @file format_test.cpp
+ * @author TNumFive
+ * @brief Tests of deferred formatting and format string checks.
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include "../base/log2what.hpp"
+#include "./check.hpp"
+
+using namespace std;
+using namespace log2what;
+
+static_assert(count_placeholders("no placeholder") == 0, "");
+static_assert(count_placeholders("{} and {}") == 2, "");
+static_assert(count_placeholders("{{}} escaped {}") == 1, "");
+static_assert(count_placeholders("unmatched {") == bad_format_string, "");
+
+/**
+ * @brief Logger that keeps comments of logs.
+ */
+class recording_logger : public logger
+{
+public:
+    vector<string> comments;
+    void write(const log_level, const string &comment,
+               const string &) override
+    {
+        this->comments.push_back(comment);
+    }
+};
+
+/**
+ * @brief Checked macros format like the methods they call.
+ */
+static void test_checked_macros()
+{
+    recording_logger output;
+    int value = 7;
+    const int &value_ref = value;
+    LOG2WHAT_INFOF(output, "plain");
+    LOG2WHAT_INFOF(output, "value {} of {}", value_ref, 10);
+    LOG2WHAT_ERRORF(output, "{{{}}} {}", "text", 1.5);
+#ifdef LOG2WHAT_FORMAT_MISMATCH
+    // must fail to compile: one placeholder short
+    LOG2WHAT_INFOF(output, "mismatch {} {}", 1);
+#endif
+#ifdef LOG2WHAT_FORMAT_UNCHECKED
+    // must fail to compile: not checked with C++17, mismatch with C++20
+    output.infof("a {} b {}", 1);
+#endif
+    CHECK(output.comments.size() == 3);
+    CHECK(output.comments[0] == "plain");
+    CHECK(output.comments[1] == "value 7 of 10");
+    CHECK(output.comments[2] == "{text} 1.5");
+}
+
+/**
+ * @brief Disabled level skips formatting and arguments.
+ */
+static void test_disabled_level()
+{
+    recording_logger output;
+    output.set_level(log_level::WARN);
+    int evaluated = 0;
+    LOG2WHAT_INFOF(output, "value {}", ++evaluated);
+    CHECK(evaluated == 0);
+    CHECK(output.comments.empty());
+}
+
+int main()
+{
+    test_checked_macros();
+    test_disabled_level();
+    return check_result("format_test");
+}
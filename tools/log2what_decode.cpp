@@ -0,0 +1,150 @@
+/**
+ * @file log2what_decode.cpp
+ * @author TNumFive
+ * @brief Tool that converts binary log files of file_writer back to text.
+ * @version 0.1
+ * @date 2023-02-13
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details Build with:
+ * g++ -o log2what-decode tools/log2what_decode.cpp
+ * Usage:
+ * log2what-decode FILE... > out.log
+ */
+#include "../base/common.hpp"
+#include "../base/time_format.hpp"
+#include "../base/binary_log.hpp"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+using namespace log2what;
+using namespace std;
+
+/**
+ * @brief Write one log in the text layout of file_writer.
+ *
+ * @param out Output stream.
+ * @param timestamp_nano Timestamp in nanoseconds.
+ * @param level Log level.
+ * @param module Module name.
+ * @param comment Content of log.
+ * @param data Data attached.
+ */
+static void write_text(ostream &out, const int64_t timestamp_nano,
+                       const log_level level, const string &module,
+                       const string &comment, const string &data)
+{
+    char buffer[timestamp_buffer_size];
+    out.write(buffer, format_timestamp(timestamp_nano, buffer));
+    out << " " << to_string(level);
+    out << " " << module;
+    out << " |%| " << comment;
+    out << " |%| " << data << "\n";
+}
+
+/**
+ * @brief Decode one binary log file to text.
+ *
+ * @param file_path Path of binary log file.
+ * @param out Output stream.
+ * @return true If whole file decoded.
+ * @return false If file is not binary log file or is truncated.
+ */
+static bool decode(const string &file_path, ostream &out)
+{
+    ifstream in{file_path, ios::binary | ios::ate};
+    if (!in.is_open())
+    {
+        cerr << file_path << ": open failed" << endl;
+        return false;
+    }
+    const uint64_t file_size = in.tellg();
+    in.seekg(0);
+    char magic[binary_log_magic_size];
+    in.read(magic, sizeof(magic));
+    if (in.gcount() != sizeof(magic) ||
+        memcmp(magic, binary_log_magic, sizeof(magic)) != 0)
+    {
+        cerr << file_path << ": not a binary log file" << endl;
+        return false;
+    }
+    unordered_map<uint32_t, string> module_map;
+    string record;
+    string comment, data;
+    while (true)
+    {
+        uint32_t length;
+        in.read(reinterpret_cast<char *>(&length), sizeof(length));
+        if (in.gcount() == 0)
+        {
+            return true;
+        }
+        // length is checked against what is left before it sizes anything,
+        // a broken one may claim up to 4GB.
+        if (in.gcount() != sizeof(length) || length == 0 ||
+            length > file_size - static_cast<uint64_t>(in.tellg()))
+        {
+            cerr << file_path << ": truncated record at the end" << endl;
+            return false;
+        }
+        record.resize(length);
+        if (!in.read(&record[0], length))
+        {
+            cerr << file_path << ": truncated record at the end" << endl;
+            return false;
+        }
+        const char *cursor = record.data();
+        const char *end = cursor + record.size();
+        auto type =
+            static_cast<binary_record_type>(read_binary<uint8_t>(cursor));
+        if (type == binary_record_type::MODULE &&
+            end - cursor >= static_cast<ptrdiff_t>(sizeof(uint32_t)))
+        {
+            uint32_t id = read_binary<uint32_t>(cursor);
+            module_map[id].assign(cursor, end);
+            continue;
+        }
+        constexpr size_t body_size =
+            binary_log_fixed_size - sizeof(uint32_t) - sizeof(uint8_t);
+        if (type != binary_record_type::LOG ||
+            end - cursor < static_cast<ptrdiff_t>(body_size))
+        {
+            cerr << file_path << ": unknown record skipped" << endl;
+            continue;
+        }
+        int64_t timestamp_nano = read_binary<int64_t>(cursor);
+        auto level = static_cast<log_level>(read_binary<uint8_t>(cursor));
+        uint32_t module_id = read_binary<uint32_t>(cursor);
+        uint32_t comment_size = read_binary<uint32_t>(cursor);
+        if (comment_size > static_cast<size_t>(end - cursor))
+        {
+            cerr << file_path << ": broken record skipped" << endl;
+            continue;
+        }
+        comment.assign(cursor, comment_size);
+        data.assign(cursor + comment_size, end);
+        write_text(out, timestamp_nano, level, module_map[module_id], comment,
+                   data);
+    }
+}
+
+int main(int argc, char const *argv[])
+{
+    if (argc < 2)
+    {
+        cerr << "usage: " << argv[0] << " FILE..." << endl;
+        return 2;
+    }
+    int ret = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!decode(argv[i], cout))
+        {
+            ret = 1;
+        }
+    }
+    return ret;
+}
\ No newline at end of file
@@ -0,0 +1,166 @@
+/**
+ * @file log2what_recover.cpp
+ * @author TNumFive
+ * @brief Tool that extracts logs from ring files of buffered_shell.
+ * @version 0.1
+ * @date 2023-02-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details Build with:
+ * g++ -std=c++17 -o log2what-recover tools/log2what_recover.cpp
+ * Usage:
+ * log2what-recover [-n N] FILE... > out.log
+ * Writes last N logs (all by default) of each ring file in text layout of
+ * file_writer. Fatal signal marked by log_ring::install_fatal_handler() is
+ * reported on stderr. Ring of last run is renamed with suffix ".prev" when
+ * the process starts again.
+ */
+#include "../base/common.hpp"
+#include "../base/time_format.hpp"
+#include "../buffered_shell/log_ring.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+using namespace log2what;
+using namespace std;
+
+/**
+ * @brief Write one log in the text layout of file_writer.
+ *
+ * @param out Output stream.
+ * @param timestamp_nano Timestamp in nanoseconds.
+ * @param level Log level.
+ * @param module Module name.
+ * @param comment Content of log.
+ * @param data Data attached.
+ */
+static void write_text(ostream &out, const int64_t timestamp_nano,
+                       const log_level level, const string &module,
+                       const string &comment, const string &data)
+{
+    char buffer[timestamp_buffer_size];
+    out.write(buffer, format_timestamp(timestamp_nano, buffer));
+    out << " " << to_string(level);
+    out << " " << module;
+    out << " |%| " << comment;
+    out << " |%| " << data << "\n";
+}
+
+/**
+ * @brief Write last logs of one ring file.
+ *
+ * @param file_path Path of ring file.
+ * @param last How many logs from newest.
+ * @param out Output stream.
+ * @return true If all logs wanted are valid.
+ * @return false If file is not a ring file or some logs are broken.
+ */
+static bool recover(const string &file_path, const size_t last, ostream &out)
+{
+    ifstream in{file_path, ios::binary};
+    if (!in.is_open())
+    {
+        cerr << file_path << ": open failed" << endl;
+        return false;
+    }
+    string region{istreambuf_iterator<char>(in), istreambuf_iterator<char>()};
+    log_ring_header header;
+    if (region.size() < sizeof(header) ||
+        memcmp(region.data(), log_ring_magic, log_ring_magic_size) != 0)
+    {
+        cerr << file_path << ": not a ring file" << endl;
+        return false;
+    }
+    memcpy(&header, region.data(), sizeof(header));
+    size_t slots_offset = sizeof(header);
+    size_t arena_offset =
+        slots_offset + header.max_count * sizeof(log_ring_slot);
+    if (header.version != log_ring_version ||
+        arena_offset + header.max_bytes != region.size() ||
+        header.count > header.max_count ||
+        (header.max_count && header.head >= header.max_count))
+    {
+        cerr << file_path << ": broken header" << endl;
+        return false;
+    }
+    if (header.fatal_signal)
+    {
+        char buffer[timestamp_buffer_size];
+        cerr << file_path << ": process " << header.pid << " got signal "
+             << header.fatal_signal << " at ";
+        cerr.write(buffer, format_timestamp(header.fatal_timestamp, buffer));
+        cerr << endl;
+    }
+    const char *arena = region.data() + arena_offset;
+    size_t first = header.count > last ? header.count - last : 0;
+    bool good = true;
+    for (size_t i = first; i < header.count; i++)
+    {
+        log_ring_slot slot;
+        memcpy(&slot,
+               region.data() + slots_offset +
+                   (header.head + i) % header.max_count * sizeof(slot),
+               sizeof(slot));
+        log_ring_record record;
+        if (slot.size < sizeof(record) || slot.offset > header.max_bytes ||
+            slot.size > header.max_bytes - slot.offset)
+        {
+            cerr << file_path << ": broken log skipped" << endl;
+            good = false;
+            continue;
+        }
+        const char *cursor = arena + slot.offset;
+        memcpy(&record, cursor, sizeof(record));
+        cursor += sizeof(record);
+        if (sizeof(record) + static_cast<uint64_t>(record.module_size) +
+                record.comment_size + record.data_size !=
+            slot.size)
+        {
+            cerr << file_path << ": broken log skipped" << endl;
+            good = false;
+            continue;
+        }
+        string module{cursor, record.module_size};
+        cursor += record.module_size;
+        string comment{cursor, record.comment_size};
+        cursor += record.comment_size;
+        string data{cursor, record.data_size};
+        write_text(out, record.timestamp_nano,
+                   static_cast<log_level>(record.level), module, comment, data);
+    }
+    return good;
+}
+
+int main(int argc, char const *argv[])
+{
+    size_t last = SIZE_MAX;
+    int i = 1;
+    if (i + 1 < argc && strcmp(argv[i], "-n") == 0)
+    {
+        char *end = nullptr;
+        last = strtoull(argv[i + 1], &end, 10);
+        if (end == argv[i + 1] || *end != '\0')
+        {
+            cerr << argv[i] << " " << argv[i + 1] << ": bad option" << endl;
+            return 2;
+        }
+        i += 2;
+    }
+    if (i >= argc)
+    {
+        cerr << "usage: " << argv[0] << " [-n N] FILE..." << endl;
+        return 2;
+    }
+    int ret = 0;
+    for (; i < argc; i++)
+    {
+        if (!recover(argv[i], last, cout))
+        {
+            ret = 1;
+        }
+    }
+    return ret;
+}
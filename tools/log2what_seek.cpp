@@ -0,0 +1,252 @@
+/**
+ * @file log2what_seek.cpp
+ * @author TNumFive
+ * @brief Tool that reads compressed log files of file_writer by time range.
+ * @version 0.1
+ * @date 2023-02-20
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details Build with the codec file_writer is built with, for example:
+ * g++ -DLOG2WHAT_COMPRESS_ZLIB -o log2what-seek tools/log2what_seek.cpp -lz
+ * Usage:
+ * log2what-seek [-f FROM] [-t TO] FILE... > out.log
+ * FROM and TO are "YYYY-MM-DD HH:MM:SS" in local time or seconds since epoch.
+ * Only blocks covering the range are read and decompressed, so output may
+ * have some logs around the range.
+ */
+#include "../base/common.hpp"
+#include "../file_writer/block_log.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace log2what;
+using namespace std;
+
+#if !LOG2WHAT_HAS_COMPRESSION
+#error "define LOG2WHAT_COMPRESS_ZLIB, LOG2WHAT_COMPRESS_LZ4 or ZSTD"
+#endif
+
+/**
+ * @brief Parse time given in command line.
+ *
+ * @param text Local time or seconds since epoch.
+ * @param timestamp_nano Parsed timestamp in nanoseconds.
+ * @return true If parsed.
+ * @return false If malformed.
+ */
+static bool parse_time(const char *text, int64_t &timestamp_nano)
+{
+    constexpr int64_t sec_to_nano = 1000000000;
+    char *end = nullptr;
+    long long sec = strtoll(text, &end, 10);
+    if (end != text && *end == '\0')
+    {
+        timestamp_nano = sec * sec_to_nano;
+        return true;
+    }
+    tm lt;
+    memset(&lt, 0, sizeof(lt));
+    end = strptime(text, "%Y-%m-%d %H:%M:%S", &lt);
+    if (end == nullptr || *end != '\0')
+    {
+        return false;
+    }
+    lt.tm_isdst = -1;
+    timestamp_nano = static_cast<int64_t>(mktime(&lt)) * sec_to_nano;
+    return true;
+}
+
+/**
+ * @brief Read index written at the end of closed file.
+ *
+ * @param in Opened file.
+ * @param file_size Size of file.
+ * @param index Index read.
+ * @return true If file has a valid index.
+ * @return false If file is not closed properly.
+ */
+static bool read_index(ifstream &in, const size_t file_size,
+                       vector<block_index_entry> &index)
+{
+    if (file_size < block_log_header_size + block_footer_size)
+    {
+        return false;
+    }
+    char footer[block_footer_size];
+    in.seekg(file_size - block_footer_size);
+    if (!in.read(footer, sizeof(footer)) ||
+        memcmp(footer + sizeof(uint64_t) * 2, block_index_magic,
+               block_index_magic_size) != 0)
+    {
+        return false;
+    }
+    const char *cursor = footer;
+    uint64_t index_offset = read_binary<uint64_t>(cursor);
+    uint64_t count = read_binary<uint64_t>(cursor);
+    if (index_offset + count * block_index_entry_size + block_footer_size !=
+        file_size)
+    {
+        return false;
+    }
+    string buffer(count * block_index_entry_size, '\0');
+    in.seekg(index_offset);
+    if (count && !in.read(&buffer[0], buffer.size()))
+    {
+        return false;
+    }
+    cursor = buffer.data();
+    for (uint64_t i = 0; i < count; i++)
+    {
+        block_index_entry entry;
+        entry.first_timestamp = read_binary<int64_t>(cursor);
+        entry.last_timestamp = read_binary<int64_t>(cursor);
+        entry.offset = read_binary<uint64_t>(cursor);
+        index.push_back(entry);
+    }
+    return true;
+}
+
+/**
+ * @brief Build index by walking block headers, for files cut by crash.
+ *
+ * @param in Opened file.
+ * @param file_size Size of file.
+ * @param index Index built.
+ */
+static void scan_blocks(ifstream &in, const size_t file_size,
+                        vector<block_index_entry> &index)
+{
+    uint64_t offset = block_log_header_size;
+    char header[block_header_size];
+    while (offset + block_header_size <= file_size)
+    {
+        in.seekg(offset);
+        if (!in.read(header, sizeof(header)))
+        {
+            return;
+        }
+        const char *cursor = header;
+        uint32_t stored_size = read_binary<uint32_t>(cursor);
+        read_binary<uint32_t>(cursor);
+        block_index_entry entry;
+        entry.first_timestamp = read_binary<int64_t>(cursor);
+        entry.last_timestamp = read_binary<int64_t>(cursor);
+        entry.offset = offset;
+        if (offset + block_header_size + stored_size > file_size)
+        {
+            return;
+        }
+        index.push_back(entry);
+        offset += block_header_size + stored_size;
+    }
+}
+
+/**
+ * @brief Write logs of blocks covering time range.
+ *
+ * @param file_path Path of compressed log file.
+ * @param from Start of range in nanoseconds.
+ * @param to End of range in nanoseconds.
+ * @param out Output stream.
+ * @return true If all blocks needed are read.
+ * @return false If file is not compressed log file or is broken.
+ */
+static bool seek(const string &file_path, const int64_t from,
+                 const int64_t to, ostream &out)
+{
+    ifstream in{file_path, ios::binary | ios::ate};
+    if (!in.is_open())
+    {
+        cerr << file_path << ": open failed" << endl;
+        return false;
+    }
+    size_t file_size = in.tellg();
+    char header[block_log_header_size];
+    in.seekg(0);
+    if (!in.read(header, sizeof(header)) ||
+        memcmp(header, block_log_magic, block_log_magic_size) != 0)
+    {
+        cerr << file_path << ": not a compressed log file" << endl;
+        return false;
+    }
+    const char *cursor = header + block_log_magic_size;
+    auto codec = static_cast<block_codec>(read_binary<uint32_t>(cursor));
+    if (codec != compiled_block_codec)
+    {
+        cerr << file_path << ": written with another codec" << endl;
+        return false;
+    }
+    vector<block_index_entry> index;
+    if (!read_index(in, file_size, index))
+    {
+        in.clear();
+        scan_blocks(in, file_size, index);
+    }
+    string payload, raw;
+    for (auto &entry : index)
+    {
+        if (entry.last_timestamp < from || entry.first_timestamp > to)
+        {
+            continue;
+        }
+        char block_header[block_header_size];
+        in.seekg(entry.offset);
+        in.read(block_header, sizeof(block_header));
+        cursor = block_header;
+        uint32_t stored_size = read_binary<uint32_t>(cursor);
+        uint32_t raw_size = read_binary<uint32_t>(cursor);
+        payload.resize(stored_size);
+        if (!in.read(&payload[0], stored_size) ||
+            !decompress_block(payload.data(), stored_size, raw_size, raw))
+        {
+            cerr << file_path << ": broken block skipped" << endl;
+            in.clear();
+            continue;
+        }
+        out.write(raw.data(), raw.size());
+    }
+    return true;
+}
+
+int main(int argc, char const *argv[])
+{
+    int64_t from = INT64_MIN;
+    int64_t to = INT64_MAX;
+    int i = 1;
+    for (; i + 1 < argc && argv[i][0] == '-'; i += 2)
+    {
+        bool parsed = false;
+        if (strcmp(argv[i], "-f") == 0)
+        {
+            parsed = parse_time(argv[i + 1], from);
+        }
+        else if (strcmp(argv[i], "-t") == 0)
+        {
+            parsed = parse_time(argv[i + 1], to);
+        }
+        if (!parsed)
+        {
+            cerr << argv[i] << " " << argv[i + 1] << ": bad option" << endl;
+            return 2;
+        }
+    }
+    if (i >= argc)
+    {
+        cerr << "usage: " << argv[0] << " [-f FROM] [-t TO] FILE..." << endl;
+        return 2;
+    }
+    int ret = 0;
+    for (; i < argc; i++)
+    {
+        if (!seek(argv[i], from, to, cout))
+        {
+            ret = 1;
+        }
+    }
+    return ret;
+}
\ No newline at end of file